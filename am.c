@@ -1,10 +1,11 @@
 // $Id: am.c,v 1.39 2018/12/05 07:08:01 karn Exp $
-// AM envelope demodulator thread for 'radio'
+// AM envelope demodulator for 'radio'
 // Copyright Oct 9 2017, Phil Karn, KA9Q
 #define _GNU_SOURCE 1
 #include <complex.h>
 #include <math.h>
 #include <assert.h>
+#include <stdlib.h>
 #include <pthread.h>
 
 #include "misc.h"
@@ -12,72 +13,89 @@
 #include "filter.h"
 #include "radio.h"
 
-void *demod_am(void *arg){
-  pthread_setname("am");
-  assert(arg != NULL);
-  struct demod * const demod = arg;
+// State kept between blocks
+struct am {
+  float samptime;        // Time between (decimated) samples
+  float recovery_factor; // AGC ramp-up rate/sample
+  int hangmax;           // samples before AGC increase
+  int hangcount;
+  float DC_filter;       // DC removal from envelope-detected AM and coherent AM
+};
+
+int start_am(struct demod * const demod){
+  assert(demod != NULL);
+  struct am * const am = calloc(1,sizeof(*am));
+  if(am == NULL)
+    return -1;
+  demod->demod_state = am;
 
   // Set derived (and other) constants
-  float const samptime = demod->filter.decimate / (float)demod->input.samprate;  // Time between (decimated) samples
+  am->samptime = demod->filter.decimate / (float)demod->input.samprate;  // Time between (decimated) samples
 
   // AGC
   // I originally just kept the carrier at constant amplitude
   // but this fails when selective fading takes out the carrier, resulting in loud, distorted audio
-  int hangcount = 0;
-  float const recovery_factor = dB2voltage(demod->agc.recovery_rate * samptime); // AGC ramp-up rate/sample
+  am->recovery_factor = dB2voltage(demod->agc.recovery_rate * am->samptime); // AGC ramp-up rate/sample
   //  float const attack_factor = dB2voltage(demod->agc.attack_rate * samptime);      // AGC ramp-down rate/sample
-  int const hangmax = demod->agc.hangtime / samptime; // samples before AGC increase
+  am->hangmax = demod->agc.hangtime / am->samptime; // samples before AGC increase
   demod->agc.gain = dB2voltage(80.); // Empirical
 
-  // DC removal from envelope-detected AM and coherent AM
-  float DC_filter = 0;
-  float const DC_filter_coeff = .0001;
-
   demod->output.channels = 1; // Mono
 
   // Detection filter
   struct filter_out * const filter = create_filter_output(demod->filter.in,NULL,demod->filter.decimate,COMPLEX);
   demod->filter.out = filter;
-  set_filter(filter,samptime*demod->filter.low,samptime*demod->filter.high,demod->filter.kaiser_beta);
+  filter->min_phase = demod->filter.min_phase;
+  set_filter(filter,am->samptime*demod->filter.low,am->samptime*demod->filter.high,demod->filter.kaiser_beta);
+  return 0;
+}
 
-  while(!demod->terminate){
-    // New samples
-    execute_filter_output(filter);    
-    if(!isnan(demod->sig.n0))
-      demod->sig.n0 += .001 * (compute_n0(demod) - demod->sig.n0); // Update noise estimate
-    else
-      demod->sig.n0 = compute_n0(demod); // Happens at startup
+// Demodulate one block
+void demod_am(struct demod * const demod){
+  struct am * const am = demod->demod_state;
+  struct filter_out * const filter = demod->filter.out;
+  float const DC_filter_coeff = .0001;
+
+  // New samples
+  downconvert(demod);
+  if(!isnan(demod->sig.n0))
+    demod->sig.n0 += .001 * (compute_n0(demod) - demod->sig.n0); // Update noise estimate
+  else
+    demod->sig.n0 = compute_n0(demod); // Happens at startup
 
-    // AM envelope detector
-    float signal = 0;
-    float noise = 0;
-    float samples[filter->olen];
-    for(int n=0; n<filter->olen; n++){
-      float const sampsq = cnrmf(filter->output.c[n]);
-      signal += sampsq;
-      float samp = sqrtf(sampsq);
-      
-      // Remove carrier DC from audio
-      // DC_filter will always be positive since sqrtf() is positive
-      DC_filter += DC_filter_coeff * (samp - DC_filter);
-      
-      if(isnan(demod->agc.gain)){
-	demod->agc.gain = demod->agc.headroom / DC_filter;
-      } else if(demod->agc.gain * DC_filter > demod->agc.headroom){
-	demod->agc.gain = demod->agc.headroom / DC_filter;
-	hangcount = hangmax;
-      } else if(hangcount != 0){
-	hangcount--;
-      } else {
-	demod->agc.gain *= recovery_factor;
-      }
-      samples[n] = (samp - DC_filter) * demod->agc.gain;
+  // AM envelope detector
+  float signal = 0;
+  float noise = 0;
+  float samples[filter->olen];
+  for(int n=0; n<filter->olen; n++){
+    float const sampsq = cnrmf(filter->output.c[n]);
+    signal += sampsq;
+    float samp = sqrtf(sampsq);
+    
+    // Remove carrier DC from audio
+    // DC_filter will always be positive since sqrtf() is positive
+    am->DC_filter += DC_filter_coeff * (samp - am->DC_filter);
+    
+    if(isnan(demod->agc.gain)){
+      demod->agc.gain = demod->agc.headroom / am->DC_filter;
+    } else if(demod->agc.gain * am->DC_filter > demod->agc.headroom){
+      demod->agc.gain = demod->agc.headroom / am->DC_filter;
+      am->hangcount = am->hangmax;
+    } else if(am->hangcount != 0){
+      am->hangcount--;
+    } else {
+      demod->agc.gain *= am->recovery_factor;
     }
-    send_mono_output(demod,samples,filter->olen);
-    // Scale to each sample so baseband power will display correctly
-    demod->sig.bb_power = (signal + noise) / (2*filter->olen);
-  } // terminate
-  delete_filter_output(filter);
+    samples[n] = (samp - am->DC_filter) * demod->agc.gain;
+  }
+  send_mono_output(demod,samples,filter->olen);
+  // Scale to each sample so baseband power will display correctly
+  demod->sig.bb_power = (signal + noise) / (2*filter->olen);
+}
+
+void stop_am(struct demod * const demod){
+  delete_filter_output(demod->filter.out);
   demod->filter.out = NULL;
-  pthread_exit(NULL);
+  free(demod->demod_state);
+  demod->demod_state = NULL;
 }
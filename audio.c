@@ -11,13 +11,13 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <complex.h>
+#undef I
 
 #include "misc.h"
 #include "multicast.h"
 #include "radio.h"
-
-#define PCM_BUFSIZE 480        // 16-bit word count; must fit in Ethernet MTU
-#define PACKETSIZE 2048        // Somewhat larger than Ethernet MTU
+#include "decimate.h"
 
 static short const scaleclip(float const x){
   if(x >= 1.0)
@@ -27,10 +27,43 @@ static short const scaleclip(float const x){
   return (short)(SHRT_MAX * x);
 }
   
+// Write 'frames' frames of 'channels' 16-bit samples to the output file instead of the network, silence and all
+// The filter's delay is dropped from the start and the end comes when the input's did,
+// so the file's length always matches the input's
+static int write_pcm(struct demod * const demod,float const *buffer,int frames,int const channels){
+  long long const done = latency_clock();
+  int16_t PCM_buf[PCM_BUFSIZE];
 
-// Send 'size' stereo samples, each in a pair of floats
-int send_stereo_output(struct demod * const demod,float const * buffer,int size){
+  int const skip = min(demod->output.pcm_skip,(long long)frames);
+  demod->output.pcm_skip -= skip;
+  buffer += skip * channels;
+  frames -= skip;
+  long long const left = atomic_load(&demod->output.pcm_frames);
+  if(frames > left)
+    frames = left > 0 ? left : 0;
+  atomic_fetch_sub(&demod->output.pcm_frames,frames);
+  int cnt = frames * channels;
+  while(cnt > 0){
+    int const chunk = min(PCM_BUFSIZE,cnt);
+    for(int i=0; i < chunk; i++)
+      PCM_buf[i] = scaleclip(*buffer++);
+    if(fwrite(PCM_buf,sizeof(*PCM_buf),chunk,demod->output.pcm_file) != chunk){
+      perror("pcm: write");
+      return -1;
+    }
+    demod->output.rtp.bytes += sizeof(*PCM_buf) * chunk;
+    cnt -= chunk;
+  }
+  output_latency(demod,done,latency_clock());
+  return 0;
+}
 
+// Send 'size' stereo samples, each in a pair of floats, at the output rate
+static int send_stereo(struct demod * const demod,float const * buffer,int size){
+  if(demod->output.pcm_file != NULL)
+    return write_pcm(demod,buffer,size,2);
+
+  long long const done = latency_clock();
   struct rtp_header rtp;
   memset(&rtp,0,sizeof(rtp));
   rtp.type = PCM_STEREO_PT;         // 16 bit linear, big endian, stereo
@@ -60,13 +93,14 @@ int send_stereo_output(struct demod * const demod,float const * buffer,int size)
       } else
 	rtp.marker = 0;
       rtp.seq = demod->output.rtp.seq++;
-      unsigned char packet[PACKETSIZE],*dp;
-      dp = packet;
+      unsigned char * const packet = send_buffer(demod->output.msend);
+      unsigned char *dp = packet;
 
       dp = hton_rtp(dp,&rtp);
       memcpy(dp,PCM_buf,2*chunk);
-      dp += 2*chunk;
-      int r = send(demod->output.fd,&packet,dp - packet,0);
+      dp += 2 * chunk;
+
+      int r = queue_send(demod->output.msend,dp - packet);
       if(r < 0){
 	perror("pcm: send");
 	break;
@@ -75,12 +109,18 @@ int send_stereo_output(struct demod * const demod,float const * buffer,int size)
       demod->output.silent = 1;
     size -= chunk/2;
   }
+  // Everything from this call goes out together
+  flush_send(demod->output.msend);
+  output_latency(demod,done,latency_clock());
   return 0;
 }
 
-// Send 'size' mono samples, each in a float
-int send_mono_output(struct demod * const demod,float const * buffer,int size){
+// Send 'size' mono samples, each in a float, at the output rate
+static int send_mono(struct demod * const demod,float const * buffer,int size){
+  if(demod->output.pcm_file != NULL)
+    return write_pcm(demod,buffer,size,1);
 
+  long long const done = latency_clock();
   struct rtp_header rtp;
   memset(&rtp,0,sizeof(rtp));
   rtp.version = RTP_VERS;
@@ -112,14 +152,14 @@ int send_mono_output(struct demod * const demod,float const * buffer,int size){
       } else
 	rtp.marker = 0;
       rtp.seq = demod->output.rtp.seq++;
-      unsigned char packet[PACKETSIZE];
+      unsigned char * const packet = send_buffer(demod->output.msend);
       unsigned char *dp = packet;
 
       dp = hton_rtp(dp,&rtp);
       memcpy(dp,PCM_buf,2*chunk);
       dp += 2 * chunk;
 
-      int r = send(demod->output.fd,&packet,dp - packet,0);
+      int r = queue_send(demod->output.msend,dp - packet);
       if(r < 0){
 	perror("pcm: send");
 	break;
@@ -128,6 +168,9 @@ int send_mono_output(struct demod * const demod,float const * buffer,int size){
       demod->output.silent = 1;
     size -= chunk;
   }
+  // Everything from this call goes out together
+  flush_send(demod->output.msend);
+  output_latency(demod,done,latency_clock());
   return 0;
 }
 
@@ -136,6 +179,10 @@ void output_cleanup(void *p){
   if(demod == NULL)
     return;
 
+  if(demod->output.msend){
+    delete_msend(demod->output.msend);
+    demod->output.msend = NULL;
+  }
   if(demod->output.fd > 0){
     close(demod->output.fd);
     demod->output.fd = -1;
@@ -156,6 +203,10 @@ int setup_output(struct demod * const demod,int ttl){
     return -1;
   socklen_t len = sizeof(demod->output.source_address);
   getsockname(demod->output.fd,(struct sockaddr *)&demod->output.source_address,&len);
+  // Each call to send_mono_output()/send_stereo_output() is flushed as one batch
+  demod->output.msend = create_msend(demod->output.fd,0,PCM_PKTSIZE);
+  if(demod->output.msend == NULL)
+    return -1;
 
   demod->output.rtcp_fd = setup_mcast(demod->output.dest_address_text,NULL,1,ttl,1);
   if(demod->output.rtcp_fd == -1)
@@ -167,3 +218,42 @@ int setup_output(struct demod * const demod,int ttl){
 
   return 0;
 }
+
+// Send 'size' stereo samples at the channel's decimated rate, resampling them to the output rate if it's different
+// Left and right go through the resampler as I and Q
+int send_stereo_output(struct demod * const demod,float const * buffer,int size){
+  struct resampler * const rs = demod->output.resampler;
+  if(rs == NULL)
+    return send_stereo(demod,buffer,size);
+
+  complex float out[resample_count(rs,size) + 1];
+  int const n = resample_complex(rs,out,(complex float const *)buffer,size);
+  return send_stereo(demod,(float *)out,n);
+}
+
+// Send 'size' mono samples at the channel's decimated rate, resampling them to the output rate if it's different
+int send_mono_output(struct demod * const demod,float const * buffer,int size){
+  struct resampler * const rs = demod->output.resampler;
+  if(rs == NULL)
+    return send_mono(demod,buffer,size);
+
+  complex float samples[size];
+  for(int i=0; i < size; i++)
+    samples[i] = buffer[i];
+  complex float out[resample_count(rs,size) + 1];
+  int const n = resample_complex(rs,out,samples,size);
+  float mono[n + 1];
+  for(int i=0; i < n; i++)
+    mono[i] = crealf(out[i]);
+  return send_mono(demod,mono,n);
+}
+
+// Account for 'size' samples at the channel's decimated rate that were skipped over as silence instead of sent,
+// so the output timestamps stay on the input's timeline. The next packet sent carries the marker
+void skip_output(struct demod * const demod,long long size){
+  struct resampler * const rs = demod->output.resampler;
+  if(rs != NULL)
+    size = resample_skip(rs,size);
+  demod->output.rtp.timestamp += size;
+  demod->output.silent = 1;
+}
@@ -0,0 +1,900 @@
+// Benchmark the DSP hot paths without any SDR hardware or network
+// Drives the fast convolution filters, half-band decimators, oscillators, noise estimator,
+// PCM packetizer and the AM, FM and linear demodulator threads on synthetic signals,
+// reporting each as samples/sec, ns/sample and multiple of real time
+// Also compares the front end decimation chains: the all-half-band cascade hackrf.c uses
+// for power-of-2 ratios against half-band stages followed by a polyphase L/M resampler,
+// and against doing the whole job in one polyphase stage, and lists what the channel decimation planner picks
+// Also checks that an ISB channel tuned between FFT bins splits its sidebands at the carrier, that output
+// timestamps survive a skipped input gap and that carriers don't raise the noise floor; exits nonzero if not
+// Copyright 2026, ka9q-radio contributors. GPL v3, see LICENSE
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(linux)
+#include <bsd/string.h>
+#endif
+#include <math.h>
+#include <complex.h>
+#include <fftw3.h>
+#undef I
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "misc.h"
+#include "decimate.h"
+#include "dsp.h"
+#include "filter.h"
+#include "osc.h"
+#include "multicast.h"
+#include "radio.h"
+#include "pool.h"
+
+// Globals the radio modules expect from main.c
+char Libdir[PATH_MAX] = "/usr/local/share/ka9q-radio";
+int Verbose;
+
+int Blocksize = 350;   // Output samples per call, as in hackrf.c
+double Seconds = 2;    // Minimum run time for each speed test
+float Resamp_order = 30; // Resampler taps per branch, times L/M; as in hackrf.c
+float Resamp_beta = 3;
+int Failures;          // Checks that didn't come out right; the exit status
+
+// Radio defaults, from main.c and a 192 kHz front end
+int const Samprate = 192000;
+int const Out_samprate = 48000;
+float const Radio_block_time = 0.020;
+float const Radio_transition = 140;
+float const Radio_beta = 3.0;
+
+static double now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+// Call fn(arg) repeatedly for at least Seconds; it returns samples handled per call
+// Print throughput against the rate the samples would arrive at in real time
+static void run_case(char const *name,double samprate,long (*fn)(void *),void *arg){
+  long long samples = 0;
+  double const start = now();
+  double elapsed;
+  do {
+    for(int k=0; k < 10; k++)
+      samples += (*fn)(arg);
+    elapsed = now() - start;
+  } while(elapsed < Seconds);
+  double const rate = samples / elapsed;
+  printf("%-40s %10.0f %14.0f %10.3f %10.1f\n",name,samprate,rate,1e9 / rate,rate / samprate);
+}
+
+static void header(char const *section){
+  printf("\n%s\n",section);
+  printf("%-40s %10s %14s %10s %10s\n","case","samp Hz","samples/s","ns/samp","x realtime");
+}
+
+// Gaussian-ish noise plus an FM carrier at 'offset' Hz, for the demodulators to chew on
+static void make_signal(complex float *buffer,int cnt,double samprate,double offset){
+  double phase = 0;
+  for(int i=0; i < cnt; i++){
+    // 1 kHz tone, 3 kHz deviation
+    double const f = offset + 3000 * sin(2 * M_PI * 1000 * i / samprate);
+    phase += 2 * M_PI * f / samprate;
+    buffer[i] = 0.1 * CMPLXF(cos(phase),sin(phase))
+      + 0.001 * CMPLXF(drand48() + drand48() - 1,drand48() + drand48() - 1);
+  }
+}
+
+// Fast convolution filter, input and output halves together
+struct filter_case {
+  char const *name;
+  int L,M,decimate;
+  enum filtertype in_type,out_type;
+  float low,high;         // Passband, fraction of output sample rate
+  int samprate;           // Input sample rate
+  int partitions;         // 0 or 1 if not partitioned
+  struct filter_in *master;
+  struct filter_out *slave;
+  void *input;            // One block of input, copied in each time as proc_samples does
+};
+
+struct filter_case Filter_cases[] = {
+  { "C->C   L3840 M4353 /4 (radio)",      3840, 4353, 4, COMPLEX, COMPLEX,    -0.2,  0.2, 192000 },
+  { "C->ISB L3840 M4353 /4",              3840, 4353, 4, COMPLEX, CROSS_CONJ, -0.2,  0.2, 192000 },
+  { "C->R   L3840 M4353 /4",              3840, 4353, 4, COMPLEX, REAL,       0.01,  0.2, 192000 },
+  { "C->C   L3840 M4353 /1",              3840, 4353, 1, COMPLEX, COMPLEX,    -0.2,  0.2, 192000 },
+  { "C->C   L3840 M4353 /8",              3840, 4353, 8, COMPLEX, COMPLEX,    -0.2,  0.2, 192000 },
+  { "C->C   L7680 M8705 /4 (low latency)",7680, 8705, 4, COMPLEX, COMPLEX,    -0.2,  0.2, 384000 },
+  { "C->C   L960 M961 x5 /4 (partitioned)", 960,  961, 4, COMPLEX, COMPLEX,    -0.2,  0.2, 192000, 5 },
+  { "R->R   L960 M1089 /1 (FM audio)",     960, 1089, 1, REAL,    REAL,       0.01,  0.2,  48000 },
+  { "R->C   L960 M1089 /1 (packet)",       960, 1089, 1, REAL,    COMPLEX,    0.01,  0.2,  48000 },
+};
+#define NFILTERS (sizeof(Filter_cases)/sizeof(Filter_cases[0]))
+
+static long filter_block(void *arg){
+  struct filter_case * const fc = arg;
+  if(fc->in_type == COMPLEX)
+    memcpy(fc->master->input.c,fc->input,fc->L * sizeof(complex float));
+  else
+    memcpy(fc->master->input.r,fc->input,fc->L * sizeof(float));
+  execute_filter_input(fc->master);
+  // Tune off center as a channel would, except where the spectrum can't be rotated
+  execute_filter_output(fc->slave,fc->in_type == COMPLEX ? 123 : 0);
+  return fc->L;
+}
+
+static void bench_filters(void){
+  header("fast convolution filters (per input sample)");
+  for(int i=0; i < NFILTERS; i++){
+    struct filter_case * const fc = &Filter_cases[i];
+    fc->master = create_partitioned_filter_input(fc->L,fc->M,max(1,fc->partitions),fc->in_type);
+    fc->slave = create_filter_output(fc->master,NULL,fc->decimate,fc->out_type);
+    set_filter(fc->slave,fc->low,fc->high,3.0);
+    if(fc->in_type == COMPLEX){
+      complex float * const input = malloc(fc->L * sizeof(*input));
+      make_signal(input,fc->L,fc->samprate,10000);
+      fc->input = input;
+    } else {
+      float * const input = malloc(fc->L * sizeof(*input));
+      for(int j=0; j < fc->L; j++)
+	input[j] = 0.1 * sin(2 * M_PI * 1000 * j / fc->samprate) + 0.001 * (drand48() - 0.5);
+      fc->input = input;
+    }
+    run_case(fc->name,fc->samprate,filter_block,fc);
+    free(fc->input);
+    delete_filter_output(fc->slave);
+    delete_filter_input(fc->master);
+  }
+}
+
+// Single half-band stages, at the hackrf A/D rate
+struct hb_case {
+  int cnt;               // Output samples per call
+  float *real;
+  complex float *cplx;
+  struct hb15_state hb15;
+  float hb3_state;
+  complex float hb3_cstate;
+};
+
+static long hb15_real(void *arg){
+  struct hb_case * const hc = arg;
+  hb15_block(&hc->hb15,hc->real,hc->real,hc->cnt);
+  return 2 * hc->cnt;
+}
+static long hb3_real(void *arg){
+  struct hb_case * const hc = arg;
+  hb3_block(&hc->hb3_state,hc->real,hc->real,hc->cnt);
+  return 2 * hc->cnt;
+}
+static long hb15_cplx(void *arg){
+  struct hb_case * const hc = arg;
+  hb15_block_complex(&hc->hb15,hc->cplx,hc->cplx,hc->cnt);
+  return 2 * hc->cnt;
+}
+static long hb3_cplx(void *arg){
+  struct hb_case * const hc = arg;
+  hb3_block_complex(&hc->hb3_cstate,hc->cplx,hc->cplx,hc->cnt);
+  return 2 * hc->cnt;
+}
+
+static void bench_halfbands(void){
+  header("half-band decimators (per input sample)");
+  struct hb_case hc;
+  memset(&hc,0,sizeof(hc));
+  hc.cnt = Blocksize << 5; // As in hackrf's first stage
+  hc.real = malloc(2 * hc.cnt * sizeof(*hc.real));
+  hc.cplx = malloc(2 * hc.cnt * sizeof(*hc.cplx));
+  // In-place decimation leaves the second half of the buffer alone, so this stays non-zero
+  for(int i=0; i < 2 * hc.cnt; i++){
+    hc.real[i] = drand48() - 0.5;
+    hc.cplx[i] = CMPLXF(drand48() - 0.5,drand48() - 0.5);
+  }
+  hc.hb15.coeffs[3] = 490./802;
+  hc.hb15.coeffs[2] = -116./802;
+  hc.hb15.coeffs[1] = 33./802;
+  hc.hb15.coeffs[0] = -6./802;
+
+  double const samprate = 12288000;
+  run_case("hb15_block",samprate,hb15_real,&hc);
+  run_case("hb3_block",samprate,hb3_real,&hc);
+  run_case("hb15_block_complex",samprate,hb15_cplx,&hc);
+  run_case("hb3_block_complex",samprate,hb3_cplx,&hc);
+  free(hc.real);
+  free(hc.cplx);
+}
+
+// Oscillators, at the demodulator output rate where they mostly run
+struct osc_case {
+  struct osc osc;
+  int cnt;
+  complex float *buffer;
+};
+
+static long osc_step(void *arg){
+  struct osc_case * const oc = arg;
+  for(int i=0; i < oc->cnt; i++)
+    oc->buffer[i] *= step_osc(&oc->osc);
+  return oc->cnt;
+}
+static long osc_mix(void *arg){
+  struct osc_case * const oc = arg;
+  mix_osc(&oc->osc,oc->buffer,oc->cnt);
+  return oc->cnt;
+}
+static long osc_block(void *arg){
+  struct osc_case * const oc = arg;
+  block_osc(&oc->osc,oc->buffer,oc->cnt);
+  return oc->cnt;
+}
+
+static void bench_oscs(void){
+  header("oscillators (per sample)");
+  struct osc_case oc;
+  memset(&oc,0,sizeof(oc));
+  pthread_mutex_init(&oc.osc.mutex,NULL);
+  oc.cnt = Samprate * Radio_block_time / 4;
+  oc.buffer = malloc(oc.cnt * sizeof(*oc.buffer));
+  for(int i=0; i < oc.cnt; i++)
+    oc.buffer[i] = 1;
+  set_osc(&oc.osc,1234.5 / Out_samprate,0);
+  run_case("step_osc (one call per sample)",Out_samprate,osc_step,&oc);
+  run_case("mix_osc",Out_samprate,osc_mix,&oc);
+  run_case("block_osc",Out_samprate,osc_block,&oc);
+  set_osc(&oc.osc,1234.5 / Out_samprate,1e-3 / ((double)Out_samprate * Out_samprate));
+  run_case("mix_osc, sweeping",Out_samprate,osc_mix,&oc);
+  free(oc.buffer);
+}
+
+// A radio channel, set up as main.c and radio_status.c would but with no SDR or display
+// Its PCM goes to a loopback socket nobody reads; the kernel drops it
+static int setup_demod(struct demod *demod){
+  memset(demod,0,sizeof(*demod));
+  demod->input.samprate = demod->sdr.status.samprate = Samprate;
+  demod->output.samprate = Out_samprate;
+  demod->filter.decimate = Samprate / Out_samprate;
+  demod->filter.interpolate = 1;
+  demod->filter.kaiser_beta = Radio_beta;
+  plan_blocksize(Samprate,Radio_block_time,Radio_transition,Radio_beta,&demod->filter.L,&demod->filter.M,&demod->filter.partitions);
+  demod->filter.low = demod->filter.high = NAN;
+  demod->agc.headroom = pow(10.,-15./20);
+  demod->tune.shift = NAN;
+  demod->sig.n0 = NAN;
+  demod->sdr.imbalance = 1;
+  demod->sdr.gain_factor = 1;
+  demod->sdr.status.frequency = 10e6;
+  demod->sdr.min_IF = -0.45 * Samprate;
+  demod->sdr.max_IF = +0.45 * Samprate;
+  demod->tune.freq = demod->sdr.status.frequency + 12345; // Off center, so the input spectrum is rotated
+  pthread_mutex_init(&demod->doppler.mutex,NULL);
+  pthread_mutex_init(&demod->second_LO.mutex,NULL);
+  pthread_mutex_init(&demod->shift.mutex,NULL);
+  pthread_mutex_init(&demod->fine.mutex,NULL);
+  pthread_mutex_init(&demod->sdr.status_mutex,NULL);
+  pthread_cond_init(&demod->sdr.status_cond,NULL);
+
+  int const sink = socket(AF_INET,SOCK_DGRAM,0);
+  struct sockaddr_in sin;
+  memset(&sin,0,sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(sin);
+  if(sink == -1 || bind(sink,(struct sockaddr *)&sin,sizeof(sin)) != 0 || getsockname(sink,(struct sockaddr *)&sin,&len) != 0){
+    perror("bench: loopback sink");
+    return -1;
+  }
+  demod->output.fd = socket(AF_INET,SOCK_DGRAM,0);
+  if(demod->output.fd == -1 || connect(demod->output.fd,(struct sockaddr *)&sin,sizeof(sin)) != 0){
+    perror("bench: loopback source");
+    return -1;
+  }
+  demod->output.rtcp_fd = sink; // Just so cleanup_demod() can find it
+  demod->output.rtp.ssrc = 1;
+  demod->output.msend = create_msend(demod->output.fd,0,PCM_PKTSIZE);
+  if(demod->output.msend == NULL)
+    return -1;
+  demod->filter.in = create_filter_input(demod->filter.L,demod->filter.M,COMPLEX);
+  return 0;
+}
+
+static void cleanup_demod(struct demod *demod){
+  delete_msend(demod->output.msend);
+  close(demod->output.fd);
+  close(demod->output.rtcp_fd);
+  delete_filter_input(demod->filter.in);
+  pthread_mutex_destroy(&demod->doppler.mutex);
+  pthread_mutex_destroy(&demod->second_LO.mutex);
+  pthread_mutex_destroy(&demod->shift.mutex);
+  pthread_mutex_destroy(&demod->fine.mutex);
+  pthread_mutex_destroy(&demod->sdr.status_mutex);
+  pthread_cond_destroy(&demod->sdr.status_cond);
+}
+
+struct demod_case {
+  struct demod demod;
+  complex float *input;  // One block of input
+};
+
+// Feed one block and demodulate it on every channel, as the input thread does
+static long demod_block(void *arg){
+  struct demod_case * const dc = arg;
+  struct demod * const demod = &dc->demod;
+  struct filter_in * const master = demod->filter.in;
+  memcpy(master->input.c,dc->input,master->ilen * sizeof(*dc->input));
+  execute_filter_input(master);
+  update_noise(demod);
+  run_channels();
+  return master->ilen;
+}
+
+// The input thread's share of the noise estimate, once per block
+static long noise_block(void *arg){
+  struct demod_case * const dc = arg;
+  update_noise(&dc->demod);
+  return dc->demod.filter.in->ilen;
+}
+
+// compute_n0() on a demodulator's current output block
+static long n0_block(void *arg){
+  struct demod_case * const dc = arg;
+  volatile float n0 = compute_n0(&dc->demod);
+  (void)n0;
+  return dc->demod.filter.in->ilen;
+}
+
+static long pcm_block(void *arg){
+  struct demod_case * const dc = arg;
+  int const cnt = dc->demod.filter.L / dc->demod.filter.decimate;
+  send_mono_output(&dc->demod,(float *)dc->input,cnt);
+  return cnt;
+}
+
+static void bench_n0(void){
+  header("noise estimator (per input sample)");
+  struct demod_case dc;
+  if(setup_demod(&dc.demod) == -1)
+    return;
+  struct demod * const demod = &dc.demod;
+  dc.input = malloc(demod->filter.L * sizeof(*dc.input));
+  make_signal(dc.input,demod->filter.L,Samprate,12345);
+  demod->filter.out = create_filter_output(demod->filter.in,NULL,demod->filter.decimate,COMPLEX);
+  set_filter(demod->filter.out,-0.2,0.2,demod->filter.kaiser_beta);
+  demod->filter.high = 0.2 * Out_samprate; // For compute_n0(), to match
+  demod->filter.low = -demod->filter.high;
+  memcpy(demod->filter.in->input.c,dc.input,demod->filter.L * sizeof(*dc.input));
+  execute_filter_input(demod->filter.in);
+  execute_filter_output(demod->filter.out,0);
+  update_noise(demod);
+  run_case("update_noise",Samprate,noise_block,&dc);
+  run_case("compute_n0",Samprate,n0_block,&dc);
+  delete_filter_output(demod->filter.out);
+  demod->filter.out = NULL;
+  free(dc.input);
+  cleanup_demod(demod);
+}
+
+static void bench_pcm(void){
+  header("PCM packetizer (per output sample)");
+  struct demod_case dc;
+  if(setup_demod(&dc.demod) == -1)
+    return;
+  int const cnt = dc.demod.filter.L / dc.demod.filter.decimate;
+  float * const audio = malloc(cnt * sizeof(*audio));
+  for(int i=0; i < cnt; i++)
+    audio[i] = 0.3 * sin(2 * M_PI * 1000 * i / Out_samprate);
+  dc.input = (complex float *)audio;
+  run_case("send_mono_output to loopback",Out_samprate,pcm_block,&dc);
+  free(audio);
+  cleanup_demod(&dc.demod);
+}
+
+// Whole demodulators: output filter, downconvert, compute_n0, demodulation and PCM
+static void bench_demods(void){
+  header("demodulators, with filter output and PCM (per input sample)");
+  if(readmodes("modes.txt") != 0){
+    fprintf(stderr,"No mode table in %s; use -l to point at the source directory\n",Libdir);
+    return;
+  }
+  char const * const modes[] = { "AM", "FM", "USB", "AME" };
+  for(int i=0; i < sizeof(modes)/sizeof(modes[0]); i++){
+    struct demod_case dc;
+    if(setup_demod(&dc.demod) == -1)
+      return;
+    struct demod * const demod = &dc.demod;
+    dc.input = malloc(demod->filter.L * sizeof(*dc.input));
+    make_signal(dc.input,demod->filter.L,Samprate,12345);
+    Channels = demod;
+    if(set_mode(demod,modes[i],1) != 0){
+      fprintf(stderr,"Mode %s not in mode table\n",modes[i]);
+    } else {
+      char name[64];
+      snprintf(name,sizeof(name),"%s (%s)",modes[i],Demodtab[demod->demod_type].name);
+      run_case(name,Samprate,demod_block,&dc);
+      stop_demod(demod);
+    }
+    Channels = NULL;
+    free(dc.input);
+    cleanup_demod(demod);
+  }
+}
+
+// Many channels on one input, demodulated by pools of increasing size
+// Ideally the rate goes up in proportion to the pool until the CPUs run out
+#define POOL_CHANNELS 16
+static void bench_pool(void){
+  header("channels on a pool (per input sample, all channels)");
+  if(readmodes("modes.txt") != 0){
+    fprintf(stderr,"No mode table in %s; use -l to point at the source directory\n",Libdir);
+    return;
+  }
+  struct pool * const saved = Demod_pool;
+  long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  for(long size=1; ; size = min(2*size,cpus)){
+    struct demod_case dc;
+    if(setup_demod(&dc.demod) == -1)
+      break;
+    struct demod * const primary = &dc.demod;
+    dc.input = malloc(primary->filter.L * sizeof(*dc.input));
+    make_signal(dc.input,primary->filter.L,Samprate,12345);
+    Demod_pool = create_pool(size-1,"demod");
+    assert(Demod_pool != NULL);
+    Channels = primary;
+    set_mode(primary,"FM",1);
+    for(int i=1; i < POOL_CHANNELS; i++){
+      struct demod * const demod = create_channel(primary,i+1);
+      if(demod == NULL)
+	break;
+      // Spread across the input band, 5 kHz apart
+      set_freq(demod,primary->sdr.status.frequency + 5000 * (i - POOL_CHANNELS/2),NAN);
+      set_mode(demod,(i & 1) ? "USB" : "FM",1);
+    }
+    char name[64];
+    snprintf(name,sizeof(name),"%d FM/USB channels, pool of %ld",POOL_CHANNELS,size);
+    run_case(name,Samprate,demod_block,&dc);
+    while(primary->next != NULL)
+      delete_channel(primary->next);
+    stop_demod(primary);
+    Channels = NULL;
+    delete_pool(Demod_pool);
+    Demod_pool = saved;
+    free(dc.input);
+    cleanup_demod(primary);
+    if(size >= cpus)
+      break;
+  }
+}
+
+// A decimation chain: stages of hb15 halfbands, then an optional resampler
+struct chain {
+  char const *name;
+  int adc_samprate;
+  int out_samprate;
+  int stages;          // Half-band stages
+  int L,M;             // Resampler ratio, or 0 for none
+};
+
+struct chain Chains[] = {
+  { "hb15 x6 (hackrf default)",    12288000, 192000, 6, 0, 0 },
+  { "hb15 x6 at 15.36 MHz",        15360000, 240000, 6, 0, 0 },
+  { "hb15 x4 + polyphase 5/16",    12288000, 240000, 4, 5, 16 },
+  { "hb15 x4 + polyphase 2/5",     10000000, 250000, 4, 2, 5 },
+  { "polyphase 1/64 single stage", 12288000, 192000, 0, 1, 64 },
+};
+#define NCHAINS (sizeof(Chains)/sizeof(Chains[0]))
+
+struct run {
+  struct chain const *chain;
+  struct hb15_state *hb15;
+  struct resampler *rs;
+  int inblock;         // Input samples per block
+  float gain;          // Compensates +6 dB per half-band stage
+};
+
+static int setup_run(struct run *run,struct chain const *chain){
+  memset(run,0,sizeof(*run));
+  run->chain = chain;
+  run->hb15 = calloc(chain->stages > 0 ? chain->stages : 1,sizeof(struct hb15_state));
+  if(run->hb15 == NULL)
+    return -1;
+  for(int i=0; i < chain->stages; i++){
+    // Goodman/Carey "F8", same as hackrf.c
+    run->hb15[i].coeffs[3] = 490./802;
+    run->hb15[i].coeffs[2] = -116./802;
+    run->hb15[i].coeffs[1] = 33./802;
+    run->hb15[i].coeffs[0] = -6./802;
+  }
+  int stage_block = Blocksize;
+  if(chain->L != 0){
+    int const taps = ceilf(Resamp_order * chain->M / chain->L);
+    run->rs = create_resampler(chain->L,chain->M,taps,1.0,Resamp_beta);
+    if(run->rs == NULL)
+      return -1;
+    // Whole resampler periods only, as in hackrf.c
+    stage_block = Blocksize / run->rs->L * run->rs->M;
+  }
+  run->inblock = stage_block << chain->stages;
+  run->gain = powf(.5,chain->stages);
+  return 0;
+}
+
+static void cleanup_run(struct run *run){
+  free(run->hb15);
+  delete_resampler(run->rs);
+  memset(run,0,sizeof(*run));
+}
+
+// Decimate one block in place, returning output sample count
+static int run_block(struct run *run,complex float *block){
+  int n = run->inblock;
+  for(int j=0; j < run->chain->stages; j++){
+    n /= 2;
+    hb15_block_complex(&run->hb15[j],block,block,n);
+  }
+  if(run->rs != NULL)
+    n = resample_complex(run->rs,block,block,n);
+  return n;
+}
+
+// Output power relative to input for a unit tone at f Hz, after the filters settle
+static double tone_gain(struct chain const *chain,double f){
+  struct run run;
+  if(setup_run(&run,chain) == -1)
+    return NAN;
+  complex float block[run.inblock];
+  double const step = 2 * M_PI * f / chain->adc_samprate;
+  double energy = 0;
+  int count = 0;
+  long long t = 0;
+  for(int b=0; b < 8; b++){
+    for(int i=0; i < run.inblock; i++,t++)
+      block[i] = CMPLXF(cos(step * t),sin(step * t));
+    int const n = run_block(&run,block);
+    if(b < 4)
+      continue; // Let the filters settle
+    for(int i=0; i < n; i++){
+      complex float const s = block[i] * run.gain;
+      energy += crealf(s) * crealf(s) + cimagf(s) * cimagf(s);
+    }
+    count += n;
+  }
+  cleanup_run(&run);
+  return energy / count;
+}
+
+// Worst alias, in dB, over tones that would fold into the inner 80% of the output band
+static double rejection(struct chain const *chain){
+  double const fout = chain->out_samprate;
+  double const ref = tone_gain(chain,0.05 * fout);
+  double worst = 0;
+  // Odd step so tones don't all land on the same few alias frequencies
+  double step = 0.0137 * fout;
+  if(step < (0.5 * chain->adc_samprate - 0.6 * fout) / 300)
+    step = (0.5 * chain->adc_samprate - 0.6 * fout) / 300;
+  for(double f = 0.6 * fout; f < 0.5 * chain->adc_samprate; f += step){
+    double const alias = fabs(remainder(f,fout));
+    if(alias > 0.4 * fout)
+      continue;
+    double const g = tone_gain(chain,f);
+    if(g > worst)
+      worst = g;
+  }
+  return 10 * log10(worst / ref);
+}
+
+// Nanoseconds per input sample
+static double speed(struct chain const *chain){
+  struct run run;
+  if(setup_run(&run,chain) == -1)
+    return NAN;
+  complex float input[run.inblock],block[run.inblock];
+  for(int i=0; i < run.inblock; i++)
+    input[i] = CMPLXF(drand48() - 0.5,drand48() - 0.5);
+
+  long long samples = 0;
+  double const start = now();
+  double elapsed;
+  do {
+    for(int k=0; k < 100; k++){
+      memcpy(block,input,sizeof(block)); // As hackrf.c does when loading the first stage
+      run_block(&run,block);
+      samples += run.inblock;
+    }
+    elapsed = now() - start;
+  } while(elapsed < Seconds);
+  cleanup_run(&run);
+  return 1e9 * elapsed / samples;
+}
+
+static void bench_chains(void){
+  printf("\nfront end decimation chains (per A/D sample)\n");
+  printf("%-30s %10s %10s %12s %12s %10s %10s\n","chain","A/D Hz","out Hz","ns/in samp","ns/out samp","x realtime","alias dB");
+  for(int i=0; i < NCHAINS; i++){
+    struct chain const *chain = &Chains[i];
+    double const ns = speed(chain);
+    double const ratio = (double)chain->adc_samprate / chain->out_samprate;
+    printf("%-30s %10d %10d %12.2f %12.2f %10.1f %10.1f\n",chain->name,chain->adc_samprate,chain->out_samprate,
+	   ns,ns * ratio,1e9 / (ns * chain->adc_samprate),rejection(chain));
+  }
+}
+
+// What the planner picks for a channel at various input rates, with radio's default block time and transition
+// Not a speed test: every line should have a decimation, since set_mode() fails without one
+static void bench_plan(void){
+  int const samprates[] = { 48000, 192000, 250000, 384000, 2000000 };
+  float const min_rates[] = { 4000, 8000, 16000, 24000, 48000 };
+  printf("\nchannel decimation planner (out %d Hz)\n",Out_samprate);
+  printf("%10s %6s %6s %10s %10s %7s %12s\n","samp Hz","L","M","min Hz","decimate","chan Hz","resample");
+  for(int i=0; i < sizeof(samprates)/sizeof(samprates[0]); i++){
+    int const samprate = samprates[i];
+    int L = 0, M = 0, partitions = 1;
+    if(plan_blocksize(samprate,Radio_block_time,Radio_transition,Radio_beta,&L,&M,&partitions) == -1){
+      printf("%10d: can't pick a blocksize\n",samprate);
+      continue;
+    }
+    for(int j=0; j < sizeof(min_rates)/sizeof(min_rates[0]); j++){
+      int const decimate = plan_decimate(samprate,L,M,min_rates[j],Out_samprate);
+      if(decimate < 1){
+	printf("%10d %6d %6d %10.0f %10s\n",samprate,L,M,min_rates[j],"NONE");
+	continue;
+      }
+      int const rate = samprate / decimate;
+      int a = rate, b = Out_samprate;
+      while(b != 0){
+	int const t = a % b;
+	a = b;
+	b = t;
+      }
+      printf("%10d %6d %6d %10.0f %10d %7d %5d/%-6d\n",samprate,L,M,min_rates[j],decimate,rate,Out_samprate/a,rate/a);
+    }
+  }
+}
+
+// Frequency of a single real tone on I or Q, from the three term recurrence x[n-1] + x[n+1] = 2cos(w)x[n]
+static double tone_freq(complex float const *z,int const cnt,int const quadrature,double const samprate){
+  double num = 0, den = 0;
+  for(int n=1; n < cnt-1; n++){
+    double const x = quadrature ? cimagf(z[n]) : crealf(z[n]);
+    double const before = quadrature ? cimagf(z[n-1]) : crealf(z[n-1]);
+    double const after = quadrature ? cimagf(z[n+1]) : crealf(z[n+1]);
+    num += x * (before + after);
+    den += 2 * x * x;
+  }
+  return samprate * acos(num / den) / (2 * M_PI);
+}
+
+// Gaussian noise, one unit of power per complex sample
+static complex float gaussian(void){
+  double const r = sqrt(-log(1 - drand48()));
+  double const a = 2 * M_PI * drand48();
+  return CMPLXF(r * cos(a),r * sin(a));
+}
+
+// Not a speed test: carriers outside the passband of a wide input, where each noise slice holds hundreds of bins,
+// must not raise the noise floor estimate. Compares it after a few sweeps with and without a carrier every 2048 bins,
+// 20 dB above the noise in a bin: enough to stand out in its bin, but not to lift a whole slice over the threshold
+static void bench_noise_floor(void){
+  printf("\nNoise floor estimate with carriers, 8 MHz input\n");
+  struct demod demod;
+  if(setup_demod(&demod) == -1)
+    return;
+  int const saved_level = Fftw_plan_level;
+  Fftw_plan_level = FFTW_ESTIMATE; // Just two blocks, not worth measuring
+  delete_filter_input(demod.filter.in);
+  int const L = 131072, M = 131073, N = L + M - 1;
+  demod.filter.in = create_filter_input(L,M,COMPLEX);
+  Fftw_plan_level = saved_level;
+  demod.input.samprate = 8000000;
+  demod.filter.low = -5000;
+  demod.filter.high = +5000;
+
+  float n0[2];
+  for(int carriers=0; carriers < 2; carriers++){
+    srand48(1);
+    struct filter_in * const master = demod.filter.in;
+    float const amplitude = sqrtf(100.0f / N);
+    for(int b=0; b < 2; b++){ // Fill the overlap too
+      for(int i=0; i < L; i++){
+	complex float x = gaussian();
+	if(carriers){
+	  // Bin centers, so none leaks into the noise
+	  long const t = (long)b * L + i;
+	  for(int k=100; k < N; k += 2048){
+	    double const phase = 2 * M_PI * (double)(((long)k * t) % N) / N;
+	    x += amplitude * CMPLXF(cos(phase),sin(phase));
+	  }
+	}
+	master->input.c[i] = x;
+      }
+      execute_filter_input(master);
+    }
+    memset(&demod.input.noise,0,sizeof(demod.input.noise)); // A new spectrum, as far as it knows
+    for(int i=0; i < 8 * NOISE_STRIPES; i++)
+      update_noise(&demod);
+    n0[carriers] = compute_n0(&demod);
+  }
+  double const error = 10 * log10(n0[1] / n0[0]);
+  int const ok = fabs(error) < 0.1;
+  printf("%d bins, %d per slice; carriers move the estimate %+.3f dB: %s\n",N,N / demod.input.noise.segments,error,ok ? "ok" : "FAIL");
+  if(!ok)
+    Failures++;
+  cleanup_demod(&demod);
+}
+
+// Not a speed test: an ISB channel tuned between two FFT bins must still split its sidebands at the carrier
+// Tones 1 kHz above and 700 Hz below a carrier 0.4 bin off a bin center should come out on Q and I at exactly those frequencies
+static void bench_isb(void){
+  printf("\nISB channel tuned off a bin center\n");
+  struct demod demod;
+  if(setup_demod(&demod) == -1)
+    return;
+  struct filter_in * const master = demod.filter.in;
+  int const N = master->ilen + master->impulse_length - 1;
+  double const carrier = (N/8 + 0.4) * Samprate / N;
+  set_second_LO(&demod,-carrier);
+  float const samptime = demod.filter.decimate / (float)Samprate;
+  struct filter_out * const filter = create_filter_output(master,NULL,demod.filter.decimate,CROSS_CONJ);
+  split_isb_output(filter); // As linear.c does
+  set_filter(filter,-3000*samptime,3000*samptime,demod.filter.kaiser_beta);
+  demod.filter.out = filter;
+
+  int const blocks = 10;
+  int const skip = 2; // Let the filter fill
+  complex float * const output = malloc(blocks * filter->olen * sizeof(*output));
+  long long t = 0;
+  for(int b=0; b < blocks; b++){
+    for(int i=0; i < master->ilen; i++,t++){
+      double const upper = 2 * M_PI * fmod((carrier + 1000) * t / Samprate,1.0);
+      double const lower = 2 * M_PI * fmod((carrier - 700) * t / Samprate,1.0);
+      master->input.c[i] = 0.1 * CMPLXF(cos(upper),sin(upper)) + 0.05 * CMPLXF(cos(lower),sin(lower));
+    }
+    execute_filter_input(master);
+    downconvert(&demod);
+    memcpy(output + b * filter->olen,filter->output.c,filter->olen * sizeof(*output));
+  }
+  double const samprate = (double)Samprate / demod.filter.decimate;
+  int const cnt = (blocks - skip) * filter->olen;
+  double const lsb = tone_freq(output + skip * filter->olen,cnt,0,samprate);
+  double const usb = tone_freq(output + skip * filter->olen,cnt,1,samprate);
+  int const ok = fabs(lsb - 700) < 0.1 && fabs(usb - 1000) < 0.1;
+  printf("carrier %.3f Hz, %.2f bins; lower sideband on I %.3f Hz (700), upper on Q %.3f Hz (1000): %s\n",
+	 carrier,carrier * N / Samprate,lsb,usb,ok ? "ok" : "FAIL");
+  if(!ok)
+    Failures++;
+  free(output);
+  delete_filter_output(filter);
+  demod.filter.out = NULL;
+  cleanup_demod(&demod);
+}
+
+// Not a speed test: a long gap in the input, skipped in one step once the filter has drained,
+// must still advance the output RTP timestamp by every sample it stood for
+static void bench_gap(void){
+  printf("\nOutput timestamps across a skipped input gap\n");
+  if(readmodes("modes.txt") != 0){
+    fprintf(stderr,"No mode table in %s; use -l to point at the source directory\n",Libdir);
+    return;
+  }
+  struct demod_case dc;
+  if(setup_demod(&dc.demod) == -1)
+    return;
+  struct demod * const demod = &dc.demod;
+  dc.input = malloc(demod->filter.L * sizeof(*dc.input));
+  make_signal(dc.input,demod->filter.L,Samprate,12345);
+  Channels = demod;
+  if(set_mode(demod,"IQ",1) != 0){
+    fprintf(stderr,"Mode IQ not in mode table\n");
+  } else {
+    int const before = 5, gap = 50, after = 5;
+    uint32_t const start = demod->output.rtp.timestamp;
+    for(int b=0; b < before; b++)
+      demod_block(&dc);
+    input_gap(demod,gap * demod->filter.L);
+    for(int b=0; b < after; b++)
+      demod_block(&dc);
+    long long const expected = (long long)(before + gap + after) * demod->filter.L * demod->output.samprate / Samprate;
+    uint32_t const advanced = demod->output.rtp.timestamp - start;
+    int const ok = advanced == expected;
+    printf("%d blocks, %d of them a gap: timestamp advanced %u, expected %lld: %s\n",
+	   before + gap + after,gap,advanced,expected,ok ? "ok" : "FAIL");
+    if(!ok)
+      Failures++;
+    stop_demod(demod);
+  }
+  Channels = NULL;
+  free(dc.input);
+  cleanup_demod(demod);
+}
+
+struct section {
+  char const *name;
+  void (*fn)(void);
+} Sections[] = {
+  { "filter", bench_filters },
+  { "halfband", bench_halfbands },
+  { "osc", bench_oscs },
+  { "n0", bench_n0 },
+  { "pcm", bench_pcm },
+  { "demod", bench_demods },
+  { "pool", bench_pool },
+  { "chain", bench_chains },
+  { "plan", bench_plan },
+  { "isb", bench_isb },
+  { "gap", bench_gap },
+  { "noise", bench_noise_floor },
+};
+#define NSECTIONS (sizeof(Sections)/sizeof(Sections[0]))
+
+int main(int argc,char *argv[]){
+  char *only = NULL;
+  char wisdom_file[PATH_MAX] = "";
+  int c;
+  while((c = getopt(argc,argv,"b:l:o:s:t:w:W:")) != -1){
+    switch(c){
+    case 'b':
+      Blocksize = strtol(optarg,NULL,0);
+      break;
+    case 'l':
+      strlcpy(Libdir,optarg,sizeof(Libdir));
+      break;
+    case 'o':
+      Resamp_order = strtod(optarg,NULL);
+      break;
+    case 's':
+      Seconds = strtod(optarg,NULL);
+      break;
+    case 't':
+      only = optarg;
+      break;
+    case 'w':
+      if((Fftw_plan_level = plan_level(optarg)) == -1){
+	fprintf(stderr,"Unknown FFTW planning level %s; use estimate, measure, patient or exhaustive\n",optarg);
+	exit(1);
+      }
+      break;
+    case 'W':
+      strlcpy(wisdom_file,optarg,sizeof(wisdom_file));
+      break;
+    default:
+      fprintf(stderr,"Usage: %s [-b blocksize] [-l libdir] [-o resampler order] [-s seconds] [-t section[,section...]] [-w planning level] [-W wisdom file]\n",argv[0]);
+      fprintf(stderr,"Sections:");
+      for(int i=0; i < NSECTIONS; i++)
+	fprintf(stderr," %s",Sections[i].name);
+      fprintf(stderr,"\n");
+      exit(1);
+    }
+  }
+  fftwf_import_system_wisdom();
+  fftwf_make_planner_thread_safe();
+  Demod_pool = create_pool(0,"demod"); // One channel at a time, demodulated by the caller
+  if(strlen(wisdom_file) > 0 && load_wisdom(wisdom_file) == -1)
+    fprintf(stderr,"No wisdom in %s\n",wisdom_file);
+
+  printf("decimation kernel: %s; filter multiply kernel: %s; sample conversion kernel: %s; FFTW planning: %s\n",
+	 decimate_kernel(),filter_kernel(),convert_kernel(),plan_level_name(Fftw_plan_level));
+  for(int i=0; i < NSECTIONS; i++){
+    if(only != NULL){
+      // Match whole names in a comma separated list
+      char list[strlen(only)+1];
+      strcpy(list,only);
+      char *cp = list;
+      char *name;
+      int found = 0;
+      while((name = strsep(&cp,",")) != NULL){
+	if(strcmp(name,Sections[i].name) == 0)
+	  found = 1;
+      }
+      if(!found)
+	continue;
+    }
+    (*Sections[i].fn)();
+  }
+  exit(Failures != 0);
+}
@@ -48,14 +48,26 @@ char Locale[256] = "en_US.UTF-8";
 
 
 
-void  *demod_am(void *arg){
-  return NULL;
+int start_am(struct demod *demod){
+  return -1;
 }
-void *demod_fm(void *arg){
-  return NULL;
+void demod_am(struct demod *demod){
 }
-void *demod_linear(void *arg){
-  return NULL;  
+void stop_am(struct demod *demod){
+}
+int start_fm(struct demod *demod){
+  return -1;
+}
+void demod_fm(struct demod *demod){
+}
+void stop_fm(struct demod *demod){
+}
+int start_linear(struct demod *demod){
+  return -1;
+}
+void demod_linear(struct demod *demod){
+}
+void stop_linear(struct demod *demod){
 }
 
 
@@ -206,6 +218,17 @@ struct demod Demod;
 
 float Noise_bandwidth;
 
+// Median, 99th percentile and maximum latency of each stage, microseconds, as in status.h
+int Latency[LATENCY_TOTAL_MAX - LATENCY_FILL_P50 + 1];
+char const *Latency_stage[] = { "Fill", "Queue", "Filter", "Demod", "Send", "Total" };
+
+// Compute load
+float Cpu[CPU_STATUS - CPU_RTP_RECV + 1]; // Fraction of a CPU used by each thread, in status.h order
+char const *Thread_name[] = { "rtp-rcv", "procsamp", "demod", "pl", "status" };
+int Queue_depth,Queue_hwm;
+float Fft_time,Ifft_time;
+float Realtime_load;
+
 
 int Netsock;
 
@@ -402,6 +425,27 @@ void decode_status(struct demod *demod,unsigned char *buffer,int length){
     case OUTPUT_CHANNELS:
       demod->output.channels = decode_int(cp,len);
       break;
+    case LATENCY_FILL_P50 ... LATENCY_TOTAL_MAX:
+      Latency[type - LATENCY_FILL_P50] = decode_int(cp,len);
+      break;
+    case CPU_RTP_RECV ... CPU_STATUS:
+      Cpu[type - CPU_RTP_RECV] = decode_float(cp,len);
+      break;
+    case INPUT_QUEUE_DEPTH:
+      Queue_depth = decode_int(cp,len);
+      break;
+    case INPUT_QUEUE_HWM:
+      Queue_hwm = decode_int(cp,len);
+      break;
+    case FFT_TIME:
+      Fft_time = decode_float(cp,len);
+      break;
+    case IFFT_TIME:
+      Ifft_time = decode_float(cp,len);
+      break;
+    case REALTIME_LOAD:
+      Realtime_load = decode_float(cp,len);
+      break;
     default:
       break;
     }
@@ -485,9 +529,12 @@ int main(int argc,char *argv[]){
   col = 0;
   row += 12;
   WINDOW * const network = newwin(8,78,row,col); // Network status information
+  col += 78;
+  WINDOW * const latency = newwin(8,37,row,col); // Where the time goes
   col = 0;
   row += 8;
   WINDOW * const debug = newwin(8,78,row,col); // Note: overlaps function keys
+  WINDOW * const load = newwin(12,37,row,col+78); // Compute load
   scrollok(debug,1);
 
   // A message from our sponsor...
@@ -811,6 +858,37 @@ int main(int argc,char *argv[]){
     box(network,0,0);
     mvwaddstr(network,0,35,"I/O");
 
+    // Latency by stage
+    row = 1;
+    col = 1;
+    for(int i=0; i < sizeof(Latency_stage)/sizeof(Latency_stage[0]); i++){
+      mvwprintw(latency,row,col,"%-7s%'9.1f%'9.1f%'9.1f",Latency_stage[i],
+		0.001 * Latency[3*i],0.001 * Latency[3*i+1],0.001 * Latency[3*i+2]);
+      row++;
+    }
+    box(latency,0,0);
+    mvwaddstr(latency,0,2,"Latency ms  p50      p99      max");
+
+    // Compute load
+    row = 1;
+    col = 1;
+    for(int i=0; i < sizeof(Thread_name)/sizeof(Thread_name[0]); i++){
+      mvwprintw(load,row,col,"%27.1f %%",100 * Cpu[i]);
+      mvwaddstr(load,row++,col,Thread_name[i]);
+    }
+    mvwprintw(load,row,col,"%27.1f %%",100 * Realtime_load);
+    mvwaddstr(load,row++,col,"Real time");
+    mvwprintw(load,row,col,"%'27.1f us",1e6 * Fft_time);
+    mvwaddstr(load,row++,col,"FFT");
+    mvwprintw(load,row,col,"%'27.1f us",1e6 * Ifft_time);
+    mvwaddstr(load,row++,col,"IFFT");
+    mvwprintw(load,row,col,"%'27d pkt",Queue_depth);
+    mvwaddstr(load,row++,col,"Queue");
+    mvwprintw(load,row,col,"%'27d pkt",Queue_hwm);
+    mvwaddstr(load,row++,col,"Queue max");
+    box(load,0,0);
+    mvwaddstr(load,0,15,"Load");
+
     touchwin(debug); // since we're not redrawing it every cycle
 
     // Highlight cursor for tuning step
@@ -856,6 +934,8 @@ int main(int argc,char *argv[]){
     wnoutrefresh(options);
     wnoutrefresh(modes);
     wnoutrefresh(network);
+    wnoutrefresh(latency);
+    wnoutrefresh(load);
     doupdate();      // Update the screen right before we pause
     
     // Scan and process keyboard commands
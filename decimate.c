@@ -1,164 +1,486 @@
 // $Id: decimate.c,v 1.8 2018/12/03 11:43:00 karn Exp $
 // half-band filters for sample rate decimation by powers of 2
 // Note: filters have unity middle tap, which usually results in overall gain of +6 dB
+// Also a polyphase resampler for the remaining rational L/M step
 // Copyright July 2018, Phil Karn, KA9Q
 
+/* Each block is first split into its even and odd input samples, each prefixed
+   with what's left over from the last block. The half-band filter then becomes a
+   short FIR over contiguous arrays that vectorizes across output samples:
+
+   out[n] = even[n-3] + coeff[0] * (odd[n] + odd[n-7]) + coeff[1] * (odd[n-1] + odd[n-6])
+                      + coeff[2] * (odd[n-2] + odd[n-5]) + coeff[3] * (odd[n-3] + odd[n-4])
+
+   Since the coefficients are real, interleaved I/Q is the same thing with every sample
+   two floats wide, so one kernel does both channels at once.
+   The widest kernel the CPU supports is picked at run time.
+
+   The resampler conceptually upsamples by L, low-pass filters and keeps every Mth sample.
+   Only the 1-in-L nonzero products are ever computed: output k uses polyphase branch
+   (k*M) mod L against the input ending at sample floor(k*M/L). Each branch is stored
+   time-reversed with every tap duplicated, so an output is one contiguous dot product
+   over interleaved I/Q with I in the even lanes and Q in the odd ones.
+*/
+#define _GNU_SOURCE 1
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <assert.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include "decimate.h"
 
-// Pick up vectorized versions if available
-#if defined(__SSSE3__)
-#pragma message "Vectorized versions of decimation filters will require SSSE3 or better to run"
-
-  #include <x86intrin.h>  // GCC-compatible compiler, targeting x86/x86-64
+// Produce n floats of output; s is floats per sample (1 = real, 2 = complex)
+// even[] starts 3 samples back, odd[] 7 samples back
+typedef void (*hb15_kernel)(float *,float const *,float const *,float const *,int,int);
+// odd[] starts 1 sample back
+typedef void (*hb3_kernel)(float *,float const *,float const *,int,int);
+// Dot product of n floats of duplicated coefficients with n floats of interleaved I/Q
+typedef complex float (*dot_kernel)(float const *,float const *,int);
+
+static void hb15_scalar(float *out,float const *even,float const *odd,float const *coeffs,int n,int s){
+  for(int j=0; j < n; j++)
+    out[j] = even[j]
+      + coeffs[0] * (odd[j] + odd[j+7*s])
+      + coeffs[1] * (odd[j+s] + odd[j+6*s])
+      + coeffs[2] * (odd[j+2*s] + odd[j+5*s])
+      + coeffs[3] * (odd[j+3*s] + odd[j+4*s]);
+}
 
-/* Folded half-band 15-tap filter
-   Only four non-unity coefficents are needed
-   Note ordering of coefficients: coeff[0] is at the tails, not the center
+// 3-tap halfband filter with fixed taps: 1, 2, 1
+static void hb3_scalar(float *out,float const *even,float const *odd,int n,int s){
+  for(int j=0; j < n; j++)
+    out[j] = 2 * even[j] + odd[j+s] + odd[j];
+}
 
-  |--   even[3]   even[2]    even[1]    even[0]  <-- in first
-  v
-drop
+static complex float dot_scalar(float const *coeffs,float const *in,int n){
+  float i = 0, q = 0;
+  for(int j=0; j < n; j += 2){
+    i += coeffs[j] * in[j];
+    q += coeffs[j+1] * in[j+1];
+  }
+  return CMPLXF(i,q);
+}
 
-  --     odd[3]    odd[2]     odd[1]     odd[0]  <-- in second
-  |
-  |       +         +          +          +
-  |
-  |-->oldodd[3]  oldodd[2]  oldodd[1]  oldodd[0] --------|
-          *          *           *          *            v
-       coeff[3]   coeff[2]   coeff[1]   coeff[0]        drop
-          v          v           v          v
-        temp[3]    temp[2]    temp[1]    temp[0]
-       sum(temp[3...0] + even[3]) to give output
- */
+// Fold a vector accumulator of w floats into I (even lanes) and Q (odd lanes)
+static inline complex float fold(float const *lanes,int w){
+  float i = 0, q = 0;
+  for(int j=0; j < w; j += 2){
+    i += lanes[j];
+    q += lanes[j+1];
+  }
+  return CMPLXF(i,q);
+}
 
-// Strong typing can be a major pain in the ass...
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wincompatible-pointer-types"
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx512f")))
+static void hb15_avx512(float *out,float const *even,float const *odd,float const *coeffs,int n,int s){
+  __m512 const c0 = _mm512_set1_ps(coeffs[0]);
+  __m512 const c1 = _mm512_set1_ps(coeffs[1]);
+  __m512 const c2 = _mm512_set1_ps(coeffs[2]);
+  __m512 const c3 = _mm512_set1_ps(coeffs[3]);
+  int j;
+  for(j=0; j + 16 <= n; j += 16){
+    float const *o = odd + j;
+    __m512 sum = _mm512_loadu_ps(even + j);
+    sum = _mm512_fmadd_ps(c0,_mm512_add_ps(_mm512_loadu_ps(o),_mm512_loadu_ps(o+7*s)),sum);
+    sum = _mm512_fmadd_ps(c1,_mm512_add_ps(_mm512_loadu_ps(o+s),_mm512_loadu_ps(o+6*s)),sum);
+    sum = _mm512_fmadd_ps(c2,_mm512_add_ps(_mm512_loadu_ps(o+2*s),_mm512_loadu_ps(o+5*s)),sum);
+    sum = _mm512_fmadd_ps(c3,_mm512_add_ps(_mm512_loadu_ps(o+3*s),_mm512_loadu_ps(o+4*s)),sum);
+    _mm512_storeu_ps(out + j,sum);
+  }
+  hb15_scalar(out+j,even+j,odd+j,coeffs,n-j,s);
+}
 
+__attribute__((target("avx512f")))
+static void hb3_avx512(float *out,float const *even,float const *odd,int n,int s){
+  int j;
+  for(j=0; j + 16 <= n; j += 16){
+    __m512 const e = _mm512_loadu_ps(even + j);
+    __m512 const sum = _mm512_add_ps(_mm512_add_ps(e,e),_mm512_add_ps(_mm512_loadu_ps(odd+j+s),_mm512_loadu_ps(odd+j)));
+    _mm512_storeu_ps(out + j,sum);
+  }
+  hb3_scalar(out+j,even+j,odd+j,n-j,s);
+}
 
-#define shiftleft(arg,n) _mm_castsi128_ps(_mm_bslli_si128(_mm_castps_si128(arg),4*n))
-#define shiftright(arg,n) _mm_castsi128_ps(_mm_bsrli_si128(_mm_castps_si128(arg),4*n))
+__attribute__((target("avx512f")))
+static complex float dot_avx512(float const *coeffs,float const *in,int n){
+  __m512 sum = _mm512_setzero_ps();
+  int j;
+  for(j=0; j + 16 <= n; j += 16)
+    sum = _mm512_fmadd_ps(_mm512_loadu_ps(coeffs+j),_mm512_loadu_ps(in+j),sum);
+  float lanes[16];
+  _mm512_storeu_ps(lanes,sum);
+  return fold(lanes,16) + dot_scalar(coeffs+j,in+j,n-j);
+}
 
-void hb15_block(struct hb15_state *state,float *output,float *input,int cnt){
-  __m128 coeffs= _mm_loadu_ps(state->coeffs);  // coeffs in xmm5;
-  __m128 even_samples = _mm_loadu_ps(state->even_samples); // xmm3;
-  __m128 odd_samples = _mm_loadu_ps(state->odd_samples); // xmm1;
-  __m128 old_odd_samples = _mm_loadu_ps(state->old_odd_samples); // xmm2;
-  __m128 temp = _mm_setzero_ps(); // Not really necessary but silences compiler warning
-  __m128 mask3 = (__m128) _mm_set_epi32(-1,0,0,0); // For selecting high word of vector
+__attribute__((target("avx2,fma")))
+static void hb15_avx2(float *out,float const *even,float const *odd,float const *coeffs,int n,int s){
+  __m256 const c0 = _mm256_set1_ps(coeffs[0]);
+  __m256 const c1 = _mm256_set1_ps(coeffs[1]);
+  __m256 const c2 = _mm256_set1_ps(coeffs[2]);
+  __m256 const c3 = _mm256_set1_ps(coeffs[3]);
+  int j;
+  for(j=0; j + 8 <= n; j += 8){
+    float const *o = odd + j;
+    __m256 sum = _mm256_loadu_ps(even + j);
+    sum = _mm256_fmadd_ps(c0,_mm256_add_ps(_mm256_loadu_ps(o),_mm256_loadu_ps(o+7*s)),sum);
+    sum = _mm256_fmadd_ps(c1,_mm256_add_ps(_mm256_loadu_ps(o+s),_mm256_loadu_ps(o+6*s)),sum);
+    sum = _mm256_fmadd_ps(c2,_mm256_add_ps(_mm256_loadu_ps(o+2*s),_mm256_loadu_ps(o+5*s)),sum);
+    sum = _mm256_fmadd_ps(c3,_mm256_add_ps(_mm256_loadu_ps(o+3*s),_mm256_loadu_ps(o+4*s)),sum);
+    _mm256_storeu_ps(out + j,sum);
+  }
+  hb15_scalar(out+j,even+j,odd+j,coeffs,n-j,s);
+}
 
-  while(cnt--){
-    temp = _mm_loadl_pi(temp,input); // X   X  IN[1] IN[0]
-    input += 2;
-    even_samples = _mm_move_ss(even_samples,temp);  // ES[3] ES[2] ES[1] in[0]
-    temp = shiftright(temp,1);
-    odd_samples = _mm_move_ss(odd_samples,temp);  // OS[3] OS[2] OS[1] in[1]
+__attribute__((target("avx2")))
+static void hb3_avx2(float *out,float const *even,float const *odd,int n,int s){
+  int j;
+  for(j=0; j + 8 <= n; j += 8){
+    __m256 const e = _mm256_loadu_ps(even + j);
+    __m256 const sum = _mm256_add_ps(_mm256_add_ps(e,e),_mm256_add_ps(_mm256_loadu_ps(odd+j+s),_mm256_loadu_ps(odd+j)));
+    _mm256_storeu_ps(out + j,sum);
+  }
+  hb3_scalar(out+j,even+j,odd+j,n-j,s);
+}
 
-    temp = _mm_mul_ps(_mm_add_ps(odd_samples,old_odd_samples),coeffs); // all taps but the middle
-    // Right shift old_odd_samples (no longer need old_odd_samples[0])
-    // sets old_odd_samples[3] = 0 in preparation for ORing later with odd_samples[3]
-    old_odd_samples = shiftright(old_odd_samples,1);  // 0 OOS[3] OOS[2] OOS[1]
+__attribute__((target("avx2,fma")))
+static complex float dot_avx2(float const *coeffs,float const *in,int n){
+  __m256 sum = _mm256_setzero_ps();
+  int j;
+  for(j=0; j + 8 <= n; j += 8)
+    sum = _mm256_fmadd_ps(_mm256_loadu_ps(coeffs+j),_mm256_loadu_ps(in+j),sum);
+  float lanes[8];
+  _mm256_storeu_ps(lanes,sum);
+  return fold(lanes,8) + dot_scalar(coeffs+j,in+j,n-j);
+}
 
-    // old_odd_samples[3] = odd_samples[3]
-    old_odd_samples = _mm_or_ps(old_odd_samples,_mm_and_ps(odd_samples,mask3));
+// Every x86-64 has SSE2
+__attribute__((target("sse2")))
+static void hb15_sse2(float *out,float const *even,float const *odd,float const *coeffs,int n,int s){
+  __m128 const c0 = _mm_set1_ps(coeffs[0]);
+  __m128 const c1 = _mm_set1_ps(coeffs[1]);
+  __m128 const c2 = _mm_set1_ps(coeffs[2]);
+  __m128 const c3 = _mm_set1_ps(coeffs[3]);
+  int j;
+  for(j=0; j + 4 <= n; j += 4){
+    float const *o = odd + j;
+    __m128 sum = _mm_loadu_ps(even + j);
+    sum = _mm_add_ps(sum,_mm_mul_ps(c0,_mm_add_ps(_mm_loadu_ps(o),_mm_loadu_ps(o+7*s))));
+    sum = _mm_add_ps(sum,_mm_mul_ps(c1,_mm_add_ps(_mm_loadu_ps(o+s),_mm_loadu_ps(o+6*s))));
+    sum = _mm_add_ps(sum,_mm_mul_ps(c2,_mm_add_ps(_mm_loadu_ps(o+2*s),_mm_loadu_ps(o+5*s))));
+    sum = _mm_add_ps(sum,_mm_mul_ps(c3,_mm_add_ps(_mm_loadu_ps(o+3*s),_mm_loadu_ps(o+4*s))));
+    _mm_storeu_ps(out + j,sum);
+  }
+  hb15_scalar(out+j,even+j,odd+j,coeffs,n-j,s);
+}
 
-    // left shift odd samples
-    odd_samples = shiftleft(odd_samples,1);
+__attribute__((target("sse2")))
+static void hb3_sse2(float *out,float const *even,float const *odd,int n,int s){
+  int j;
+  for(j=0; j + 4 <= n; j += 4){
+    __m128 const e = _mm_loadu_ps(even + j);
+    __m128 const sum = _mm_add_ps(_mm_add_ps(e,e),_mm_add_ps(_mm_loadu_ps(odd+j+s),_mm_loadu_ps(odd+j)));
+    _mm_storeu_ps(out + j,sum);
+  }
+  hb3_scalar(out+j,even+j,odd+j,n-j,s);
+}
 
-    // Sum up terms
-    temp = _mm_add_ps(temp,_mm_and_ps(even_samples,mask3)); // even_samples[3] (central tap, unity gain)
-    temp = _mm_hadd_ps(temp,temp);
-    temp = _mm_hadd_ps(temp,temp);    
+__attribute__((target("sse2")))
+static complex float dot_sse2(float const *coeffs,float const *in,int n){
+  __m128 sum = _mm_setzero_ps();
+  int j;
+  for(j=0; j + 4 <= n; j += 4)
+    sum = _mm_add_ps(sum,_mm_mul_ps(_mm_loadu_ps(coeffs+j),_mm_loadu_ps(in+j)));
+  float lanes[4];
+  _mm_storeu_ps(lanes,sum);
+  return fold(lanes,4) + dot_scalar(coeffs+j,in+j,n-j);
+}
+#endif
 
-    // Left shift one word (no longer need even_samples[3])
-    even_samples = shiftleft(even_samples,1);
+#if defined(__ARM_NEON)
+static void hb15_neon(float *out,float const *even,float const *odd,float const *coeffs,int n,int s){
+  float32x4_t const c0 = vdupq_n_f32(coeffs[0]);
+  float32x4_t const c1 = vdupq_n_f32(coeffs[1]);
+  float32x4_t const c2 = vdupq_n_f32(coeffs[2]);
+  float32x4_t const c3 = vdupq_n_f32(coeffs[3]);
+  int j;
+  for(j=0; j + 4 <= n; j += 4){
+    float const *o = odd + j;
+    float32x4_t sum = vld1q_f32(even + j);
+    sum = vmlaq_f32(sum,c0,vaddq_f32(vld1q_f32(o),vld1q_f32(o+7*s)));
+    sum = vmlaq_f32(sum,c1,vaddq_f32(vld1q_f32(o+s),vld1q_f32(o+6*s)));
+    sum = vmlaq_f32(sum,c2,vaddq_f32(vld1q_f32(o+2*s),vld1q_f32(o+5*s)));
+    sum = vmlaq_f32(sum,c3,vaddq_f32(vld1q_f32(o+3*s),vld1q_f32(o+4*s)));
+    vst1q_f32(out + j,sum);
+  }
+  hb15_scalar(out+j,even+j,odd+j,coeffs,n-j,s);
+}
 
-    // Stash result:     *output++ = result;
-    _mm_store_ss(output++,temp);
+static void hb3_neon(float *out,float const *even,float const *odd,int n,int s){
+  int j;
+  for(j=0; j + 4 <= n; j += 4){
+    float32x4_t const e = vld1q_f32(even + j);
+    float32x4_t const sum = vaddq_f32(vaddq_f32(e,e),vaddq_f32(vld1q_f32(odd+j+s),vld1q_f32(odd+j)));
+    vst1q_f32(out + j,sum);
   }
-  _mm_storeu_ps(state->even_samples,even_samples);
-  _mm_storeu_ps(state->odd_samples,odd_samples);
-  _mm_storeu_ps(state->old_odd_samples,old_odd_samples);
+  hb3_scalar(out+j,even+j,odd+j,n-j,s);
 }
 
+static complex float dot_neon(float const *coeffs,float const *in,int n){
+  float32x4_t sum = vdupq_n_f32(0);
+  int j;
+  for(j=0; j + 4 <= n; j += 4)
+    sum = vmlaq_f32(sum,vld1q_f32(coeffs+j),vld1q_f32(in+j));
+  float lanes[4];
+  vst1q_f32(lanes,sum);
+  return fold(lanes,4) + dot_scalar(coeffs+j,in+j,n-j);
+}
+#endif
 
-// 3-tap halfband filter with fixed taps: 1, 2, 1
-void hb3_block(float *state,float *output,float *input,int cnt){
+static hb15_kernel Hb15_kernel = hb15_scalar;
+static hb3_kernel Hb3_kernel = hb3_scalar;
+static dot_kernel Dot_kernel = dot_scalar;
+static char const *Kernel_name = "scalar";
+static pthread_once_t Kernel_once = PTHREAD_ONCE_INIT;
+
+static void select_kernels(void){
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")){
+    Hb15_kernel = hb15_avx512;
+    Hb3_kernel = hb3_avx512;
+    Dot_kernel = dot_avx512;
+    Kernel_name = "avx512";
+  } else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+    Hb15_kernel = hb15_avx2;
+    Hb3_kernel = hb3_avx2;
+    Dot_kernel = dot_avx2;
+    Kernel_name = "avx2";
+  } else if(__builtin_cpu_supports("sse2")){
+    Hb15_kernel = hb15_sse2;
+    Hb3_kernel = hb3_sse2;
+    Dot_kernel = dot_sse2;
+    Kernel_name = "sse2";
+  }
+#elif defined(__ARM_NEON)
+  Hb15_kernel = hb15_neon;
+  Hb3_kernel = hb3_neon;
+  Dot_kernel = dot_neon;
+  Kernel_name = "neon";
+#endif
+}
 
-  __m128 oldstate = _mm_load_ss(state);   // 0   0        0        S
-  __m128 in = _mm_setzero_ps();            // 0   0        0        0
+char const *decimate_kernel(void){
+  pthread_once(&Kernel_once,select_kernels);
+  return Kernel_name;
+}
 
-  while(cnt--){
-    in = _mm_loadl_pi(in,input);   // 0   0       IN[1]  IN[0]
-    input += 2;
-    
-    __m128 temp;
-    temp = _mm_unpacklo_ps(in,oldstate); // 0   IN[1]            S           IN[0]
-    temp = _mm_add_ps(temp,in);    // 0   IN[1]             S+IN[1]      2*IN[0]
-    temp = _mm_hadd_ps(temp,temp); // IN[1]   S+IN[1]+2*IN[0]        IN[1]   S+IN[1]+2*IN[0]
-    _mm_store_ss(output++,temp);   // Store result
-    oldstate = shiftright(in,1);
+// Split 2*cnt input samples of s floats each into even and odd ones
+static inline void split(float *even,float *odd,float const *input,int cnt,int s){
+  if(s == 1){
+    for(int n=0; n < cnt; n++){
+      even[n] = input[2*n];
+      odd[n] = input[2*n+1];
+    }
+  } else {
+    complex float *ce = (complex float *)even;
+    complex float *co = (complex float *)odd;
+    complex float const *ci = (complex float const *)input;
+    for(int n=0; n < cnt; n++){
+      ce[n] = ci[2*n];
+      co[n] = ci[2*n+1];
+    }
   }
-  _mm_store_ss(state,oldstate);
 }
-#pragma GCC diagnostic pop
 
-#else
+static void hb15_run(struct hb15_state *state,float *output,float const *input,int cnt,int s){
+  assert(state != NULL && output != NULL && input != NULL);
+  if(cnt <= 0)
+    return;
+  pthread_once(&Kernel_once,select_kernels);
+
+  // Everything is copied out of input before output is written, so they may be the same
+  float even[(cnt+3)*s];
+  float odd[(cnt+7)*s];
+  memcpy(even,state->even,3*s*sizeof(float));
+  memcpy(odd,state->odd,7*s*sizeof(float));
+  split(even+3*s,odd+7*s,input,cnt,s);
+  (*Hb15_kernel)(output,even,odd,state->coeffs,cnt*s,s);
+  memcpy(state->even,even+cnt*s,3*s*sizeof(float));
+  memcpy(state->odd,odd+cnt*s,7*s*sizeof(float));
+}
+
+static void hb3_run(float *state,float *output,float const *input,int cnt,int s){
+  assert(state != NULL && output != NULL && input != NULL);
+  if(cnt <= 0)
+    return;
+  pthread_once(&Kernel_once,select_kernels);
+
+  float even[cnt*s];
+  float odd[(cnt+1)*s];
+  memcpy(odd,state,s*sizeof(float));
+  split(even,odd+s,input,cnt,s);
+  (*Hb3_kernel)(output,even,odd,cnt*s,s);
+  memcpy(state,odd+cnt*s,s*sizeof(float));
+}
 
-// Portable version - written to help the compiler vectorize at least partly
 void hb15_block(struct hb15_state *state,float *output,float *input,int cnt){
-  float even_samples[4];
-  float odd_samples[4];
-  float old_odd_samples[4];
-  float coeffs[4];
-
-  memcpy(coeffs, state->coeffs, sizeof(coeffs));
-  memcpy(even_samples, state->even_samples, sizeof(even_samples));
-  memcpy(odd_samples, state->odd_samples, sizeof(odd_samples));
-  memcpy(old_odd_samples, state->old_odd_samples, sizeof(old_odd_samples));
-
-  while(cnt--){
-    even_samples[0] = *input++;
-    odd_samples[0] = *input++;
-
-    float result = even_samples[3];
-    for(int i=2; i >= 0; i--)
-      even_samples[i+1] = even_samples[i];
-
-    for(int i=0; i < 4; i++)
-      result += (odd_samples[i] + old_odd_samples[i]) * coeffs[i];
-    
-    *output++ = result;
-
-    for(int i=0; i < 3; i++)
-      old_odd_samples[i] = old_odd_samples[i+1];
-    
-    old_odd_samples[3] = odd_samples[3];
-    
-    for(int i=2; i >= 0; i--)
-      odd_samples[i+1] = odd_samples[i];
-  }
-  memcpy(state->even_samples, even_samples, sizeof(even_samples));
-  memcpy(state->odd_samples, odd_samples, sizeof(odd_samples));
-  memcpy(state->old_odd_samples, old_odd_samples, sizeof(old_odd_samples));
+  hb15_run(state,output,input,cnt,1);
 }
-// 3-tap halfband filter with fixed taps: 1, 2, 1
+
 void hb3_block(float *state,float *output,float *input,int cnt){
+  hb3_run(state,output,input,cnt,1);
+}
 
-  float oldstate = *state;
+void hb15_block_complex(struct hb15_state *state,complex float *output,complex float *input,int cnt){
+  hb15_run(state,(float *)output,(float *)input,cnt,2);
+}
 
-  while(cnt--){
-    float in[2];
-    in[0] = *input++;
-    in[1] = *input++;
+void hb3_block_complex(complex float *state,complex float *output,complex float *input,int cnt){
+  hb3_run((float *)state,(float *)output,(float *)input,cnt,2);
+}
 
-    *output++ = 2 * in[0] + in[1] + oldstate;
-    oldstate = in[1];
+// Modified Bessel function of the 0th kind, for the Kaiser window
+// (filter.c has one too, but pulling it in would drag FFTW into the front ends)
+static double i0(double const x){
+  double const t = 0.25 * x * x;
+  double sum = 1 + t;
+  double term = t;
+  for(int k=2; k < 40; k++){
+    term *= t/(k*k);
+    sum += term;
+    if(term < 1e-12 * sum)
+      break;
   }
-  *state = oldstate;
+  return sum;
 }
 
+static int gcd(int a,int b){
+  while(b != 0){
+    int const t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
 
-#endif
+// Resample by L/M with a Kaiser-windowed sinc of L*taps total taps
+// cutoff is the -6 dB edge as a fraction of the lower of the input and output Nyquist rates;
+// beta is as in make_kaiser(), i.e., multiplied by pi
+struct resampler *create_resampler(int L,int M,int taps,float cutoff,float beta){
+  if(L <= 0 || M <= 0 || taps <= 0 || cutoff <= 0 || cutoff > 1)
+    return NULL;
+  int const g = gcd(L,M);
+  L /= g;
+  M /= g;
+
+  struct resampler * const rs = calloc(1,sizeof(*rs));
+  if(rs == NULL)
+    return NULL;
+  rs->L = L;
+  rs->M = M;
+  rs->taps = taps;
+  rs->coeffs = calloc(2*L*taps,sizeof(float));
+  rs->history = calloc(taps,sizeof(complex float)); // taps-1 used; never zero-length
+  if(rs->coeffs == NULL || rs->history == NULL){
+    delete_resampler(rs);
+    return NULL;
+  }
+  // Prototype at the upsampled rate, normalized to unit gain after decimation
+  int const N = L * taps;
+  double const fc = 0.5 * cutoff / (L > M ? L : M); // cycles per upsampled sample
+  double const inv_denom = 1 / i0(M_PI * beta);
+  double h[N];
+  double sum = 0;
+  for(int n=0; n < N; n++){
+    double const t = n - 0.5 * (N-1);
+    double const p = N > 1 ? 2.0 * n / (N-1) - 1 : 0;
+    double const x = 2 * M_PI * fc * t;
+    double const w = 1 - p*p; // Can round slightly negative at the ends
+    h[n] = (x == 0 ? 1 : sin(x) / x) * i0(M_PI * beta * sqrt(w > 0 ? w : 0)) * inv_denom;
+    sum += h[n];
+  }
+  // Branch p holds h[p], h[p+L], ... reversed, so the newest input sample gets h[p]
+  for(int p=0; p < L; p++){
+    float * const c = rs->coeffs + 2*p*taps;
+    for(int j=0; j < taps; j++)
+      c[2*(taps-1-j)] = c[2*(taps-1-j)+1] = L * h[p + j*L] / sum;
+  }
+  return rs;
+}
+
+void delete_resampler(struct resampler *rs){
+  if(rs == NULL)
+    return;
+  free(rs->coeffs);
+  free(rs->history);
+  free(rs);
+}
+
+// Group delay of the resampler's linear phase prototype filter, in output samples
+double resample_delay(struct resampler const *rs){
+  assert(rs != NULL);
+  return (rs->L * rs->taps - 1) / (2.0 * rs->M);
+}
+
+// Number of outputs the next cnt input samples will produce
+int resample_count(struct resampler const *rs,int cnt){
+  assert(rs != NULL);
+  // Output k (counting from the next) falls on input skip + floor((phase + k*M)/L)
+  long long const last = cnt - 1 - rs->skip; // Last usable input offset
+  if(last < 0)
+    return 0;
+  return (int)((last * rs->L + rs->L - 1 - rs->phase) / rs->M) + 1;
+}
+
+// Pass over cnt input samples of silence without computing anything, as resample_complex() would have
+// Returns the number of outputs they stand for
+long long resample_skip(struct resampler *rs,long long cnt){
+  assert(rs != NULL);
+  if(cnt <= 0)
+    return 0;
+  long long const last = cnt - 1 - rs->skip;
+  long long const n = last < 0 ? 0 : (last * rs->L + rs->L - 1 - rs->phase) / rs->M + 1;
+  long long const advance = rs->phase + n * rs->M;
+  rs->skip += advance / rs->L - cnt;
+  rs->phase = advance % rs->L;
+  // The newest history is now silence
+  int const keep = cnt < rs->taps - 1 ? rs->taps - 1 - cnt : 0;
+  memmove(rs->history,rs->history + rs->taps - 1 - keep,keep * sizeof(complex float));
+  memset(rs->history + keep,0,(rs->taps - 1 - keep) * sizeof(complex float));
+  return n;
+}
+
+// Resample cnt input samples, returning the number of outputs written
+// Everything is copied out of input before output is written, so they may be the same
+int resample_complex(struct resampler *rs,complex float *output,complex float const *input,int cnt){
+  assert(rs != NULL && output != NULL && input != NULL);
+  if(cnt <= 0)
+    return 0;
+  pthread_once(&Kernel_once,select_kernels);
+
+  int const taps = rs->taps;
+  complex float buffer[taps - 1 + cnt];
+  memcpy(buffer,rs->history,(taps-1)*sizeof(complex float));
+  memcpy(buffer+taps-1,input,cnt*sizeof(complex float));
+
+  int phase = rs->phase;
+  int pos = rs->skip; // Newest input used by the next output, as an offset into input
+  int n = 0;
+  while(pos < cnt){
+    output[n++] = (*Dot_kernel)(rs->coeffs + 2*phase*taps,(float *)(buffer + pos),2*taps);
+    phase += rs->M;
+    pos += phase / rs->L;
+    phase %= rs->L;
+  }
+  rs->phase = phase;
+  rs->skip = pos - cnt;
+  memcpy(rs->history,buffer+cnt,(taps-1)*sizeof(complex float));
+  return n;
+}
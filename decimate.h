@@ -1,14 +1,41 @@
 #ifndef _DECIMATE_H
 #define _DECIMATE_H 1
+#include <complex.h>
+#undef I
 
+// State of a 15-tap half-band decimator. Use one per stage, for either real or complex
+// samples but not both; zero it before the first call
 struct hb15_state {
-  float coeffs[4];
-  float even_samples[4];
-  float odd_samples[4];
-  float old_odd_samples[4];
+  float coeffs[4];   // Note ordering: coeffs[0] is at the tails, coeffs[3] is next to the center
+  float even[3*2];   // Last 3 even input samples, oldest first (6 floats when complex)
+  float odd[7*2];    // Last 7 odd input samples, oldest first
 };
+// Decimate by 2, producing cnt outputs from 2*cnt inputs. May run in place
 void hb15_block(struct hb15_state *state,float *output,float *input,int cnt);
 void hb3_block(float *state,float *output,float *input,int cnt);
 
+// Same on interleaved I/Q, filtering both channels in one pass
+void hb15_block_complex(struct hb15_state *state,complex float *output,complex float *input,int cnt);
+void hb3_block_complex(complex float *state,complex float *output,complex float *input,int cnt);
+
+// Polyphase FIR resampler by the rational factor L/M, on interleaved I/Q
+struct resampler {
+  int L;                  // Interpolation factor (reduced)
+  int M;                  // Decimation factor (reduced)
+  int taps;               // Taps in each of the L polyphase branches
+  float *coeffs;          // L branches of 2*taps floats, time reversed, each tap repeated for I and Q
+  int phase;              // Branch for the next output, 0 to L-1
+  int skip;               // Input samples to pass over before the next output
+  complex float *history; // Last taps-1 input samples, oldest first
+};
+struct resampler *create_resampler(int L,int M,int taps,float cutoff,float beta);
+void delete_resampler(struct resampler *rs);
+int resample_count(struct resampler const *rs,int cnt);
+double resample_delay(struct resampler const *rs);
+long long resample_skip(struct resampler *rs,long long cnt);
+int resample_complex(struct resampler *rs,complex float *output,complex float const *input,int cnt);
+
+// Name of the SIMD kernel picked for this CPU
+char const *decimate_kernel(void);
 
 #endif
@@ -127,7 +127,6 @@ static int Frequency_lock;
 // Adjust the selected item up or down one step
 void adjust_item(struct demod *demod,int direction){
   double tunestep;
-  double samptime = demod->filter.decimate / (double)demod->input.samprate;
   
   tunestep = pow(10., (double)demod->tune.step);
 
@@ -159,12 +158,10 @@ void adjust_item(struct demod *demod,int direction){
     }
     break;
   case 4: // Filter low edge
-    demod->filter.low += tunestep;
-    set_filter(demod->filter.out,samptime*demod->filter.low,samptime*demod->filter.high,demod->filter.kaiser_beta);
+    set_passband(demod,demod->filter.low + tunestep,NAN);
     break;
   case 5: // Filter high edge
-    demod->filter.high += tunestep;
-    set_filter(demod->filter.out,samptime*demod->filter.low,samptime*demod->filter.high,demod->filter.kaiser_beta);
+    set_passband(demod,NAN,demod->filter.high + tunestep);
     break;
   case 6: // Post-detection audio frequency shift
     demod->tune.shift += tunestep;
@@ -174,7 +171,7 @@ void adjust_item(struct demod *demod,int direction){
     demod->filter.kaiser_beta += tunestep;
     if(demod->filter.kaiser_beta < 0)
       demod->filter.kaiser_beta = 0;
-    set_filter(demod->filter.out,samptime*demod->filter.low,samptime*demod->filter.high,demod->filter.kaiser_beta);
+    set_passband(demod,NAN,NAN);
     break;
   }
 }
@@ -475,6 +472,7 @@ void *display(void *arg){
 
 
     int const N = demod->filter.L + demod->filter.M - 1;
+    int const fir = (demod->filter.partitions - 1) * demod->filter.L + demod->filter.M; // Whole impulse response, if partitioned
     // Filter window values
     row = 1;
     col = 1;
@@ -488,11 +486,11 @@ void *display(void *arg){
     mvwaddstr(filtering,row++,col,"Beta");    
     mvwprintw(filtering,row,col,"%'17d",demod->filter.L);
     mvwaddstr(filtering,row++,col,"Blocksize");
-    mvwprintw(filtering,row,col,"%'17d",demod->filter.M);
+    mvwprintw(filtering,row,col,"%'17d",fir);
     mvwaddstr(filtering,row++,col,"FIR");
     mvwprintw(filtering,row,col,"%'17.3f Hz",(float)demod->input.samprate / N);
     mvwaddstr(filtering,row++,col,"Freq bin");
-    mvwprintw(filtering,row,col,"%'17.3f ms",1000.0*(N - (demod->filter.M - 1)/2)/demod->input.samprate); // Is this correct?
+    mvwprintw(filtering,row,col,"%'17.3f ms",1000.0*(demod->filter.L + (fir - 1)/2)/demod->input.samprate); // Is this correct?
     mvwaddstr(filtering,row++,col,"Delay");
     mvwprintw(filtering,row,col,"%17d",demod->filter.interpolate);
     mvwaddstr(filtering,row++,col,"Interpolate");
@@ -625,6 +623,11 @@ void *display(void *arg){
 	wattron(options,A_UNDERLINE);
       mvwprintw(options,row++,col,"Stereo");    
       wattroff(options,A_UNDERLINE);
+
+      if(demod->filter.min_phase)
+	wattron(options,A_UNDERLINE);
+      mvwprintw(options,row++,col,"MinPhase");
+      wattroff(options,A_UNDERLINE);
     }
     box(options,0,0);
     mvwaddstr(options,0,2,"Options");
@@ -662,6 +665,8 @@ void *display(void *arg){
       wprintw(network," drops %'llu",demod->input.rtp.drops);
     if(demod->input.rtp.dupes)
       wprintw(network," dupes %'llu",demod->input.rtp.dupes);
+    if(demod->input.mrecv && demod->input.mrecv->calls)
+      wprintw(network," batch %.1f",(double)demod->input.mrecv->packets / demod->input.mrecv->calls);
 
     mvwprintw(network,row++,col,"Time: %s",lltime(demod->sdr.status.timestamp));
     update_sockcache(&output_source,(struct sockaddr *)&demod->output.source_address);
@@ -947,14 +952,14 @@ void *display(void *arg){
 	}
 	if(b != demod->filter.kaiser_beta){
 	  demod->filter.kaiser_beta = b;
-	  set_filter(demod->filter.out,demod->filter.low/demod->input.samprate,demod->filter.high/demod->input.samprate,demod->filter.kaiser_beta);
+	  set_passband(demod,NAN,NAN);
 	}
       }
       break;
     case 'o': // Set/clear option flags, most apply only to linear detector
       {
 	char str[160];
-	getentry("Enter option [isb pll cal flat square stereo mono], '!' prefix disables: ",str,sizeof(str));
+	getentry("Enter option [isb pll cal flat square stereo mono minphase], '!' prefix disables: ",str,sizeof(str));
 	if(strcasecmp(str,"mono") == 0){
 	  demod->output.channels = 1;
 	} else if(strcasecmp(str,"!mono") == 0){
@@ -977,6 +982,12 @@ void *display(void *arg){
 	  demod->opt.flat = 1;
 	} else if(strcasecmp(str,"!flat") == 0){
 	  demod->opt.flat = 0;
+	} else if(strcasecmp(str,"minphase") == 0){
+	  demod->filter.min_phase = 1;
+	  set_passband(demod,NAN,NAN); // Redesign the filter
+	} else if(strcasecmp(str,"!minphase") == 0){
+	  demod->filter.min_phase = 0;
+	  set_passband(demod,NAN,NAN);
 	}
       }
       break;
@@ -1055,6 +1066,10 @@ void *display(void *arg){
 	case 5:
 	  demod->output.channels = 2;
 	  break;
+	case 6:
+	  demod->filter.min_phase = !demod->filter.min_phase;
+	  set_passband(demod,NAN,NAN);
+	  break;
 	}
       }
     }
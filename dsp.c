@@ -9,6 +9,13 @@
 
 #include <complex.h>
 #include <math.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include "dsp.h"
 
 // return unit magnitude complex number with phase x radians
@@ -48,3 +55,209 @@ float const cnrmf(const complex float x){
 double const cnrm(const complex double x){
   return creal(x)*creal(x) + cimag(x) * cimag(x);
 }
+
+// Front end sample conversion: interleaved integer I/Q to complex float, scaled, with total energy
+// Kernels work on n = 2*cnt scalars, since I and Q are treated alike
+typedef float (*iq16_kernel)(float *,signed short const *,int,float);
+typedef float (*iq8_kernel)(float *,signed char const *,int,float);
+
+static float iq16_scalar(float *out,signed short const *in,int n,float scale){
+  float energy = 0;
+  for(int j=0; j < n; j++){
+    float const x = in[j] * scale;
+    out[j] = x;
+    energy += x * x;
+  }
+  return energy;
+}
+
+static float iq8_scalar(float *out,signed char const *in,int n,float scale){
+  float energy = 0;
+  for(int j=0; j < n; j++){
+    float const x = in[j] * scale;
+    out[j] = x;
+    energy += x * x;
+  }
+  return energy;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx512f")))
+static float iq16_avx512(float *out,signed short const *in,int n,float scale){
+  __m512 const s = _mm512_set1_ps(scale);
+  __m512 energy = _mm512_setzero_ps();
+  int j;
+  for(j=0; j + 16 <= n; j += 16){
+    __m512 const x = _mm512_mul_ps(s,_mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((__m256i const *)(in+j)))));
+    _mm512_storeu_ps(out+j,x);
+    energy = _mm512_fmadd_ps(x,x,energy);
+  }
+  return _mm512_reduce_add_ps(energy) + iq16_scalar(out+j,in+j,n-j,scale);
+}
+
+__attribute__((target("avx512f")))
+static float iq8_avx512(float *out,signed char const *in,int n,float scale){
+  __m512 const s = _mm512_set1_ps(scale);
+  __m512 energy = _mm512_setzero_ps();
+  int j;
+  for(j=0; j + 16 <= n; j += 16){
+    __m512 const x = _mm512_mul_ps(s,_mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((__m128i const *)(in+j)))));
+    _mm512_storeu_ps(out+j,x);
+    energy = _mm512_fmadd_ps(x,x,energy);
+  }
+  return _mm512_reduce_add_ps(energy) + iq8_scalar(out+j,in+j,n-j,scale);
+}
+
+__attribute__((target("avx2,fma")))
+static inline float hsum256(__m256 v){
+  __m128 x = _mm_add_ps(_mm256_castps256_ps128(v),_mm256_extractf128_ps(v,1));
+  x = _mm_add_ps(x,_mm_movehl_ps(x,x));
+  x = _mm_add_ss(x,_mm_shuffle_ps(x,x,1));
+  return _mm_cvtss_f32(x);
+}
+
+__attribute__((target("avx2,fma")))
+static float iq16_avx2(float *out,signed short const *in,int n,float scale){
+  __m256 const s = _mm256_set1_ps(scale);
+  __m256 energy = _mm256_setzero_ps();
+  int j;
+  for(j=0; j + 8 <= n; j += 8){
+    __m256 const x = _mm256_mul_ps(s,_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i const *)(in+j)))));
+    _mm256_storeu_ps(out+j,x);
+    energy = _mm256_fmadd_ps(x,x,energy);
+  }
+  return hsum256(energy) + iq16_scalar(out+j,in+j,n-j,scale);
+}
+
+__attribute__((target("avx2,fma")))
+static float iq8_avx2(float *out,signed char const *in,int n,float scale){
+  __m256 const s = _mm256_set1_ps(scale);
+  __m256 energy = _mm256_setzero_ps();
+  int j;
+  for(j=0; j + 8 <= n; j += 8){
+    __m256 const x = _mm256_mul_ps(s,_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((__m128i const *)(in+j)))));
+    _mm256_storeu_ps(out+j,x);
+    energy = _mm256_fmadd_ps(x,x,energy);
+  }
+  return hsum256(energy) + iq8_scalar(out+j,in+j,n-j,scale);
+}
+
+// SSE2 has no sign extension instructions; interleave each value with itself and shift it back down
+__attribute__((target("sse2")))
+static inline __m128 iq_sse2_step(float *out,__m128i w,__m128 s,__m128 energy){
+  __m128 const lo = _mm_mul_ps(s,_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(w,w),16)));
+  __m128 const hi = _mm_mul_ps(s,_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(w,w),16)));
+  _mm_storeu_ps(out,lo);
+  _mm_storeu_ps(out+4,hi);
+  return _mm_add_ps(energy,_mm_add_ps(_mm_mul_ps(lo,lo),_mm_mul_ps(hi,hi)));
+}
+
+__attribute__((target("sse2")))
+static inline float hsum128(__m128 x){
+  x = _mm_add_ps(x,_mm_movehl_ps(x,x));
+  x = _mm_add_ss(x,_mm_shuffle_ps(x,x,1));
+  return _mm_cvtss_f32(x);
+}
+
+__attribute__((target("sse2")))
+static float iq16_sse2(float *out,signed short const *in,int n,float scale){
+  __m128 const s = _mm_set1_ps(scale);
+  __m128 energy = _mm_setzero_ps();
+  int j;
+  for(j=0; j + 8 <= n; j += 8)
+    energy = iq_sse2_step(out+j,_mm_loadu_si128((__m128i const *)(in+j)),s,energy);
+  return hsum128(energy) + iq16_scalar(out+j,in+j,n-j,scale);
+}
+
+__attribute__((target("sse2")))
+static float iq8_sse2(float *out,signed char const *in,int n,float scale){
+  __m128 const s = _mm_set1_ps(scale);
+  __m128 energy = _mm_setzero_ps();
+  int j;
+  for(j=0; j + 8 <= n; j += 8){
+    __m128i const b = _mm_loadl_epi64((__m128i const *)(in+j));
+    energy = iq_sse2_step(out+j,_mm_srai_epi16(_mm_unpacklo_epi8(b,b),8),s,energy);
+  }
+  return hsum128(energy) + iq8_scalar(out+j,in+j,n-j,scale);
+}
+#endif
+
+#if defined(__ARM_NEON)
+static inline float32x4_t iq_neon_step(float *out,int16x8_t w,float32x4_t s,float32x4_t energy){
+  float32x4_t const lo = vmulq_f32(s,vcvtq_f32_s32(vmovl_s16(vget_low_s16(w))));
+  float32x4_t const hi = vmulq_f32(s,vcvtq_f32_s32(vmovl_s16(vget_high_s16(w))));
+  vst1q_f32(out,lo);
+  vst1q_f32(out+4,hi);
+  return vmlaq_f32(vmlaq_f32(energy,lo,lo),hi,hi);
+}
+
+static inline float hsum_neon(float32x4_t x){
+  float lanes[4];
+  vst1q_f32(lanes,x);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static float iq16_neon(float *out,signed short const *in,int n,float scale){
+  float32x4_t const s = vdupq_n_f32(scale);
+  float32x4_t energy = vdupq_n_f32(0);
+  int j;
+  for(j=0; j + 8 <= n; j += 8)
+    energy = iq_neon_step(out+j,vld1q_s16(in+j),s,energy);
+  return hsum_neon(energy) + iq16_scalar(out+j,in+j,n-j,scale);
+}
+
+static float iq8_neon(float *out,signed char const *in,int n,float scale){
+  float32x4_t const s = vdupq_n_f32(scale);
+  float32x4_t energy = vdupq_n_f32(0);
+  int j;
+  for(j=0; j + 8 <= n; j += 8)
+    energy = iq_neon_step(out+j,vmovl_s8(vld1_s8(in+j)),s,energy);
+  return hsum_neon(energy) + iq8_scalar(out+j,in+j,n-j,scale);
+}
+#endif
+
+static iq16_kernel Iq16_kernel = iq16_scalar;
+static iq8_kernel Iq8_kernel = iq8_scalar;
+static char const *Convert_name = "scalar";
+static pthread_once_t Convert_once = PTHREAD_ONCE_INIT;
+
+static void select_convert(void){
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")){
+    Iq16_kernel = iq16_avx512;
+    Iq8_kernel = iq8_avx512;
+    Convert_name = "avx512";
+  } else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+    Iq16_kernel = iq16_avx2;
+    Iq8_kernel = iq8_avx2;
+    Convert_name = "avx2";
+  } else if(__builtin_cpu_supports("sse2")){
+    Iq16_kernel = iq16_sse2;
+    Iq8_kernel = iq8_sse2;
+    Convert_name = "sse2";
+  }
+#elif defined(__ARM_NEON)
+  Iq16_kernel = iq16_neon;
+  Iq8_kernel = iq8_neon;
+  Convert_name = "neon";
+#endif
+}
+
+char const *convert_kernel(void){
+  pthread_once(&Convert_once,select_convert);
+  return Convert_name;
+}
+
+// Convert cnt interleaved 16-bit I/Q samples to complex, times scale
+// Returns the total energy (sum of squares of I and Q) of the output
+float convert_iq16(complex float *out,signed short const *in,int cnt,float scale){
+  pthread_once(&Convert_once,select_convert);
+  return (*Iq16_kernel)((float *)out,in,2*cnt,scale);
+}
+
+// Same for 8-bit samples
+float convert_iq8(complex float *out,signed char const *in,int cnt,float scale){
+  pthread_once(&Convert_once,select_convert);
+  return (*Iq8_kernel)((float *)out,in,2*cnt,scale);
+}
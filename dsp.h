@@ -32,6 +32,11 @@ double const cnrm(const complex double x);
 
 double const parse_frequency(const char *);
 
+// Interleaved integer I/Q to complex float times scale, returning total energy; see dsp.c
+float convert_iq16(complex float *out,signed short const *in,int cnt,float scale);
+float convert_iq8(complex float *out,signed char const *in,int cnt,float scale);
+char const *convert_kernel(void);
+
 #define dB2power(x) (powf(10.,(x)/10.))
 #define power2dB(x) (10*log10f(x))
 #define dB2voltage(x) (powf(10.,(x)/20.))
@@ -10,14 +10,31 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 #include <memory.h>
 #include <complex.h>
 #include <math.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#if defined(linux)
+#include <bsd/string.h>
+#endif
 #include <fftw3.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "misc.h"
 #include "dsp.h"
 #include "filter.h"
+#include "latency.h"
+
+#define FFT_TIME_SMOOTH 0.05 // Exponential smoothing of the FFT execution times, per block
 
 // Create fast convolution filters
 // The filters are now in two parts, filter_in (the master) and filter_out (the slave)
@@ -29,6 +46,12 @@
 // M = impulse response duration
 // in_type = REAL or COMPLEX
 
+// create_partitioned_filter_input() also takes a number of partitions P (uniformly partitioned overlap-save)
+// The impulse response is then (P-1)*L + M long, cut into P-1 pieces of L samples and a last one of M.
+// The master keeps the spectra of its last P blocks in a frequency domain delay line and each slave
+// sums piece p times the spectrum from p blocks back, so a filter as sharp as one with a P times
+// longer transform runs with the block latency of L. M must be at least L
+
 // filter_create_output() parameters, distinct per slave
 // master - pointer to associated master (input) filter
 // response = complex frequency response; may be NULL here and set later with set_filter()
@@ -50,10 +73,279 @@
 // to prevent aliasing. Remember that decimation reduces the Nyquist rate by the decimation ratio.
 // The set_filter() function uses Kaiser windowing for this purpose
 
+// FFTW planning
+// Plans are made at Fftw_plan_level, but anything other than FFTW_ESTIMATE can take seconds
+// for an awkward size like 8192 = 3840+4353-1. FFTW's own wisdom remembers the result,
+// keyed by transform size, type, direction and alignment, so we keep it in a file:
+// a plan already in the wisdom is made instantly, and a new one is saved as soon as it's made.
+// Planning at a real level overwrites the arrays, so always plan before filling them
+int Fftw_plan_level = FFTW_MEASURE;
+char Wisdom_file[PATH_MAX]; // Empty means don't save wisdom
+static pthread_mutex_t Wisdom_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+  char const *name;
+  int flag;
+} const Plan_levels[] = {
+  { "estimate", FFTW_ESTIMATE },
+  { "measure", FFTW_MEASURE },
+  { "patient", FFTW_PATIENT },
+  { "exhaustive", FFTW_EXHAUSTIVE },
+};
+
+// Planning level flag for a name, or -1 if unknown
+int plan_level(char const *name){
+  for(int i=0; i < sizeof(Plan_levels)/sizeof(Plan_levels[0]); i++)
+    if(strcasecmp(name,Plan_levels[i].name) == 0)
+      return Plan_levels[i].flag;
+  return -1;
+}
+
+char const *plan_level_name(int flag){
+  for(int i=0; i < sizeof(Plan_levels)/sizeof(Plan_levels[0]); i++)
+    if(flag == Plan_levels[i].flag)
+      return Plan_levels[i].name;
+  return "unknown";
+}
+
+// Read saved wisdom, if any, and save new wisdom back to the same file
+int load_wisdom(char const *filename){
+  assert(filename != NULL);
+  strlcpy(Wisdom_file,filename,sizeof(Wisdom_file));
+  pthread_mutex_lock(&Wisdom_mutex);
+  int const r = fftwf_import_wisdom_from_filename(Wisdom_file);
+  pthread_mutex_unlock(&Wisdom_mutex);
+  return r ? 0 : -1;
+}
+
+// Write all accumulated wisdom; a temp file and rename keeps a crash from leaving half of it
+// Caller holds Wisdom_mutex
+static int save_wisdom(void){
+  if(strlen(Wisdom_file) == 0)
+    return 0;
+  char tmp[PATH_MAX+8];
+  snprintf(tmp,sizeof(tmp),"%s.new",Wisdom_file);
+  if(!fftwf_export_wisdom_to_filename(tmp)){
+    fprintf(stderr,"Can't write FFTW wisdom to %s\n",tmp);
+    return -1;
+  }
+  if(rename(tmp,Wisdom_file) == -1){
+    perror(Wisdom_file);
+    unlink(tmp);
+    return -1;
+  }
+  return 0;
+}
+
+// Make a plan from wisdom if we have it, otherwise plan the hard way and save what we learned
+// The arguments are passed to both fftwf_plan_* calls, so keep them free of side effects
+#define PLAN(plan,call,...) do { \
+    if(Fftw_plan_level == FFTW_ESTIMATE){ \
+      plan = call(__VA_ARGS__,FFTW_ESTIMATE); \
+      break; \
+    } \
+    if((plan = call(__VA_ARGS__,Fftw_plan_level|FFTW_WISDOM_ONLY)) != NULL) \
+      break; \
+    pthread_mutex_lock(&Wisdom_mutex); \
+    plan = call(__VA_ARGS__,Fftw_plan_level); \
+    save_wisdom(); \
+    pthread_mutex_unlock(&Wisdom_mutex); \
+  } while(0)
+
+fftwf_plan plan_dft(int N,complex float *in,complex float *out,int sign){
+  fftwf_plan plan;
+  PLAN(plan,fftwf_plan_dft_1d,N,in,out,sign);
+  return plan;
+}
+fftwf_plan plan_r2c(int N,float *in,complex float *out){
+  fftwf_plan plan;
+  PLAN(plan,fftwf_plan_dft_r2c_1d,N,in,out);
+  return plan;
+}
+fftwf_plan plan_c2r(int N,complex float *in,float *out){
+  fftwf_plan plan;
+  PLAN(plan,fftwf_plan_dft_c2r_1d,N,in,out);
+  return plan;
+}
+
+// Choosing the block size and decimation for a given input sample rate
+// N = L + M - 1 is rounded up to a product of small primes so FFTW has a fast transform for it,
+// and both L and N are kept multiples of a "granule" so that decimations down to about
+// PLAN_MIN_RATE divide them, letting each slave's IFFT run at close to the lowest rate that holds its passband
+
+static int gcd(int a,int b){
+  while(b != 0){
+    int const t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// Is n a product of 2, 3, 5 and 7 only?
+static int smooth7(int n){
+  int const primes[] = {2,3,5,7};
+  for(int i=0; i < 4 && n > 1; i++){
+    while(n % primes[i] == 0)
+      n /= primes[i];
+  }
+  return n == 1;
+}
+
+// Largest 7-smooth divisor of samprate no more than samprate/PLAN_MIN_RATE
+static int plan_granule(int const samprate){
+  for(int g = samprate / PLAN_MIN_RATE; g > 1; g--){
+    if(samprate % g == 0 && smooth7(g))
+      return g;
+  }
+  return 1;
+}
+
+// Impulse response length for a transition width, Hz
+// The Kaiser window's transition is about sqrt(1+beta^2) bins of an M-point transform
+static int impulse_length(int const samprate,float const transition,float const beta){
+  return ceilf(sqrtf(1 + beta * beta) * samprate / transition) + 1;
+}
+
+// The partitioned case of plan_blocksize()
+static int plan_partitions(int const samprate,float const block_time,float const transition,float const beta,int * const L,int * const M,int * const partitions){
+  int const g = plan_granule(samprate);
+  int l = *L;
+  if(l <= 0)
+    l = max(1,(int)(block_time * samprate / (*partitions * g))) * g;
+  int mt = *M;
+  if(mt <= 0){
+    if(transition <= 0)
+      return -1;
+    mt = impulse_length(samprate,transition,beta);
+  }
+  // Each partition's transform needs N >= 2L-1 so an L-sample piece doesn't wrap around
+  int n = (2*l - 1 + g - 1) / g * g;
+  while(!smooth7(n))
+    n += g;
+  int const m = n - l + 1;
+  *L = l;
+  *M = m;
+  *partitions = mt <= m ? 1 : (mt - m + l - 1) / l + 1;
+  return 0;
+}
+
+// Pick L (from the block time, sec) and M (from the filter transition width, Hz, with a Kaiser window of the given beta)
+// Either may already be set (> 0) and is then left alone; if both are, nothing changes
+// Otherwise M is lengthened so that N is a multiple of the granule with no prime factors above 7
+// With *partitions > 1 the block time is divided among that many, and M (given or planned) is the whole
+// impulse response; L is then the shorter block, M comes back as the last partition's length,
+// a little over L, and *partitions as however many it takes to cover the whole impulse response
+int plan_blocksize(int const samprate,float const block_time,float const transition,float const beta,int * const L,int * const M,int * const partitions){
+  assert(L != NULL && M != NULL && partitions != NULL);
+  if(samprate <= 0 || L == NULL || M == NULL || partitions == NULL)
+    return -1;
+  if(*partitions > 1)
+    return plan_partitions(samprate,block_time,transition,beta,L,M,partitions);
+  *partitions = 1;
+  if(*L > 0 && *M > 0)
+    return 0;
+
+  int const g = plan_granule(samprate);
+  int l = *L;
+  if(l <= 0)
+    l = max(1,(int)(block_time * samprate / g)) * g;
+  int m = *M;
+  if(m <= 0){
+    if(transition <= 0)
+      return -1;
+    m = impulse_length(samprate,transition,beta);
+  }
+  int n = (l + m - 1 + g - 1) / g * g;
+  while(!smooth7(n))
+    n += g;
+  *L = l;
+  *M = n - l + 1;
+  return 0;
+}
+
+// Can a slave of a filter with this L and M decimate by 'decimate', and a resampler then
+// take the result to out_samprate without an unreasonably large polyphase filter?
+// A resampler's cost per output is its taps per branch whatever the ratio, so what's limited is
+// the number of branches (its interpolation factor), and how far the ratio is from 1;
+// near-unity ratios like 24/25 (50 kHz to 48 kHz) are cheap
+int decimation_ok(int const samprate,int const L,int const M,int const decimate,int const out_samprate){
+  if(decimate <= 0 || out_samprate <= 0 || samprate % decimate != 0 || L % decimate != 0 || (L + M - 1) % decimate != 0)
+    return 0;
+  int const rate = samprate / decimate;
+  int const g = gcd(rate,out_samprate);
+  int const up = out_samprate / g;
+  int const down = rate / g;
+  return up <= PLAN_MAX_PHASES && max(up,down) <= PLAN_MAX_RATIO * min(up,down);
+}
+
+// Largest usable decimation leaving a sample rate of at least min_rate, Hz
+// Never asks for more than out_samprate, since that's all that leaves anyway
+// Returns -1 if there isn't one
+int plan_decimate(int const samprate,int const L,int const M,float const min_rate,int const out_samprate){
+  float const need = min(min_rate,(float)out_samprate);
+  if(samprate <= 0)
+    return -1;
+  for(int d = samprate / max(1.0f,ceilf(need)); d >= 1; d--){
+    if(decimation_ok(samprate,L,M,d,out_samprate))
+      return d;
+  }
+  return -1;
+}
+
+// Map a ring of at least 'size' bytes (rounded up to a page, and returned in 'size') twice, back to back,
+// so any span of up to 'size' bytes starting in the first copy is contiguous and wraps into the start
+// Returns NULL if the system can't do it (no memfd_create() outside Linux)
+static void *mirror_alloc(unsigned int * const size){
+#if defined(linux)
+  long const page = sysconf(_SC_PAGESIZE);
+  unsigned int const len = (*size + page - 1) / page * page;
+  int const fd = memfd_create("filter",MFD_CLOEXEC);
+  if(fd == -1)
+    return NULL;
+  if(ftruncate(fd,len) != 0){
+    close(fd);
+    return NULL;
+  }
+  // Reserve both halves, then put the same pages in each
+  uint8_t * const base = mmap(NULL,2*len,PROT_NONE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if(base == MAP_FAILED){
+    close(fd);
+    return NULL;
+  }
+  if(mmap(base,len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,fd,0) == MAP_FAILED
+     || mmap(base+len,len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,fd,0) == MAP_FAILED){
+    munmap(base,2*len);
+    close(fd);
+    return NULL;
+  }
+  close(fd); // The mappings keep it
+  *size = len;
+  return base;
+#else
+  return NULL;
+#endif
+}
+
 // Set up input (master) half of filter
+// Overlap-save keeps the last M-1 input samples of each block as the start of the next. Rather than
+// copy them down, the N-point FFT input slides L samples along a mirrored ring each block, so
+// they're already in place. That needs every block start to keep FFTW's SIMD alignment, i.e.,
+// L samples a multiple of it; otherwise, or without the ring, we fall back to copying
 struct filter_in *create_filter_input(unsigned int const L,unsigned int const M, enum filtertype const in_type){
+  return create_partitioned_filter_input(L,M,1,in_type);
+}
 
+struct filter_in *create_partitioned_filter_input(unsigned int const L,unsigned int const M,unsigned int const partitions,enum filtertype const in_type){
+  assert(partitions >= 1);
+  if(partitions < 1)
+    return NULL;
+  if(partitions > 1 && M < L){
+    fprintf(stderr,"Partitioned filter needs M %'u >= L %'u\n",M,L);
+    return NULL;
+  }
   int const N = L + M - 1;
+  unsigned int const size = in_type == REAL ? sizeof(float) : sizeof(complex float);
 
   struct filter_in * const master = calloc(1,sizeof(*master));
 
@@ -64,31 +356,403 @@ struct filter_in *create_filter_input(unsigned int const L,unsigned int const M,
   master->in_type = in_type;
   master->ilen = L;
   master->impulse_length = M;
-
+  master->partitions = partitions;
+  // Each spectrum in the delay line starts on a cache line, so they all keep FFTW's alignment
+  unsigned int const bins = in_type == REAL ? N/2+1 : N;
+  master->fdl_stride = (bins + 7) & ~7;
+
+  master->ring_size = N * size;
+  master->ring = mirror_alloc(&master->ring_size);
+  if(master->ring != NULL && fftwf_alignment_of((float *)((uint8_t *)master->ring + L * size)) != fftwf_alignment_of(master->ring)){
+    munmap(master->ring,2*master->ring_size);
+    master->ring = NULL;
+  }
   switch(in_type){
   default:
     fprintf(stderr,"Filter input type %d, assuming complex\n",in_type); // Note fall-thru
   case COMPLEX:
-    master->fdomain = fftwf_alloc_complex(N);
-    assert(master->fdomain != NULL);
-    master->input_buffer.c = fftwf_alloc_complex(N);
-    assert(malloc_usable_size(master->input_buffer.c) >= N * sizeof(*master->input_buffer.c));
+    master->fdl = fftwf_alloc_complex(partitions * master->fdl_stride);
+    assert(master->fdl != NULL);
+    memset(master->fdl,0,partitions * master->fdl_stride * sizeof(*master->fdl));
+    master->fdomain = master->fdl;
+    if(master->ring != NULL)
+      master->input_buffer.c = master->ring;
+    else
+      master->input_buffer.c = fftwf_alloc_complex(N);
+    assert(master->input_buffer.c != NULL);
+    master->fwd_plan = plan_dft(N,master->input_buffer.c,master->fdomain,FFTW_FORWARD);
     memset(master->input_buffer.c,0,(M-1)*sizeof(*master->input_buffer.c)); // Clear earlier state
     master->input.c = master->input_buffer.c + M - 1;
-    master->fwd_plan = fftwf_plan_dft_1d(N,master->input_buffer.c,master->fdomain,FFTW_FORWARD,FFTW_ESTIMATE);
     break;
   case REAL:
-    master->fdomain = fftwf_alloc_complex(N/2+1); // Only N/2+1 will be filled in by the r2c FFT
-    assert(master->fdomain != NULL);
-    master->input_buffer.r = fftwf_alloc_real(N);
-    assert(malloc_usable_size(master->input_buffer.r) >= N * sizeof(*master->input_buffer.r));
+    master->fdl = fftwf_alloc_complex(partitions * master->fdl_stride); // Only N/2+1 will be filled in by the r2c FFT
+    assert(master->fdl != NULL);
+    memset(master->fdl,0,partitions * master->fdl_stride * sizeof(*master->fdl));
+    master->fdomain = master->fdl;
+    if(master->ring != NULL)
+      master->input_buffer.r = master->ring;
+    else
+      master->input_buffer.r = fftwf_alloc_real(N);
+    assert(master->input_buffer.r != NULL);
+    master->fwd_plan = plan_r2c(N,master->input_buffer.r,master->fdomain);
     memset(master->input_buffer.r,0,(M-1)*sizeof(*master->input_buffer.r)); // Clear earlier state
     master->input.r = master->input_buffer.r + M - 1;
-    master->fwd_plan = fftwf_plan_dft_r2c_1d(N,master->input_buffer.r,master->fdomain,FFTW_ESTIMATE);
     break;
   }
   return master;
 }
+// Frequency domain multiply kernels for execute_filter_output()
+// Each combination of input and output type gets its own routine, picked by create_filter_output(),
+// built from two primitives over contiguous runs of bins, in the widest SIMD the CPU supports:
+// a plain complex multiply, and a "pair" kernel that handles bin p together with its negative
+// frequency N_dec-p, so the conjugate fold for REAL output and the ISB cross conjugation
+// are done in the same pass as the multiply rather than going back over f_fdomain[]
+
+// How the pair kernel combines the positive (a) and negative (b) frequency products
+enum pair_mode {
+  PAIR_FOLD,       // out[p] = a + conj(b)                           (real output)
+  PAIR_ISB,        // out[p] = a + conj(b), out[dn] = b - conj(a)    (CROSS_CONJ)
+  PAIR_SPLIT_CONJ, // out[p] = a, out[dn] = b, with b using conj(x[p]) (real input, complex output)
+  PAIR_ISB_CONJ,   // PAIR_ISB, with b using conj(x[p])               (real input, CROSS_CONJ output)
+  PAIR_MODES
+};
+
+// out[j] = k * r[j] * x[j]
+typedef void (*cmul_kernel)(complex float *out,complex float const *r,complex float const *x,complex float k,int n);
+// Positive side runs up from op, rp, xp; negative side runs down from on, rn, xn
+typedef void (*pair_kernel)(complex float *op,complex float *on,complex float const *rp,complex float const *rn,
+			    complex float const *xp,complex float const *xn,complex float k,int n);
+
+static void cmul_scalar(complex float *out,complex float const *r,complex float const *x,complex float const k,int const n){
+  for(int j=0; j < n; j++)
+    out[j] = k * (r[j] * x[j]);
+}
+
+static inline __attribute__((always_inline)) void pair_generic(complex float *op,complex float *on,complex float const *rp,complex float const *rn,
+							       complex float const *xp,complex float const *xn,complex float const k,int const n,enum pair_mode const mode){
+  for(int j=0; j < n; j++){
+    complex float const a = k * (rp[j] * xp[j]);
+    complex float const b = k * (rn[-j] * (mode == PAIR_SPLIT_CONJ || mode == PAIR_ISB_CONJ ? conjf(xp[j]) : xn[-j]));
+    if(mode == PAIR_SPLIT_CONJ){
+      op[j] = a;
+      on[-j] = b;
+    } else {
+      op[j] = a + conjf(b);
+      if(mode != PAIR_FOLD)
+	on[-j] = b - conjf(a);
+    }
+  }
+}
+static void pair_fold_scalar(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_generic(op,on,rp,rn,xp,xn,k,n,PAIR_FOLD);
+}
+static void pair_isb_scalar(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_generic(op,on,rp,rn,xp,xn,k,n,PAIR_ISB);
+}
+static void pair_split_conj_scalar(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_generic(op,on,rp,rn,xp,xn,k,n,PAIR_SPLIT_CONJ);
+}
+static void pair_isb_conj_scalar(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_generic(op,on,rp,rn,xp,xn,k,n,PAIR_ISB_CONJ);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Interleaved complex multiply: (ar*br - ai*bi, ai*br + ar*bi) in one fmaddsub
+__attribute__((target("avx2,fma")))
+static inline __m256 cmul_avx2(__m256 const a,__m256 const b){
+  return _mm256_fmaddsub_ps(a,_mm256_moveldup_ps(b),_mm256_mul_ps(_mm256_permute_ps(a,0xb1),_mm256_movehdup_ps(b)));
+}
+__attribute__((target("avx2")))
+static inline __m256 conj_avx2(__m256 const a){
+  return _mm256_xor_ps(a,_mm256_setr_ps(0,-0.0f,0,-0.0f,0,-0.0f,0,-0.0f));
+}
+// Reverse the order of the 4 complex values
+__attribute__((target("avx2")))
+static inline __m256 rev_avx2(__m256 const a){
+  return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(a),0x1b));
+}
+
+__attribute__((target("avx2,fma")))
+static void cmul_avx2_kernel(complex float *out,complex float const *r,complex float const *x,complex float const k,int const n){
+  __m256 const kv = _mm256_setr_ps(crealf(k),cimagf(k),crealf(k),cimagf(k),crealf(k),cimagf(k),crealf(k),cimagf(k));
+  int j;
+  for(j=0; j + 4 <= n; j += 4){
+    __m256 const p = cmul_avx2(_mm256_loadu_ps((float const *)(r+j)),_mm256_loadu_ps((float const *)(x+j)));
+    _mm256_storeu_ps((float *)(out+j),cmul_avx2(kv,p));
+  }
+  cmul_scalar(out+j,r+j,x+j,k,n-j);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __attribute__((always_inline)) void pair_avx2(complex float *op,complex float *on,complex float const *rp,complex float const *rn,
+							    complex float const *xp,complex float const *xn,complex float const k,int const n,enum pair_mode const mode){
+  __m256 const kv = _mm256_setr_ps(crealf(k),cimagf(k),crealf(k),cimagf(k),crealf(k),cimagf(k),crealf(k),cimagf(k));
+  int j;
+  for(j=0; j + 4 <= n; j += 4){
+    __m256 const x = _mm256_loadu_ps((float const *)(xp+j));
+    __m256 const a = cmul_avx2(kv,cmul_avx2(_mm256_loadu_ps((float const *)(rp+j)),x));
+    __m256 const xb = (mode == PAIR_SPLIT_CONJ || mode == PAIR_ISB_CONJ) ? conj_avx2(x) : rev_avx2(_mm256_loadu_ps((float const *)(xn-j-3)));
+    __m256 const b = cmul_avx2(kv,cmul_avx2(rev_avx2(_mm256_loadu_ps((float const *)(rn-j-3))),xb));
+    if(mode == PAIR_SPLIT_CONJ){
+      _mm256_storeu_ps((float *)(op+j),a);
+      _mm256_storeu_ps((float *)(on-j-3),rev_avx2(b));
+    } else {
+      _mm256_storeu_ps((float *)(op+j),_mm256_add_ps(a,conj_avx2(b)));
+      if(mode != PAIR_FOLD)
+	_mm256_storeu_ps((float *)(on-j-3),rev_avx2(_mm256_sub_ps(b,conj_avx2(a))));
+    }
+  }
+  pair_generic(op+j,on-j,rp+j,rn-j,xp+j,xn-j,k,n-j,mode);
+}
+__attribute__((target("avx2,fma")))
+static void pair_fold_avx2(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_avx2(op,on,rp,rn,xp,xn,k,n,PAIR_FOLD);
+}
+__attribute__((target("avx2,fma")))
+static void pair_isb_avx2(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_avx2(op,on,rp,rn,xp,xn,k,n,PAIR_ISB);
+}
+__attribute__((target("avx2,fma")))
+static void pair_split_conj_avx2(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_avx2(op,on,rp,rn,xp,xn,k,n,PAIR_SPLIT_CONJ);
+}
+__attribute__((target("avx2,fma")))
+static void pair_isb_conj_avx2(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_avx2(op,on,rp,rn,xp,xn,k,n,PAIR_ISB_CONJ);
+}
+
+// Same again 8 complex values at a time
+__attribute__((target("avx512f")))
+static inline __m512 cmul_avx512(__m512 const a,__m512 const b){
+  return _mm512_fmaddsub_ps(a,_mm512_moveldup_ps(b),_mm512_mul_ps(_mm512_permute_ps(a,0xb1),_mm512_movehdup_ps(b)));
+}
+__attribute__((target("avx512f")))
+static inline __m512 conj_avx512(__m512 const a){
+  return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a),_mm512_set1_epi64(0x8000000000000000LL)));
+}
+__attribute__((target("avx512f")))
+static inline __m512 rev_avx512(__m512 const a){
+  return _mm512_castpd_ps(_mm512_permutexvar_pd(_mm512_set_epi64(0,1,2,3,4,5,6,7),_mm512_castps_pd(a)));
+}
+
+__attribute__((target("avx512f")))
+static void cmul_avx512_kernel(complex float *out,complex float const *r,complex float const *x,complex float const k,int const n){
+  double kd;
+  memcpy(&kd,&k,sizeof(kd));
+  __m512 const kv = _mm512_castpd_ps(_mm512_set1_pd(kd)); // k in every complex lane
+  int j;
+  for(j=0; j + 8 <= n; j += 8){
+    __m512 const p = cmul_avx512(_mm512_loadu_ps(r+j),_mm512_loadu_ps(x+j));
+    _mm512_storeu_ps(out+j,cmul_avx512(kv,p));
+  }
+  cmul_scalar(out+j,r+j,x+j,k,n-j);
+}
+
+__attribute__((target("avx512f")))
+static inline __attribute__((always_inline)) void pair_avx512(complex float *op,complex float *on,complex float const *rp,complex float const *rn,
+							      complex float const *xp,complex float const *xn,complex float const k,int const n,enum pair_mode const mode){
+  double kd;
+  memcpy(&kd,&k,sizeof(kd));
+  __m512 const kv = _mm512_castpd_ps(_mm512_set1_pd(kd)); // k in every complex lane
+  int j;
+  for(j=0; j + 8 <= n; j += 8){
+    __m512 const x = _mm512_loadu_ps(xp+j);
+    __m512 const a = cmul_avx512(kv,cmul_avx512(_mm512_loadu_ps(rp+j),x));
+    __m512 const xb = (mode == PAIR_SPLIT_CONJ || mode == PAIR_ISB_CONJ) ? conj_avx512(x) : rev_avx512(_mm512_loadu_ps(xn-j-7));
+    __m512 const b = cmul_avx512(kv,cmul_avx512(rev_avx512(_mm512_loadu_ps(rn-j-7)),xb));
+    if(mode == PAIR_SPLIT_CONJ){
+      _mm512_storeu_ps(op+j,a);
+      _mm512_storeu_ps(on-j-7,rev_avx512(b));
+    } else {
+      _mm512_storeu_ps(op+j,_mm512_add_ps(a,conj_avx512(b)));
+      if(mode != PAIR_FOLD)
+	_mm512_storeu_ps(on-j-7,rev_avx512(_mm512_sub_ps(b,conj_avx512(a))));
+    }
+  }
+  pair_generic(op+j,on-j,rp+j,rn-j,xp+j,xn-j,k,n-j,mode);
+}
+__attribute__((target("avx512f")))
+static void pair_fold_avx512(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_avx512(op,on,rp,rn,xp,xn,k,n,PAIR_FOLD);
+}
+__attribute__((target("avx512f")))
+static void pair_isb_avx512(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_avx512(op,on,rp,rn,xp,xn,k,n,PAIR_ISB);
+}
+__attribute__((target("avx512f")))
+static void pair_split_conj_avx512(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_avx512(op,on,rp,rn,xp,xn,k,n,PAIR_SPLIT_CONJ);
+}
+__attribute__((target("avx512f")))
+static void pair_isb_conj_avx512(complex float *op,complex float *on,complex float const *rp,complex float const *rn,complex float const *xp,complex float const *xn,complex float k,int n){
+  pair_avx512(op,on,rp,rn,xp,xn,k,n,PAIR_ISB_CONJ);
+}
+#endif
+
+static cmul_kernel Cmul_kernel = cmul_scalar;
+static pair_kernel Pair_kernel[PAIR_MODES] = { pair_fold_scalar, pair_isb_scalar, pair_split_conj_scalar, pair_isb_conj_scalar };
+static char const *Mult_kernel_name = "scalar";
+static pthread_once_t Mult_once = PTHREAD_ONCE_INIT;
+
+static void select_mult_kernels(void){
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")){
+    Cmul_kernel = cmul_avx512_kernel;
+    Pair_kernel[PAIR_FOLD] = pair_fold_avx512;
+    Pair_kernel[PAIR_ISB] = pair_isb_avx512;
+    Pair_kernel[PAIR_SPLIT_CONJ] = pair_split_conj_avx512;
+    Pair_kernel[PAIR_ISB_CONJ] = pair_isb_conj_avx512;
+    Mult_kernel_name = "avx512";
+  } else if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")){
+    Cmul_kernel = cmul_avx2_kernel;
+    Pair_kernel[PAIR_FOLD] = pair_fold_avx2;
+    Pair_kernel[PAIR_ISB] = pair_isb_avx2;
+    Pair_kernel[PAIR_SPLIT_CONJ] = pair_split_conj_avx2;
+    Pair_kernel[PAIR_ISB_CONJ] = pair_isb_conj_avx2;
+    Mult_kernel_name = "avx2";
+  }
+#endif
+}
+
+char const *filter_kernel(void){
+  pthread_once(&Mult_once,select_mult_kernels);
+  return Mult_kernel_name;
+}
+
+// Multiply n bins starting at master bin 'first', wrapping around at N
+static void cmul_wrap(complex float *out,complex float const *r,complex float const *x,int const N,int first,complex float const k,int n){
+  while(n > 0){
+    int const seg = min(n,N - first);
+    (*Cmul_kernel)(out,r,x+first,k,seg);
+    out += seg;
+    r += seg;
+    n -= seg;
+    first = 0;
+  }
+}
+
+// Pairs of bins: positive side from master bin 'up' going up, negative side from bin 'down' going down, both wrapping at N
+static void pair_wrap(enum pair_mode const mode,complex float *op,complex float *on,complex float const *rp,complex float const *rn,
+		      complex float const *x,int const N,int up,int down,complex float const k,int n){
+  while(n > 0){
+    int const seg = min(n,min(N - up,down + 1));
+    (*Pair_kernel[mode])(op,on,rp,rn,x+up,x+down,k,seg);
+    op += seg;
+    on -= seg;
+    rp += seg;
+    rn -= seg;
+    n -= seg;
+    if((up += seg) == N)
+      up = 0;
+    if((down -= seg) < 0)
+      down = N-1;
+  }
+}
+
+// The routines picked by create_filter_output(), one per combination of input and output type
+// Each multiplies master spectrum x[] by response[] into out[]
+// For a REAL input only bins 0..N/2 exist and F[-f] = conj(F[+f]); it can't be rotated, so 'first' and 'k' don't apply
+// Bins of the same output the fused pair kernels don't cover are done one at a time
+static void mult_real_real(struct filter_out * const slave,complex float * const out,complex float const * const response,complex float const * const x,int const first,complex float const k){
+  int const N_dec = (slave->master->ilen + slave->master->impulse_length - 1) / slave->decimate;
+  (*Cmul_kernel)(out,response,x,1,N_dec/2+1);
+}
+
+static void mult_real_complex(struct filter_out * const slave,complex float * const out,complex float const * const response,complex float const * const x,int const first,complex float const k){
+  int const N_dec = (slave->master->ilen + slave->master->impulse_length - 1) / slave->decimate;
+  int const pairs = N_dec - 1 - N_dec/2; // Negative frequencies
+
+  out[0] = response[0] * x[0];
+  (*Pair_kernel[PAIR_SPLIT_CONJ])(out+1,out+N_dec-1,response+1,response+N_dec-1,x+1,NULL,1,pairs);
+  (*Cmul_kernel)(out+1+pairs,response+1+pairs,x+1+pairs,1,N_dec/2 - pairs); // Nyquist, if N_dec is even
+}
+
+static void mult_real_isb(struct filter_out * const slave,complex float * const out,complex float const * const response,complex float const * const x,int const first,complex float const k){
+  int const N_dec = (slave->master->ilen + slave->master->impulse_length - 1) / slave->decimate;
+  int const h = N_dec/2;
+
+  out[0] = response[0] * x[0];
+  if(h == 0)
+    return;
+  (*Pair_kernel[PAIR_ISB_CONJ])(out+1,out+N_dec-1,response+1,response+N_dec-1,x+1,NULL,1,h-1);
+  out[h] = response[h] * x[h];
+  if(N_dec & 1)
+    out[h+1] = response[h+1] * conjf(x[h]); // Its partner isn't cross conjugated
+}
+
+static void mult_complex_complex(struct filter_out * const slave,complex float * const out,complex float const * const response,complex float const * const x,int const first,complex float const k){
+  int const N = slave->master->ilen + slave->master->impulse_length - 1;
+  int const N_dec = N / slave->decimate;
+  int const h = N_dec/2;
+
+  // DC and positive frequencies, starting at the rotated center, then the negative frequencies below it
+  cmul_wrap(out,response,x,N,first,k,h+1);
+  cmul_wrap(out+h+1,response+h+1,x,N,(first + h+1 - N_dec + N) % N,k,N_dec-1-h);
+}
+
+static void mult_complex_real(struct filter_out * const slave,complex float * const out,complex float const * const response,complex float const * const x,int const first,complex float const k){
+  int const N = slave->master->ilen + slave->master->impulse_length - 1;
+  int const N_dec = N / slave->decimate;
+  int const h = N_dec/2;
+
+  // Fold conjugates of negative frequencies into positive to force pure real result
+  out[0] = k * (response[0] * x[first]);
+  if(h == 0)
+    return;
+  pair_wrap(PAIR_FOLD,out+1,out+N_dec-1,response+1,response+N_dec-1,x,N,(first+1) % N,(first-1+N) % N,k,h-1);
+  out[h] = k * (response[h] * x[(first+h) % N]);
+}
+
+static void mult_complex_isb(struct filter_out * const slave,complex float * const out,complex float const * const response,complex float const * const x,int const first,complex float const k){
+  int const N = slave->master->ilen + slave->master->impulse_length - 1;
+  int const N_dec = N / slave->decimate;
+  int const h = N_dec/2;
+
+  // hack for ISB; forces negative frequencies onto I, positive onto Q
+  out[0] = k * (response[0] * x[first]);
+  if(h == 0)
+    return;
+  pair_wrap(PAIR_ISB,out+1,out+N_dec-1,response+1,response+N_dec-1,x,N,(first+1) % N,(first-1+N) % N,k,h-1);
+  out[h] = k * (response[h] * x[(first+h) % N]);
+  if(N_dec & 1)
+    out[h+1] = k * (response[h+1] * x[(first + h+1 - N_dec + N) % N]);
+}
+
+// The multiply for this combination of input and output types
+// A split ISB output is an ordinary complex product until execute_filter_output() pulls the sidebands apart
+typedef void (*mult_routine)(struct filter_out *,complex float *out,complex float const *response,complex float const *x,int first,complex float phasor);
+static mult_routine pick_multiply(struct filter_out const * const slave){
+  enum filtertype const out_type = slave->isb_split && slave->master->in_type == COMPLEX && slave->out_type == CROSS_CONJ ? COMPLEX : slave->out_type;
+  if(slave->master->in_type == REAL)
+    return out_type == REAL ? mult_real_real : out_type == CROSS_CONJ ? mult_real_isb : mult_real_complex;
+  else
+    return out_type == REAL ? mult_complex_real : out_type == CROSS_CONJ ? mult_complex_isb : mult_complex_complex;
+}
+
+// Have a CROSS_CONJ output from a COMPLEX master leave its sidebands apart, the upper in output and the lower in lower,
+// for the caller to tune and cross conjugate itself. Made for the life of the filter whatever its type now,
+// so ISB can be toggled later without planning an IFFT in the block path. Does nothing for a REAL master
+int split_isb_output(struct filter_out * const slave){
+  assert(slave != NULL);
+  if(slave->master->in_type != COMPLEX || slave->lower_plan != NULL)
+    return 0;
+  int const N_dec = (slave->master->ilen + slave->master->impulse_length - 1) / slave->decimate;
+  slave->lower_fdomain = fftwf_alloc_complex(N_dec);
+  slave->lower_buffer = fftwf_alloc_complex(N_dec);
+  if(slave->lower_fdomain == NULL || slave->lower_buffer == NULL){
+    fftwf_free(slave->lower_fdomain);
+    fftwf_free(slave->lower_buffer);
+    slave->lower_fdomain = slave->lower_buffer = NULL;
+    return -1;
+  }
+  memset(slave->lower_fdomain,0,N_dec * sizeof(*slave->lower_fdomain)); // The positive frequencies stay zero
+  slave->lower = slave->lower_buffer + N_dec - slave->olen;
+  slave->lower_plan = plan_dft(N_dec,slave->lower_fdomain,slave->lower_buffer,FFTW_BACKWARD);
+  slave->isb_split = 1;
+  return 0;
+}
+
 // Set up output (slave) side of filter (possibly one of several sharing the same input master)
 
 // Example: processing FM after demodulation to separate the PL tone and to de-emphasize the audio
@@ -120,25 +784,32 @@ struct filter_out *create_filter_output(struct filter_in * master,complex float
   else
     slave->noise_gain = NAN;
   
+  pthread_once(&Mult_once,select_mult_kernels);
+  slave->multiply = pick_multiply(slave);
+
   switch(slave->out_type){
   default:
   case COMPLEX:
   case CROSS_CONJ:
     slave->f_fdomain = fftwf_alloc_complex(N_dec);
     assert(slave->f_fdomain != NULL);
+    if(master->partitions > 1)
+      slave->f_partial = fftwf_alloc_complex(N_dec);
     slave->output_buffer.c = fftwf_alloc_complex(N_dec);
     assert(slave->output_buffer.c != NULL);
     slave->output.c = slave->output_buffer.c + N_dec - slave->olen;
-    slave->rev_plan = fftwf_plan_dft_1d(N_dec,slave->f_fdomain,slave->output_buffer.c,FFTW_BACKWARD,FFTW_ESTIMATE);
+    slave->rev_plan = plan_dft(N_dec,slave->f_fdomain,slave->output_buffer.c,FFTW_BACKWARD);
     break;
   case REAL:
     slave->f_fdomain = fftwf_alloc_complex(N_dec/2+1);
     assert(slave->f_fdomain != NULL);    
+    if(master->partitions > 1)
+      slave->f_partial = fftwf_alloc_complex(N_dec/2+1);
     slave->output_buffer.r = fftwf_alloc_real(N_dec);
     assert(slave->output_buffer.r != NULL);
     //    slave->output.r = slave->output_buffer.r + (master->impulse_length - 1)/decimate;
     slave->output.r = slave->output_buffer.r + N_dec - slave->olen;
-    slave->rev_plan = fftwf_plan_dft_c2r_1d(N_dec,slave->f_fdomain,slave->output_buffer.r,FFTW_ESTIMATE);
+    slave->rev_plan = plan_c2r(N_dec,slave->f_fdomain,slave->output_buffer.r);
     break;
   }
   return slave;
@@ -148,15 +819,49 @@ int execute_filter_input(struct filter_in * const master){
   if(master == NULL)
     return -1;
 
-  fftwf_execute(master->fwd_plan);  // Forward transform
+  long long const start = latency_clock();
+  // Forward transform, of wherever the input has slid to on the ring, into the delay line's next slot
+  // (always the same one if it isn't partitioned). The slaves find it through fdl_head
+  unsigned int const slot = (atomic_load(&master->fdl_head) + 1) % master->partitions;
+  complex float * const fdomain = master->fdl + slot * master->fdl_stride;
+  if(master->ring == NULL && master->partitions == 1)
+    fftwf_execute(master->fwd_plan);
+  else if(master->in_type == REAL)
+    fftwf_execute_dft_r2c(master->fwd_plan,master->input_buffer.r,fdomain);
+  else
+    fftwf_execute_dft(master->fwd_plan,master->input_buffer.c,fdomain);
+  master->fdomain = fdomain;
+  atomic_store(&master->fdl_head,slot);
+  master->fft_time += FFT_TIME_SMOOTH * (1e-9f * (latency_clock() - start) - master->fft_time);
 
   // Notify slaves of new data
-  pthread_mutex_lock(&master->filter_mutex);
-  master->blocknum++;
-  pthread_cond_broadcast(&master->filter_cond);
-  pthread_mutex_unlock(&master->filter_mutex);
+  // Only take the lock if a slave has gone to sleep; a slave that's keeping up just sees the new blocknum
+  // Both sides store then load with seq_cst, so either we see its waiters count or it sees our blocknum
+  atomic_fetch_add(&master->blocknum,1);
+  if(atomic_load(&master->waiters) != 0){
+    pthread_mutex_lock(&master->filter_mutex);
+    pthread_cond_broadcast(&master->filter_cond);
+    pthread_mutex_unlock(&master->filter_mutex);
+  }
 
-  // Perform overlap-and-save operation for fast convolution; note memmove is non-destructive
+  // Perform overlap-and-save operation for fast convolution
+  if(master->ring != NULL){
+    // Slide along so the last M-1 samples start the next block; past the end of the ring they're also at its start
+    master->ring_offset = (master->ring_offset + master->ilen * (master->in_type == REAL ? sizeof(float) : sizeof(complex float))) % master->ring_size;
+    switch(master->in_type){
+    default:
+    case COMPLEX:
+      master->input_buffer.c = (complex float *)((uint8_t *)master->ring + master->ring_offset);
+      master->input.c = master->input_buffer.c + master->impulse_length - 1;
+      break;
+    case REAL:
+      master->input_buffer.r = (float *)((uint8_t *)master->ring + master->ring_offset);
+      master->input.r = master->input_buffer.r + master->impulse_length - 1;
+      break;
+    }
+    return 0;
+  }
+  // Without the ring, copy them down; note memmove is non-destructive
   switch(master->in_type){
   default:
   case COMPLEX:
@@ -171,8 +876,42 @@ int execute_filter_input(struct filter_in * const master){
   return 0;
 }
 
+// Stand in for 'blocks' blocks of silence without transforming any of them
+// Clears the input history and spectra, then advances the block count by that many
+// so the slaves stay in step (e.g., keep their rotation phase) and each wakes to one block of silence
+// Only the thread calling execute_filter_input() may call this
+int reset_filter_input(struct filter_in * const master,unsigned int const blocks){
+  assert(master != NULL);
+  if(master == NULL)
+    return -1;
+  if(blocks == 0)
+    return 0;
 
-int execute_filter_output(struct filter_out * const slave){
+  int const N = master->ilen + master->impulse_length - 1;
+  switch(master->in_type){
+  default:
+  case COMPLEX:
+    memset(master->input_buffer.c,0,N * sizeof(*master->input_buffer.c));
+    break;
+  case REAL:
+    memset(master->input_buffer.r,0,N * sizeof(*master->input_buffer.r));
+    break;
+  }
+  memset(master->fdl,0,master->partitions * master->fdl_stride * sizeof(*master->fdl));
+  // Same notification as execute_filter_input()
+  atomic_fetch_add(&master->blocknum,blocks);
+  if(atomic_load(&master->waiters) != 0){
+    pthread_mutex_lock(&master->filter_mutex);
+    pthread_cond_broadcast(&master->filter_cond);
+    pthread_mutex_unlock(&master->filter_mutex);
+  }
+  return 0;
+}
+
+// Execute the output (slave) half of the filter
+// rotate != 0 shifts the (COMPLEX) input spectrum down by that many bins before filtering,
+// i.e., it tunes the slave to a carrier rotate * samprate / N Hz above the master's center
+int execute_filter_output(struct filter_out * const slave,int const rotate){
   assert(slave != NULL);
   if(slave == NULL)
     return -1;
@@ -183,71 +922,102 @@ int execute_filter_output(struct filter_out * const slave){
   assert(master->in_type != NONE);
   assert(master->fdomain != NULL);
   assert(slave->f_fdomain != NULL);  
+  assert(rotate == 0 || master->in_type == COMPLEX); // Can't rotate a conjugate-symmetric spectrum
 
   int const N = master->ilen + master->impulse_length - 1; // points in input buffer
-  int const N_dec = N / slave->decimate;                     // points in (decimated) output buffer
+  int const N_dec = N / slave->decimate; // points in (decimated) output buffer
+
+  // The output type can change between blocks, e.g., when ISB is toggled, so pick the multiply every time
+  int const split = slave->isb_split && master->in_type == COMPLEX && slave->out_type == CROSS_CONJ;
+  slave->multiply = pick_multiply(slave);
 
   // DC and positive frequencies up to nyquist frequency are same for all types
   assert(malloc_usable_size(slave->f_fdomain) >= (N_dec/2+1) * sizeof(*slave->f_fdomain));
   assert(malloc_usable_size(master->fdomain) >= (N_dec/2+1) * sizeof(*master->fdomain));
 
   // Wait for new block of data
-  pthread_mutex_lock(&master->filter_mutex);
-  while(slave->blocknum == master->blocknum)
-    pthread_cond_wait(&master->filter_cond,&master->filter_mutex);
-  slave->blocknum = master->blocknum;
-  pthread_mutex_unlock(&master->filter_mutex);
-
-  pthread_mutex_lock(&slave->response_mutex); // Protect access to response[] array
-  assert(malloc_usable_size(slave->response) >= (N_dec/2+1) * sizeof(*slave->response));
-  assert(slave->response != NULL);
-
-  // Positive frequencies up to half the nyquist rate are the same for all types
-  for(int p=0; p <= N_dec/2; p++){
-    slave->f_fdomain[p] = slave->response[p] * master->fdomain[p];
-  }
-  if(master->in_type == REAL){
-    if(slave->out_type != REAL){
-      // For a purely real input, F[-f] = conj(F[+f])
-      assert(malloc_usable_size(slave->f_fdomain) >= N_dec * sizeof(*slave->f_fdomain));
-      int p,dn;
-      for(p=1,dn=N_dec-1; dn > N_dec/2; p++,dn--){
-	slave->f_fdomain[dn] = slave->response[dn] * conjf(master->fdomain[p]);
-      }
-    } // out_type == REAL already handled
-  } else { // in_type == COMPLEX
-    if(slave->out_type != REAL){
-      // Complex output; do negative frequencies
-      assert(malloc_usable_size(master->fdomain) >= N * sizeof(*master->fdomain));
-      assert(malloc_usable_size(slave->response) >= N_dec * sizeof(*slave->response));
-      assert(malloc_usable_size(slave->f_fdomain) >= N_dec * sizeof(*slave->f_fdomain));
-
-      for(int n=N-1,dn=N_dec-1; dn > N_dec/2;n--,dn--){
-	slave->f_fdomain[dn] = slave->response[dn] * master->fdomain[n];
-      }
-    } else {
-      // Real output; fold conjugates of negative frequencies into positive to force pure real result
-      assert(malloc_usable_size(master->fdomain) >= N * sizeof(*master->fdomain));
-      assert(malloc_usable_size(slave->response) >= N_dec * sizeof(*slave->response));
-      for(int n=N-1,p=1,dn=N_dec-1; p < N_dec/2; p++,n--,dn--){
-	slave->f_fdomain[p] += conjf(slave->response[dn] * master->fdomain[n]);
-      }
-    }
+  unsigned int blocknum = atomic_load(&master->blocknum);
+  if(blocknum == slave->blocknum){
+    pthread_mutex_lock(&master->filter_mutex);
+    atomic_fetch_add(&master->waiters,1);
+    while((blocknum = atomic_load(&master->blocknum)) == slave->blocknum)
+      pthread_cond_wait(&master->filter_cond,&master->filter_mutex);
+    atomic_fetch_sub(&master->waiters,1);
+    pthread_mutex_unlock(&master->filter_mutex);
   }
-  pthread_mutex_unlock(&slave->response_mutex); // release response[]
-
-  if(slave->out_type == CROSS_CONJ){
-    // hack for ISB; forces negative frequencies onto I, positive onto Q
+  unsigned int const blocks = blocknum - slave->blocknum; // Normally 1, more if we fell behind
+  slave->blocknum = blocknum;
+
+  // Rotating the spectrum by 'rotate' bins is the same as multiplying the input by exp(-j*2*pi*rotate*n/N),
+  // except that the time origin of each block is reset, while it actually advances by L samples.
+  // Keep track of the phase this mixer would have at the start of each block, so the rotated signal
+  // stays continuous from block to block even when the rotation changes.
+  // Phases are in units of 2*pi/N; integer arithmetic mod N keeps them exact no matter how long we run
+  long long phase = slave->phase - ((long long)slave->rotate * master->ilen % N) * (blocks % N);
+  phase %= N;
+  if(phase < 0)
+    phase += N;
+  slave->phase = phase;
+  slave->rotate = rotate;
+
+  complex float phasor = 1; // Correction for the rotated block
+  int first = 0;            // master bin mapped to output DC
+  if(rotate != 0 || phase != 0){
+    first = rotate % N;
+    if(first < 0)
+      first += N;
+    // The FFT window starts M-1 samples before the new data
+    phasor = csincospi(2.0 * ((phase + (long long)first * (master->impulse_length - 1)) % N) / N);
+  }
+  // Mark ourselves as using response[] so set_filter() won't free it out from under us; see there
+  atomic_fetch_add(&slave->epoch,1);
+  complex float const * const response = atomic_load(&slave->response);
+  assert(response != NULL);
+  assert(malloc_usable_size((void *)response) >= (N_dec/2+1) * sizeof(*response));
+
+  // Negative frequencies are used unless both sides are real
+  if(master->in_type == COMPLEX)
+    assert(malloc_usable_size(master->fdomain) >= N * sizeof(*master->fdomain));
+  if(master->in_type == COMPLEX || slave->out_type != REAL)
+    assert(malloc_usable_size((void *)response) >= N_dec * sizeof(*response));
+  if(slave->out_type != REAL)
     assert(malloc_usable_size(slave->f_fdomain) >= N_dec * sizeof(*slave->f_fdomain));
-    for(int p=1,dn=N_dec-1; p < N_dec/2; p++,dn--){
-      complex float const pos = slave->f_fdomain[p];
-      complex float const neg = slave->f_fdomain[dn];
-      
-      slave->f_fdomain[p]  = pos + conjf(neg);
-      slave->f_fdomain[dn] = neg - conjf(pos);
+  if(master->partitions == 1){
+    (*slave->multiply)(slave,slave->f_fdomain,response,master->fdomain,first,phasor);
+  } else {
+    // Sum each partition's response times the spectrum of the block p back, which started p*L samples
+    // earlier when the equivalent mixer was at an earlier phase
+    unsigned int const head = atomic_load(&master->fdl_head);
+    int const bins = slave->out_type == REAL ? N_dec/2+1 : N_dec;
+    long long const step = ((long long)rotate * master->ilen % N + N) % N;
+    for(int p=0; p < master->partitions; p++){
+      complex float const * const x = master->fdl + ((head + master->partitions - p) % master->partitions) * master->fdl_stride;
+      complex float k = phasor;
+      if(p > 0 && step != 0)
+	k = csincospi(2.0 * ((phase + p * step + (long long)first * (master->impulse_length - 1)) % N) / N);
+      if(p == 0){
+	(*slave->multiply)(slave,slave->f_fdomain,response,x,first,k);
+      } else {
+	(*slave->multiply)(slave,slave->f_partial,response + p * N_dec,x,first,k);
+	for(int j=0; j < bins; j++)
+	  slave->f_fdomain[j] += slave->f_partial[j];
+      }
     }
   }
+  atomic_fetch_add(&slave->epoch,1); // Done with response[]
+
+  if(split){
+    // Give the negative frequencies their own IFFT, so the caller can tune both sidebands
+    // before cross conjugating them as mult_complex_isb() would
+    int const h = N_dec/2;
+    memcpy(slave->lower_fdomain + h+1,slave->f_fdomain + h+1,(N_dec-1-h) * sizeof(*slave->f_fdomain));
+    memset(slave->f_fdomain + h+1,0,(N_dec-1-h) * sizeof(*slave->f_fdomain));
+  }
+  long long const start = latency_clock();
   fftwf_execute(slave->rev_plan); // Note: c2r version destroys f_fdomain[]
+  if(split)
+    fftwf_execute(slave->lower_plan);
+  slave->fft_time += FFT_TIME_SMOOTH * (1e-9f * (latency_clock() - start) - slave->fft_time);
   return 0;
 }
 
@@ -256,8 +1026,11 @@ int delete_filter_input(struct filter_in * const master){
     return 0;
   
   fftwf_destroy_plan(master->fwd_plan);
-  fftwf_free(master->input_buffer.c);
-  fftwf_free(master->fdomain);
+  if(master->ring != NULL)
+    munmap(master->ring,2*master->ring_size);
+  else
+    fftwf_free(master->input_buffer.c);
+  fftwf_free(master->fdl);
   free(master);
   return 0;
 }
@@ -270,6 +1043,11 @@ int delete_filter_output(struct filter_out * const slave){
   fftwf_free(slave->output_buffer.c);
   fftwf_free(slave->response);
   fftwf_free(slave->f_fdomain);
+  fftwf_free(slave->f_partial);
+  if(slave->lower_plan != NULL)
+    fftwf_destroy_plan(slave->lower_plan);
+  fftwf_free(slave->lower_fdomain);
+  fftwf_free(slave->lower_buffer);
   free(slave);
   return 0;
 }
@@ -357,62 +1135,177 @@ int make_kaiser(float * const window,unsigned int const M,float const beta){
 }
 
 
-// Apply Kaiser window to filter frequency response
-// "response" is SIMD-aligned array of N complex floats
-// Impulse response will be limited to first M samples in the time domain
-// Phase is adjusted so "time zero" (center of impulse response) is at M/2
-// L and M refer to the decimated output
-int window_filter(int const L,int const M,complex float * const response,float const beta){
+// Persistent plans for filter design, one pair per transform size and type
+// Made once on scratch arrays and then run with fftwf_execute_dft*() on the caller's arrays,
+// so a passband change costs one FFT pair instead of two plan creations.
+// New-array execution requires the same alignment and in-place-ness as planning,
+// which fftwf_alloc_*() and the usage below guarantee
+// One-shot plans are for the odd sizes only used in designing (minimum phase conversion and whole
+// partitioned impulse responses). They're made with FFTW_ESTIMATE: the sizes aren't in the wisdom,
+// and measuring them would hold up set_filter(), and every other channel's, for the sake of a few FFTs
+struct design_plans {
+  struct design_plans *next;
+  int N;
+  enum filtertype type;  // COMPLEX: in place on N complex; REAL: N reals <-> N/2+1 complex
+  int one_shot;          // Planned with FFTW_ESTIMATE
+  fftwf_plan fwd;
+  fftwf_plan rev;
+};
+static struct design_plans *Design_plans;
+static pthread_mutex_t Design_plans_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct design_plans *design_plans(int const N,enum filtertype const type,int const one_shot){
+  pthread_mutex_lock(&Design_plans_mutex);
+  struct design_plans *dp;
+  for(dp = Design_plans; dp != NULL; dp = dp->next)
+    if(dp->N == N && dp->type == type && dp->one_shot == one_shot)
+      break;
+
+  if(dp == NULL && (dp = calloc(1,sizeof(*dp))) != NULL){
+    dp->N = N;
+    dp->type = type;
+    dp->one_shot = one_shot;
+    if(type == REAL){
+      float * const timebuf = fftwf_alloc_real(N);
+      complex float * const buffer = fftwf_alloc_complex(N/2+1);
+      if(one_shot){
+	dp->fwd = fftwf_plan_dft_r2c_1d(N,timebuf,buffer,FFTW_ESTIMATE);
+	dp->rev = fftwf_plan_dft_c2r_1d(N,buffer,timebuf,FFTW_ESTIMATE);
+      } else {
+	dp->fwd = plan_r2c(N,timebuf,buffer);
+	dp->rev = plan_c2r(N,buffer,timebuf);
+      }
+      fftwf_free(timebuf);
+      fftwf_free(buffer);
+    } else {
+      complex float * const buffer = fftwf_alloc_complex(N);
+      if(one_shot){
+	dp->fwd = fftwf_plan_dft_1d(N,buffer,buffer,FFTW_FORWARD,FFTW_ESTIMATE);
+	dp->rev = fftwf_plan_dft_1d(N,buffer,buffer,FFTW_BACKWARD,FFTW_ESTIMATE);
+      } else {
+	dp->fwd = plan_dft(N,buffer,buffer,FFTW_FORWARD);
+	dp->rev = plan_dft(N,buffer,buffer,FFTW_BACKWARD);
+      }
+      fftwf_free(buffer);
+    }
+    assert(dp->fwd != NULL && dp->rev != NULL);
+    dp->next = Design_plans;
+    Design_plans = dp;
+  }
+  pthread_mutex_unlock(&Design_plans_mutex);
+  return dp;
+}
+
+// First half of window_filter(): leaves the windowed impulse response in response[], zero padded to N
+// one_shot if N isn't a filter's own transform size; see design_plans()
+static int window_impulse(int const L,int const M,complex float * const response,float const beta,int const one_shot){
   assert(response != NULL);
   if(response == NULL)
     return -1;
   int const N = L + M - 1;
   assert(malloc_usable_size(response) >= N*sizeof(*response));
-  // fftw_plan can overwrite its buffers, so we're forced to make a temp. Ugh.
-  complex float * const buffer = fftwf_alloc_complex(N);
-  fftwf_plan fwd_filter_plan = fftwf_plan_dft_1d(N,buffer,buffer,FFTW_FORWARD,FFTW_ESTIMATE);
-  fftwf_plan rev_filter_plan = fftwf_plan_dft_1d(N,buffer,buffer,FFTW_BACKWARD,FFTW_ESTIMATE);
-
-  // Convert to time domain
-  memcpy(buffer,response,N*sizeof(*buffer));
-  fftwf_execute(rev_filter_plan);
-  fftwf_destroy_plan(rev_filter_plan);
-  
+  struct design_plans const * const dp = design_plans(N,COMPLEX,one_shot);
+  if(dp == NULL)
+    return -1;
+
+  // Convert to time domain, in place
+  fftwf_execute_dft(dp->rev,response,response);
 
   float kaiser_window[M];
   make_kaiser(kaiser_window,M,beta);
 
-
   // Round trip through FFT/IFFT scales by N
   float const gain = 1./N;
   // Shift to beginning of buffer to make causal; apply window and gain
   for(int n = M - 1; n >= 0; n--)
-    buffer[n] = buffer[(n-M/2+N)%N] * kaiser_window[n] * gain;
+    response[n] = response[(n-M/2+N)%N] * kaiser_window[n] * gain;
   // Pad with zeroes on right side
-  memset(buffer+M,0,(N-M)*sizeof(*buffer));
+  memset(response+M,0,(N-M)*sizeof(*response));
 
 #if 0
   fprintf(stderr,"Filter impulse response, shifted, windowed and zero padded\n");
   for(int n=0;n< N;n++)
-    fprintf(stderr,"%d %lg %lg\n",n,crealf(buffer[n]),cimagf(buffer[n]));
+    fprintf(stderr,"%d %lg %lg\n",n,crealf(response[n]),cimagf(response[n]));
 #endif
-  
+  return 0;
+}
+
+// Apply Kaiser window to filter frequency response
+// "response" is SIMD-aligned array of N complex floats
+// Impulse response will be limited to first M samples in the time domain
+// Phase is adjusted so "time zero" (center of impulse response) is at M/2
+// L and M refer to the decimated output
+int window_filter(int const L,int const M,complex float * const response,float const beta){
+  if(window_impulse(L,M,response,beta,0) == -1)
+    return -1;
+  int const N = L + M - 1;
+  struct design_plans const * const dp = design_plans(N,COMPLEX,0);
+  if(dp == NULL)
+    return -1;
+
   // Now back to frequency domain
-  fftwf_execute(fwd_filter_plan);
-  fftwf_destroy_plan(fwd_filter_plan);
+  fftwf_execute_dft(dp->fwd,response,response);
 
 #if 0
   fprintf(stderr,"Filter response amplitude\n");
   for(int n=0;n<N;n++){
     float f = n*192000./N;
-    fprintf(stderr,"%.1f %.1f\n",f,power2dB(cnrmf(buffer[n])));
+    fprintf(stderr,"%.1f %.1f\n",f,power2dB(cnrmf(response[n])));
   }
   fprintf(stderr,"\n");
 #endif
-  memcpy(response,buffer,N*sizeof(*response));
+  return 0;
+}
+// Minimum phase conversion by folding the cepstrum of the log magnitude response
+// The transform is oversampled to keep the cepstrum from aliasing, and the magnitude floored
+// so the log of a stopband zero stays finite
+#define MINPHASE_OVERSAMPLE 8
+#define MINPHASE_FLOOR 1e-5 // Relative to the peak, i.e., -100 dB
+
+// Replace the M-point impulse response at the start of impulse[] (zero padded to N) with the
+// minimum phase one having the same magnitude response. Its energy comes out bunched at the start
+// instead of centered at M/2, so the group delay in the passband is much less than M/2
+// It isn't exactly M points long; the tail is truncated
+static int minimum_phase(complex float * const impulse,int const M,int const N){
+  int const NB = MINPHASE_OVERSAMPLE * N;
+  struct design_plans const * const dp = design_plans(NB,COMPLEX,1);
+  complex float * const buffer = fftwf_alloc_complex(NB);
+  if(dp == NULL || buffer == NULL){
+    fftwf_free(buffer);
+    return -1;
+  }
+  memcpy(buffer,impulse,M * sizeof(*buffer));
+  memset(buffer + M,0,(NB - M) * sizeof(*buffer));
+  fftwf_execute_dft(dp->fwd,buffer,buffer);
+
+  float peak = 0;
+  for(int k=0; k < NB; k++)
+    peak = max(peak,cabsf(buffer[k]));
+  float const limit = peak * MINPHASE_FLOOR;
+  for(int k=0; k < NB; k++)
+    buffer[k] = logf(max(cabsf(buffer[k]),limit));
+
+  // Cepstrum; keep quefrency 0 and NB/2, double the positive half and zero the negative half
+  // Transformed back, that's the log magnitude plus j times the minimum phase
+  fftwf_execute_dft(dp->rev,buffer,buffer);
+  float const scale = 1./NB;
+  buffer[0] *= scale;
+  for(int n=1; n < NB/2; n++)
+    buffer[n] *= 2 * scale;
+  buffer[NB/2] *= scale;
+  memset(buffer + NB/2 + 1,0,(NB/2 - 1) * sizeof(*buffer));
+  fftwf_execute_dft(dp->fwd,buffer,buffer);
+  for(int k=0; k < NB; k++)
+    buffer[k] = cexpf(buffer[k]);
+
+  fftwf_execute_dft(dp->rev,buffer,buffer);
+  for(int n=0; n < M; n++)
+    impulse[n] = buffer[n] * scale;
+  memset(impulse + M,0,(N - M) * sizeof(*impulse));
   fftwf_free(buffer);
   return 0;
 }
+
 // Real-only counterpart to window_filter()
 // response[] is only N/2+1 elements containing DC and positive frequencies only
 // Negative frequencies are inplicitly the conjugate of the positive frequencies
@@ -423,19 +1316,14 @@ int window_rfilter(int const L,int const M,complex float * const response,float
     return -1;
   int const N = L + M - 1;
   assert(malloc_usable_size(response) >= (N/2+1)*sizeof(*response));
-  complex float * const buffer = fftwf_alloc_complex(N/2 + 1); // plan destroys its input
-  assert(buffer != NULL);
+  struct design_plans const * const dp = design_plans(N,REAL,0);
+  if(dp == NULL)
+    return -1;
   float * const timebuf = fftwf_alloc_real(N);
   assert(timebuf != NULL);
-  fftwf_plan fwd_filter_plan = fftwf_plan_dft_r2c_1d(N,timebuf,buffer,FFTW_ESTIMATE);
-  assert(fwd_filter_plan != NULL);
-  fftwf_plan rev_filter_plan = fftwf_plan_dft_c2r_1d(N,buffer,timebuf,FFTW_ESTIMATE);
-  assert(rev_filter_plan != NULL);
   
-  // Convert to time domain
-  memcpy(buffer,response,(N/2+1)*sizeof(*buffer));
-  fftwf_execute(rev_filter_plan);
-  fftwf_destroy_plan(rev_filter_plan);
+  // Convert to time domain; the c2r transform destroys response[], but we're replacing it anyway
+  fftwf_execute_dft_c2r(dp->rev,response,timebuf);
 
   // Shift to beginning of buffer, apply window and scale (N*N)
   float kaiser_window[M];
@@ -454,17 +1342,14 @@ int window_rfilter(int const L,int const M,complex float * const response,float
 #endif
   
   // Now back to frequency domain
-  fftwf_execute(fwd_filter_plan);
-  fftwf_destroy_plan(fwd_filter_plan);
+  fftwf_execute_dft_r2c(dp->fwd,timebuf,response);
   fftwf_free(timebuf);
 #if 0
   printf("Filter frequency response\n");
   for(int n=0; n < N/2 + 1; n++)
-    printf("%d %g %g (%.1f dB)\n",n,crealf(buffer[n]),cimagf(buffer[n]),
-	   power2dB(cnrmf(buffer[n])));
+    printf("%d %g %g (%.1f dB)\n",n,crealf(response[n]),cimagf(response[n]),
+	   power2dB(cnrmf(response[n])));
 #endif
-  memcpy(response,buffer,(N/2+1)*sizeof(*response));
-  fftwf_free(buffer);
   return 0;
 }
 
@@ -473,17 +1358,22 @@ float const noise_gain(struct filter_out const * const filter){
   if(filter == NULL)
     return NAN;
   struct filter_in *master = filter->master;
+  complex float const * const response = filter->response;
 
   int const N = master->ilen + master->impulse_length - 1;
   int const N_dec = N / filter->decimate;
 
+  // Partitions are disjoint pieces of one impulse response, so their energies just add
   float sum = 0;
-  if(master->in_type == REAL && filter->out_type == REAL){
-    for(int i=0;i<N_dec/2+1;i++)
-      sum += cnrmf(filter->response[i]);
-  } else {
-    for(int i=0;i<N_dec;i++)
-      sum += cnrmf(filter->response[i]);
+  for(int p=0; p < master->partitions; p++){
+    complex float const * const r = response + p * N_dec;
+    if(master->in_type == REAL && filter->out_type == REAL){
+      for(int i=0;i<N_dec/2+1;i++)
+	sum += cnrmf(r[i]);
+    } else {
+      for(int i=0;i<N_dec;i++)
+	sum += cnrmf(r[i]);
+    }
   }
   // the factor N compensates for the unity gain scaling
   // Amplitude is pre-scaled 1/N for the concatenated (FFT/IFFT) round trip, so the overall power
@@ -497,6 +1387,94 @@ float const noise_gain(struct filter_out const * const filter){
 }
 
 
+// Recently designed responses, so that returning to an earlier passband
+// (a scanner, or a mode switch) is a copy rather than a new design
+#define DESIGN_CACHE 32
+static struct design {
+  int N;                     // Undecimated FFT size; sets the gain
+  int N_dec;
+  int M_dec;
+  int partitions;
+  int min_phase;
+  float low,high,beta;
+  enum filtertype type;      // Output type; sets the gain
+  complex float *response;   // N_dec points per partition, or NULL if entry unused
+  unsigned long long used;   // For least recently used replacement
+} Designs[DESIGN_CACHE];
+static unsigned long long Design_clock;
+static pthread_mutex_t Design_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int design_match(struct design const *d,int N,int N_dec,int M_dec,int partitions,int min_phase,float low,float high,float beta,enum filtertype type){
+  return d->response != NULL && d->N == N && d->N_dec == N_dec && d->M_dec == M_dec && d->partitions == partitions && d->min_phase == min_phase
+    && d->low == low && d->high == high && d->beta == beta && d->type == type;
+}
+
+// Copy a cached design into response[], returning 0, or -1 if not cached
+static int lookup_design(complex float *response,int N,int N_dec,int M_dec,int partitions,int min_phase,float low,float high,float beta,enum filtertype type){
+  int r = -1;
+  pthread_mutex_lock(&Design_mutex);
+  for(int i=0; i < DESIGN_CACHE; i++){
+    struct design * const d = &Designs[i];
+    if(design_match(d,N,N_dec,M_dec,partitions,min_phase,low,high,beta,type)){
+      memcpy(response,d->response,partitions*N_dec*sizeof(*response));
+      d->used = ++Design_clock;
+      r = 0;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&Design_mutex);
+  return r;
+}
+
+static void save_design(complex float const *response,int N,int N_dec,int M_dec,int partitions,int min_phase,float low,float high,float beta,enum filtertype type){
+  pthread_mutex_lock(&Design_mutex);
+  struct design *victim = &Designs[0];
+  for(int i=0; i < DESIGN_CACHE; i++){
+    struct design * const d = &Designs[i];
+    if(design_match(d,N,N_dec,M_dec,partitions,min_phase,low,high,beta,type)){
+      victim = NULL; // Another thread beat us to it
+      break;
+    }
+    if(d->used < victim->used)
+      victim = d;
+  }
+  if(victim != NULL){
+    if(victim->response == NULL || victim->N_dec * victim->partitions != N_dec * partitions){
+      free(victim->response);
+      victim->response = malloc(partitions*N_dec*sizeof(*response));
+    }
+    if(victim->response != NULL){
+      memcpy(victim->response,response,partitions*N_dec*sizeof(*response));
+      victim->N = N;
+      victim->N_dec = N_dec;
+      victim->M_dec = M_dec;
+      victim->partitions = partitions;
+      victim->min_phase = min_phase;
+      victim->low = low;
+      victim->high = high;
+      victim->beta = beta;
+      victim->type = type;
+      victim->used = ++Design_clock;
+    }
+  }
+  pthread_mutex_unlock(&Design_mutex);
+}
+
+// Unwindowed brick wall response: 'gain' from low to high (fractions of the sample rate), zero elsewhere
+static void ideal_response(complex float * const response,int const N,float const low,float const high,float const gain){
+  for(int n=0;n<N;n++){
+    float f;
+    if(n <= N/2)
+      f = (float)n / N;
+    else
+      f = (float)(n-N) / N;
+    if(f >= low && f <= high)
+      response[n] = gain;
+    else
+      response[n] = 0;
+  }
+}
+
 int set_filter(struct filter_out * const slave,float const low,float const high,float const kaiser_beta){
   assert(slave != NULL);
   if(slave == NULL)
@@ -521,26 +1499,64 @@ int set_filter(struct filter_out * const slave,float const low,float const high,
     gain *= M_SQRT1_2;
 #endif
 
-  complex float * const response = fftwf_alloc_complex(N_dec);
-  for(int n=0;n<N_dec;n++){
-    float f;
-    if(n <= N_dec/2)
-      f = (float)n / N_dec;
-    else
-      f = (float)(n-N_dec) / N_dec;
-    if(f >= low && f <= high)
-      response[n] = gain;
-    else
-      response[n] = 0;
+  int const P = master->partitions;
+  complex float * const response = fftwf_alloc_complex(P * N_dec);
+  if(response == NULL)
+    return -1;
+  enum filtertype const type = slave->out_type == CROSS_CONJ ? REAL : slave->out_type; // Only the gain differs
+  int const min_phase = slave->min_phase;
+  if(lookup_design(response,N,N_dec,M_dec,P,min_phase,low,high,kaiser_beta,type) == 0)
+    goto swap;
+
+  if(P == 1 && !min_phase){
+    ideal_response(response,N_dec,low,high,gain);
+    window_filter(L_dec,M_dec,response,kaiser_beta);
+  } else {
+    // Design the whole (P-1)*L_dec + M_dec point impulse response at once, make it minimum phase
+    // if asked, then cut it into partitions (maybe just one) and transform each one separately
+    int const Mt_dec = (P-1) * L_dec + M_dec;
+    int const Nt = L_dec + Mt_dec - 1;
+    complex float * const whole = fftwf_alloc_complex(Nt);
+    complex float * const piece = fftwf_alloc_complex(N_dec); // Aligned, unlike most of response[]
+    struct design_plans const * const dp = design_plans(N_dec,COMPLEX,0);
+    if(whole == NULL || piece == NULL || dp == NULL){
+      fftwf_free(whole);
+      fftwf_free(piece);
+      fftwf_free(response);
+      return -1;
+    }
+    ideal_response(whole,Nt,low,high,gain);
+    window_impulse(L_dec,Mt_dec,whole,kaiser_beta,Nt != N_dec);
+    if(min_phase)
+      minimum_phase(whole,Mt_dec,Nt);
+    for(int p=0; p < P; p++){
+      int const len = p < P-1 ? L_dec : M_dec;
+      memcpy(piece,whole + p * L_dec,len * sizeof(*piece));
+      memset(piece + len,0,(N_dec - len) * sizeof(*piece));
+      fftwf_execute_dft(dp->fwd,piece,piece);
+      memcpy(response + p * N_dec,piece,N_dec * sizeof(*response));
+    }
+    fftwf_free(whole);
+    fftwf_free(piece);
   }
-  window_filter(L_dec,M_dec,response,kaiser_beta);
-  // Hot swap with existing response, if any, using mutual exclusion
+  save_design(response,N,N_dec,M_dec,P,min_phase,low,high,kaiser_beta,type);
+
+ swap:;
+  // Hot swap with existing response, if any. The mutex only keeps two set_filter() calls
+  // on the same slave apart; execute_filter_output() never takes it.
+  // Instead, it makes slave->epoch odd while it's using response[]. Once we've published the new
+  // response, the old one can be in use only by a multiply already under way when we swapped,
+  // so if the epoch is odd we wait for it to change before freeing the old one
   pthread_mutex_lock(&slave->response_mutex);
-  complex float *tmp = slave->response;
-  slave->response = response;
+  complex float * const old = atomic_exchange(&slave->response,response);
   slave->noise_gain = noise_gain(slave);
+  unsigned int const epoch = atomic_load(&slave->epoch);
+  if(epoch & 1){
+    while(atomic_load(&slave->epoch) == epoch)
+      sched_yield();
+  }
   pthread_mutex_unlock(&slave->response_mutex);
-  fftwf_free(tmp);
+  fftwf_free(old);
 
   return 0;
 }
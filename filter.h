@@ -9,6 +9,8 @@
 #define _FILTER_H 1
 
 #include <complex.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <fftw3.h>
 #undef I
 
@@ -54,42 +56,87 @@ struct filter {
 struct filter_in {
   enum filtertype in_type;           // REAL or COMPLEX
   unsigned int ilen;                          // Length of user portion of input buffer, aka 'L'
-  unsigned int impulse_length;                // Length of filter impulse response, aka 'M'
-  complex float *fdomain;            // Signal in frequency domain
+  unsigned int impulse_length;                // Length of filter impulse response, aka 'M'; per partition if partitioned
+  unsigned int partitions;           // Impulse response split into this many, the last M long and the rest L long
+  complex float *fdomain;            // Signal in frequency domain; the newest spectrum in fdl[] if partitioned
+  complex float *fdl;                // Frequency domain delay line: spectra of the last 'partitions' blocks
+  unsigned int fdl_stride;           // Complex floats from one spectrum in fdl[] to the next
+  atomic_uint fdl_head;              // Slot in fdl[] of the newest spectrum
   union rc input_buffer;             // Actual time-domain input buffer, length N = L + M - 1
   union rc input;                    // Beginning of user input area, length L
+  void *ring;                        // Mirrored ring that input_buffer slides along, or NULL if memmoved
+  unsigned int ring_size;            // Bytes in the ring; it's mapped twice, back to back
+  unsigned int ring_offset;          // Bytes from ring to input_buffer
   fftwf_plan fwd_plan;               // FFT (time -> frequency)
-  unsigned int blocknum;                      // Data sequence number, used to notify slaves of new data
-  pthread_mutex_t filter_mutex;      // Synchronization for sequence number
+  atomic_uint blocknum;               // Data sequence number, used to notify slaves of new data
+  atomic_int waiters;                // Slaves sleeping on filter_cond
+  pthread_mutex_t filter_mutex;      // Only for sleeping and waking slaves
   pthread_cond_t filter_cond;
+  float fft_time;                    // Smoothed execution time of the forward FFT, sec
 
 };
 struct filter_out {
   struct filter_in *master;
   enum filtertype out_type;          // REAL, COMPLEX or CROSS_CONJ
-  complex float *response;           // Filter response in frequency domain
-  pthread_mutex_t response_mutex;
+  complex float * _Atomic response;  // Filter response in frequency domain, N_dec points per partition; swapped by set_filter()
+  atomic_uint epoch;                 // Odd while execute_filter_output() is using response[]
+  pthread_mutex_t response_mutex;    // Serializes set_filter() calls; not taken by execute_filter_output()
   complex float *f_fdomain;          // Filtered signal in frequency domain
+  complex float *f_partial;          // One partition's share of it, when partitioned
   float noise_gain;                  // Filter gain on uniform noise (ratio < 1)
+  int min_phase;                     // set_filter() designs minimum phase responses, with little group delay
   union rc output_buffer;            // Actual time-domain output buffer, length N/decimate
   union rc output;                   // Beginning of user output area, length L/decimate
   fftwf_plan rev_plan;               // IFFT (frequency -> time)
+  int isb_split;                     // Set by split_isb_output(): CROSS_CONJ leaves the sidebands apart, upper in output, lower in lower
+  complex float *lower_fdomain;      // Negative frequencies moved out of f_fdomain when split
+  complex float *lower_buffer;       // Their time domain output, length N/decimate
+  complex float *lower;              // Beginning of user area of lower_buffer, length L/decimate
+  fftwf_plan lower_plan;             // IFFT of lower_fdomain
   unsigned int decimate;                      // Ratio of input to output sample rate
   unsigned int olen;                          // Length of user portion of output buffer
   unsigned int blocknum;                      // Last sequence number received from master, used for synchronization
+  int rotate;                        // Bins by which the input spectrum was rotated in the last block
+  long long phase;                   // Phase of equivalent mixer at start of block, units of 2*pi/N
+  float fft_time;                    // Smoothed execution time of the inverse FFT, sec
+  // Frequency domain multiply for this combination of input and output types, picked by execute_filter_output()
+  void (*multiply)(struct filter_out *,complex float *out,complex float const *response,complex float const *x,int first,complex float phasor);
 };
+// FFTW planning level and wisdom file; see filter.c
+extern int Fftw_plan_level;
+extern char Wisdom_file[];
+int plan_level(char const *name);
+char const *plan_level_name(int flag);
+int load_wisdom(char const *filename);
+fftwf_plan plan_dft(int N,complex float *in,complex float *out,int sign);
+fftwf_plan plan_r2c(int N,float *in,complex float *out);
+fftwf_plan plan_c2r(int N,complex float *in,float *out);
+
+// Block size and decimation planning; see filter.c
+#define PLAN_MIN_RATE 4000 // Hz, lowest decimated sample rate provided for
+#define PLAN_MAX_RATIO 16   // Largest overall interpolation or decimation left to a resampler
+#define PLAN_MAX_PHASES 256 // Most polyphase branches in a resampler; its coefficient table grows with them
+int plan_blocksize(int samprate,float block_time,float transition,float beta,int *L,int *M,int *partitions);
+int decimation_ok(int samprate,int L,int M,int decimate,int out_samprate);
+int plan_decimate(int samprate,int L,int M,float min_rate,int out_samprate);
+
 int window_filter(int L,int M,complex float *response,float beta);
 int window_rfilter(int L,int M,complex float *response,float beta);
 
 struct filter_in *create_filter_input(unsigned int const L,unsigned int const M, enum filtertype const in_type);
+struct filter_in *create_partitioned_filter_input(unsigned int L,unsigned int M,unsigned int partitions,enum filtertype in_type);
+#define filter_memory(master) (((master)->partitions - 1) * (master)->ilen + (master)->impulse_length - 1) // Input samples still affecting the output
 struct filter_out *create_filter_output(struct filter_in * master,complex float * response,unsigned int decimate, enum filtertype out_type);
 int execute_filter_input(struct filter_in *);
-int execute_filter_output(struct filter_out *);
+int reset_filter_input(struct filter_in *,unsigned int blocks);
+int split_isb_output(struct filter_out *);
+int execute_filter_output(struct filter_out *,int);
 int delete_filter_input(struct filter_in *);
 int delete_filter_output(struct filter_out *);
 int make_kaiser(float *window,unsigned int M,float beta);
 int set_filter(struct filter_out *,float,float,float);
 float const noise_gain(struct filter_out const *);
+char const *filter_kernel(void); // SIMD kernel picked for the frequency domain multiply
 
 
 // Experimental complex notch filter
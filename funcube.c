@@ -81,6 +81,8 @@ int Mcast_ttl = 1; // Don't send fast IQ streams beyond the local network by def
 // Global variables
 struct rtp_state Rtp;
 int Rtp_sock;     // Socket handle for sending real time stream
+struct msend *Rtp_send; // Batched transmit on Rtp_sock
+double Send_latency = 0.005; // Max time an I/Q packet may wait for others to batch with, sec
 int Nctl_sock;    // Socket handle for incoming commands
 int Status_sock;  // Socket handle for outgoing status messages
 struct sockaddr_storage Output_dest_address; // Multicast output socket
@@ -118,7 +120,7 @@ int main(int argc,char *argv[]){
   int c;
   int List_audio = 0;
 
-  while((c = getopt(argc,argv,"dc:vl:b:oR:T:LI:S:")) != -1){
+  while((c = getopt(argc,argv,"dc:vl:b:op:R:T:LI:S:t:")) != -1){
     switch(c){
     case 'd':
       Daemonize++;
@@ -139,6 +141,10 @@ int main(int argc,char *argv[]){
     case 'I':
       Device = strtol(optarg,NULL,0);
       break;
+    case 'p':
+      if(add_thread_sched(optarg) == -1) // CPU affinity and scheduling, name=cpulist[:policy[:priority]]
+	exit(1);
+      break;
     case 'v':
       if(!Daemonize)
 	Status = stderr; // Could be overridden by status file argument below
@@ -155,6 +161,9 @@ int main(int argc,char *argv[]){
     case 'S':
       Rtp.ssrc = strtol(optarg,NULL,0);
       break;
+    case 't':
+      Send_latency = strtod(optarg,NULL) * 1e-3; // Milliseconds
+      break;
     default:
     case '?':
       fprintf(stderr,"Unknown argument %c\n",c);
@@ -162,6 +171,10 @@ int main(int argc,char *argv[]){
       break;
     }
   }
+  if(RTP_MIN_SIZE + 24 + Blocksize * 2 * sizeof(short) > SEND_MAX_PKTSIZE){
+    fprintf(stderr,"Blocksize %d too large for an RTP packet of %d bytes\n",Blocksize,SEND_MAX_PKTSIZE);
+    exit(1);
+  }
   setlocale(LC_ALL,Locale);
 
   if(List_audio){
@@ -264,6 +277,10 @@ int main(int argc,char *argv[]){
     errmsg("Can't create multicast socket: %s\n",strerror(errno));
     exit(1);
   }
+  if((Rtp_send = create_msend(Rtp_sock,Send_latency,RTP_MIN_SIZE + 24 + Blocksize * 2 * sizeof(short))) == NULL){
+    errmsg("Can't allocate transmit queue\n");
+    exit(1);
+  }
     
   Pa_Initialize();
   if(front_end_init(sdr,Device,ADC_samprate,Blocksize) < 0){
@@ -296,6 +313,9 @@ int main(int argc,char *argv[]){
 
   float rate_factor = Blocksize/(ADC_samprate * Power_alpha);
 
+  // The main thread becomes the A/D reader, so give it a name that -p can match
+  pthread_setname("funcube");
+
   while(1){
     struct rtp_header rtp;
     memset(&rtp,0,sizeof(rtp));
@@ -305,7 +325,8 @@ int main(int argc,char *argv[]){
     rtp.seq = Rtp.seq++;
     rtp.timestamp = Rtp.timestamp;
 
-    unsigned char buffer[16384]; // Pick a better value
+    // Build packet in place in the transmit queue
+    unsigned char * const buffer = send_buffer(Rtp_send);
     unsigned char *dp = buffer;
 
     dp = hton_rtp(dp,&rtp);
@@ -351,7 +372,7 @@ int main(int argc,char *argv[]){
       //sampbuf[i+1] = round(cimagf(samp));
     }
 
-    if(send(Rtp_sock,buffer,dp - buffer,0) == -1){
+    if(queue_send(Rtp_send,dp - buffer) == -1){
       errmsg("send: %s\n",strerror(errno));
       // If we're sending to a unicast address without a listener, we'll get ECONNREFUSED
       // Should sleep to slow down the rate of these messages
@@ -58,10 +58,14 @@ struct sdrstate {
 float Upper_limit = -15;
 float Lower_limit = -25;
 
-int ADC_samprate; // Computed from Out_samprate * Decimate
+int ADC_samprate; // Computed from Out_samprate * Decimate unless given with -A
 int Out_samprate = 192000;
 int Decimate = 64;
 int Log_decimate = 6; // Computed from Decimate
+struct resampler *Resampler; // Final L/M stage when ADC_samprate isn't Out_samprate * Decimate
+float Resamp_order = 30;     // Taps per polyphase branch, times L/M
+float Resamp_beta = 3;       // Kaiser window parameter, as in make_kaiser()
+int Stage_blocksize;         // Samples per packet out of the half-band stages
 float Filter_atten = 1;
 int Blocksize = 350;
 int Device = 0;      // Which of several to use
@@ -85,6 +89,8 @@ pthread_t Process_thread;
 pthread_t AGC_thread;
 pthread_t Status_thread;
 int Rtp_sock; // Socket handle for sending real time stream *and* receiving commands
+struct msend *Rtp_send; // Batched transmit on Rtp_sock
+double Send_latency = 0.005; // Max time an I/Q packet may wait for others to batch with, sec
 int Status_sock;
 struct sockaddr_storage Output_dest_address;
 struct rtp_state Rtp;
@@ -199,7 +205,6 @@ void *process(void *arg){
 
   pthread_setname("hackrf-proc");
 
-  unsigned char buffer[200+2*Blocksize*sizeof(short)];
   struct rtp_header rtp;
   memset(&rtp,0,sizeof(rtp));
   rtp.version = RTP_VERS;
@@ -207,60 +212,56 @@ void *process(void *arg){
   rtp.ssrc = Rtp.ssrc;
   int rotate_phase = 0;
 
-  // Decimation filter states
-  struct hb15_state hb15_state_real[Log_decimate];
-  struct hb15_state hb15_state_imag[Log_decimate];
-  memset(hb15_state_real,0,sizeof(hb15_state_real));
-  memset(hb15_state_imag,0,sizeof(hb15_state_imag));
-  float hb3state_real[Log_decimate];
-  float hb3state_imag[Log_decimate];
-  memset(hb3state_real,0,sizeof(hb3state_real));
-  memset(hb3state_imag,0,sizeof(hb3state_imag));
-
-#if 0
-  // Verify SIMD alignment
-  assert(((uint64_t)hb15_state_real & 15) == 0);
-  assert(((uint64_t)hb15_state_imag & 15) == 0);
-#endif
+  // Decimation filter states, I and Q filtered together
+  struct hb15_state hb15_state[Log_decimate];
+  memset(hb15_state,0,sizeof(hb15_state));
+  complex float hb3state[Log_decimate];
+  memset(hb3state,0,sizeof(hb3state));
 
   // Initialize coefficients here!!!
   // As experiment, use Goodman/Carey "F8" 15-tap filter
   // Note word order in array -- [3] is closest to the center, [0] is on the tails
   for(int i=0; i<Log_decimate; i++){ // For each stage (h(0) is always unity, other h(n) are zero for even n)
-    hb15_state_real[i].coeffs[3] = 490./802;
-    hb15_state_imag[i].coeffs[3] = 490./802;
-    hb15_state_real[i].coeffs[2] = -116./802;
-    hb15_state_imag[i].coeffs[2] = -116./802;
-    hb15_state_real[i].coeffs[1] = 33./802; 
-    hb15_state_imag[i].coeffs[1] = 33./802;    
-    hb15_state_real[i].coeffs[0] = -6./802; 
-    hb15_state_imag[i].coeffs[0] = -6./802;    
+    hb15_state[i].coeffs[3] = 490./802;
+    hb15_state[i].coeffs[2] = -116./802;
+    hb15_state[i].coeffs[1] = 33./802; 
+    hb15_state[i].coeffs[0] = -6./802; 
   }
+  errmsg("decimation kernel: %s\n",decimate_kernel());
   float time_p_packet = (float)Blocksize / Out_samprate;
   while(1){
 
     rtp.timestamp = Rtp.timestamp;
     rtp.seq = Rtp.seq++;
 
-    unsigned char *dp = buffer;
-    dp = hton_rtp(dp,&rtp);
-    dp = hton_status(dp,&HackCD.status);
-
     // Wait for enough to be available
     pthread_mutex_lock(&Buf_mutex);
     while(1){
       int avail = (Samp_wp - Samp_rp) & (BUFFERSIZE-1);
-      if(avail >= Blocksize*Decimate)
+      if(avail >= Stage_blocksize*Decimate)
 	break;
+      if(Rtp_send->count > 0){
+	// Don't hold queued packets while we sleep
+	pthread_mutex_unlock(&Buf_mutex);
+	flush_send(Rtp_send);
+	pthread_mutex_lock(&Buf_mutex);
+	continue;
+      }
       pthread_cond_wait(&Buf_cond,&Buf_mutex);
     }
     pthread_mutex_unlock(&Buf_mutex);
+
+    // Build packet in place in the transmit queue
+    // (only after any flush above, which empties the queue)
+    unsigned char * const buffer = send_buffer(Rtp_send);
+    unsigned char *dp = buffer;
+    dp = hton_rtp(dp,&rtp);
+    dp = hton_status(dp,&HackCD.status);
     
-    float workblock_real[Decimate*Blocksize];    // Hold input to first decimator, half used on each filter call
-    float workblock_imag[Decimate*Blocksize];
+    complex float workblock[Decimate*Stage_blocksize];    // Hold input to first decimator, half used on each filter call
 
     // Load first stage with corrected samples
-    int loop_limit = Decimate * Blocksize;
+    int loop_limit = Decimate * Stage_blocksize;
     for(int i=0; i<loop_limit; i++){
       complex float samp = Sampbuffer[Samp_rp++];
       float samp_i = crealf(samp);
@@ -271,65 +272,51 @@ void *process(void *arg){
       switch(rotate_phase){
       default:
       case 0:
-	workblock_real[i] = samp_i;
-	workblock_imag[i] = samp_q;
+	workblock[i] = CMPLXF(samp_i,samp_q);
 	break;
       case 1:
-	workblock_real[i] = -samp_q;
-	workblock_imag[i] = samp_i;
+	workblock[i] = CMPLXF(-samp_q,samp_i);
 	break;
       case 2:
-	workblock_real[i] = -samp_i;
-	workblock_imag[i] = -samp_q;
+	workblock[i] = CMPLXF(-samp_i,-samp_q);
 	break;
       case 3:
-	workblock_real[i] = samp_q;
-	workblock_imag[i] = -samp_i;
+	workblock[i] = CMPLXF(samp_q,-samp_i);
 	break;
       }
       rotate_phase += Offset;
       rotate_phase &= 3; // Modulo 4
     }
 
-    // Real channel decimation
+    // Decimation, I and Q interleaved
     // First stages can use simple, fast filter; later ones use slower filter
     int j;
     for(j=Log_decimate-1;j>=stage_threshold;j--)
-      hb3_block(&hb3state_real[j],workblock_real,workblock_real,(1<<j)*Blocksize);
+      hb3_block_complex(&hb3state[j],workblock,workblock,(1<<j)*Stage_blocksize);
 
     for(; j>=0;j--)
-      hb15_block(&hb15_state_real[j],workblock_real,workblock_real,(1<<j)*Blocksize);
+      hb15_block_complex(&hb15_state[j],workblock,workblock,(1<<j)*Stage_blocksize);
 
-    float output_energy = 0;
-    signed short *up = (signed short *)dp;
-    loop_limit = Blocksize;
-    for(int j=0;j<loop_limit;j++){
-      float s = workblock_real[j] * Filter_atten;
-      output_energy += s*s;
-      *up++ = (short)round(32767 * s);
-      up++;
+    // Stage_blocksize is a whole number of resampler periods, so this always yields Blocksize
+    if(Resampler != NULL){
+      int const n = resample_complex(Resampler,workblock,workblock,Stage_blocksize);
+      assert(n == Blocksize);
+      (void)n;
     }
 
-    // Imaginary channel decimation
-    for(j=Log_decimate-1;j>=stage_threshold;j--)
-      hb3_block(&hb3state_imag[j],workblock_imag,workblock_imag,(1<<j)*Blocksize);
-
-    for(; j>=0;j--)
-      hb15_block(&hb15_state_imag[j],workblock_imag,workblock_imag,(1<<j)*Blocksize);
-
-    // Interleave imaginary samples following real
-    up = (signed short *)dp;
+    float output_energy = 0;
+    signed short *up = (signed short *)dp;
     loop_limit = Blocksize;
     for(int j=0;j<loop_limit;j++){
-      float s = workblock_imag[j] * Filter_atten;
-      output_energy += s*s;
-      up++;
-      *up++ = (short)round(32767 * s);
+      complex float const s = workblock[j] * Filter_atten;
+      output_energy += crealf(s) * crealf(s) + cimagf(s) * cimagf(s);
+      *up++ = (short)round(32767 * crealf(s));
+      *up++ = (short)round(32767 * cimagf(s));
     }
 
     HackCD.out_power = 0.5 * output_energy / Blocksize;
     dp = (unsigned char *)up;
-    if(send(Rtp_sock,buffer,dp - buffer,0) == -1){
+    if(queue_send(Rtp_send,dp - buffer) == -1){
       errmsg("send: %s",strerror(errno));
       // If we're sending to a unicast address without a listener, we'll get ECONNREFUSED
       // Sleep 1 sec to slow down the rate of these messages
@@ -366,7 +353,7 @@ int main(int argc,char *argv[]){
     Locale = "en_US.UTF-8";
 
   int c;
-  while((c = getopt(argc,argv,"D:I:dvl:b:R:T:o:r:S:")) != -1){
+  while((c = getopt(argc,argv,"A:D:I:dvl:b:p:R:T:o:r:S:t:")) != -1){
     switch(c){
     case 'd':
       Daemonize++;
@@ -381,12 +368,19 @@ int main(int argc,char *argv[]){
     case 'R':
       Dest = optarg;
       break;
+    case 'A':
+      ADC_samprate = strtol(optarg,NULL,0);
+      break;
     case 'D':
       Decimate = strtol(optarg,NULL,0);
       break;
     case 'I':
       Device = strtol(optarg,NULL,0);
       break;
+    case 'p':
+      if(add_thread_sched(optarg) == -1) // CPU affinity and scheduling, name=cpulist[:policy[:priority]]
+	exit(1);
+      break;
     case 'v':
       if(!Daemonize)
 	Status = stderr;
@@ -403,12 +397,19 @@ int main(int argc,char *argv[]){
     case 'S':
       Rtp.ssrc = strtol(optarg,NULL,0);
       break;
+    case 't':
+      Send_latency = strtod(optarg,NULL) * 1e-3; // Milliseconds
+      break;
     default:
     case '?':
       fprintf(stderr,"Unknown argument %c\n",c);
       break;
     }
   }
+  if(RTP_MIN_SIZE + 24 + Blocksize * 2 * sizeof(short) > SEND_MAX_PKTSIZE){
+    fprintf(stderr,"Blocksize %d too large for an RTP packet of %d bytes\n",Blocksize,SEND_MAX_PKTSIZE);
+    exit(1);
+  }
   if(Daemonize){
     openlog("hackrf",LOG_PID,LOG_DAEMON);
 
@@ -460,12 +461,53 @@ int main(int argc,char *argv[]){
     Status = stderr; // Write status to stderr when running in foreground
   }
   
-  ADC_samprate = Decimate * Out_samprate;
+  if(ADC_samprate == 0){
+    ADC_samprate = Decimate * Out_samprate;
+  } else {
+    if(ADC_samprate < Out_samprate){
+      errmsg("A/D sample rate %d must be at least output sample rate %d\n",ADC_samprate,Out_samprate);
+      exit(1);
+    }
+    // Half-band stages down to a power-of-2 rate between 2 and 4 times the output rate,
+    // so their aliases stay outside the output band; the polyphase resampler does the rest
+    // (-D is ignored)
+    int const ratio = ADC_samprate / Out_samprate;
+    if(ADC_samprate % Out_samprate == 0 && (ratio & (ratio-1)) == 0){
+      Decimate = ratio; // Exact power of 2: half-bands all the way, as before
+    } else {
+      Decimate = 1;
+      while((long long)ADC_samprate >= 4LL * Decimate * Out_samprate)
+	Decimate *= 2;
+    }
+  }
   Log_decimate = (int)round(log2(Decimate));
   if(1<<Log_decimate != Decimate){
     errmsg("Decimation ratios must currently be a power of 2\n");
     exit(1);
   }
+  Stage_blocksize = Blocksize;
+  if((long long)Decimate * Out_samprate != ADC_samprate){
+    int const taps = ceilf(Resamp_order * ADC_samprate / ((float)Decimate * Out_samprate));
+    Resampler = create_resampler(Decimate * Out_samprate,ADC_samprate,taps,1.0,Resamp_beta);
+    if(Resampler == NULL){
+      errmsg("Can't create %d/%d resampler\n",Decimate * Out_samprate,ADC_samprate);
+      exit(1);
+    }
+    // Each packet must be a whole number of resampler periods
+    if(Blocksize % Resampler->L != 0){
+      Blocksize -= Blocksize % Resampler->L;
+      if(Blocksize == 0){
+	errmsg("Resampling ratio %d/%d too fine for any blocksize\n",Resampler->L,Resampler->M);
+	exit(1);
+      }
+      errmsg("Blocksize rounded down to %d for resampling by %d/%d\n",Blocksize,Resampler->L,Resampler->M);
+    }
+    Stage_blocksize = Blocksize / Resampler->L * Resampler->M;
+  }
+  if(Decimate * Stage_blocksize > BUFFERSIZE/2){
+    errmsg("Blocksize %d too large for decimation ratio %d\n",Blocksize,Decimate);
+    exit(1);
+  }
   Filter_atten = powf(.5, Log_decimate); // Compensate for +6dB gain in each decimation stage
 
   setlocale(LC_ALL,Locale);
@@ -476,6 +518,10 @@ int main(int argc,char *argv[]){
     errmsg("Can't create multicast socket: %s",strerror(errno));
     exit(1);
   }
+  if((Rtp_send = create_msend(Rtp_sock,Send_latency,RTP_MIN_SIZE + 24 + Blocksize * 2 * sizeof(short))) == NULL){
+    errmsg("Can't allocate transmit queue");
+    exit(1);
+  }
     
   // Set up new control socket on port 5006
   int Nctl_sock = setup_mcast(Dest,NULL,0,Mcast_ttl,2); // For input
@@ -538,6 +584,8 @@ int main(int argc,char *argv[]){
   errmsg("uid %d; device %d; dest %s; blocksize %d; RTP SSRC %lx; status file %s\n",getuid(),Device,Dest,Blocksize,Rtp.ssrc,Status_filename);
   errmsg("A/D sample rate %'d Hz; decimation ratio %d; output sample rate %'d Hz; Offset %'+d\n",
 	 ADC_samprate,Decimate,Out_samprate,Offset * ADC_samprate/4);
+  if(Resampler != NULL)
+    errmsg("resampling %d/%d after half-band stages, %d taps\n",Resampler->L,Resampler->M,Resampler->L * Resampler->taps);
 
   pthread_create(&Process_thread,NULL,process,&HackCD);
 
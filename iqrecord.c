@@ -34,7 +34,6 @@
 // but what about Ethernet interfaces that can reassemble fragments?
 // 65536 should be safe since that's the largest IPv4 datagram.
 // But what about IPv6?
-#define MAXPKT 65535
 
 // size of stdio buffer for disk I/O
 // This should be large to minimize write calls, but how big?
@@ -66,6 +65,7 @@ char IQ_mcast_address_text[256];
 struct sockaddr Sender;
 struct sockaddr Input_mcast_sockaddr;
 int Input_fd;
+struct mrecv *Mrecv;
 struct session *Sessions;
 
 
@@ -126,6 +126,10 @@ int main(int argc,char *argv[]){
   int n = 1 << 20; // 1 MB
   if(setsockopt(Input_fd,SOL_SOCKET,SO_RCVBUF,&n,sizeof(n)) == -1)
     perror("setsockopt");
+  if((Mrecv = create_mrecv(Input_fd)) == NULL){
+    fprintf(stderr,"Can't allocate receive buffers\n");
+    exit(1);
+  }
 
   // Graceful signal catch
   signal(SIGPIPE,closedown);
@@ -158,14 +162,15 @@ void input_loop(){
 
   while(!isfinite(Duration) || t < Duration){
     // Receive I/Q data from front end
-    unsigned char buffer[MAXPKT];
     socklen_t socksize = sizeof(Sender);
-    int size = recvfrom(Input_fd,buffer,sizeof(buffer),0,&Sender,&socksize);
-    if(size <= 0){    // ??
-      perror("recvfrom");
+    struct packet * const pkt = recv_pkt(Mrecv,&Sender,&socksize);
+    if(pkt == NULL){    // ??
+      perror("recvmmsg");
       usleep(50000);
       continue;
     }
+    unsigned char * const buffer = pkt->content;
+    int size = pkt->len;
     if(size < RTP_MIN_SIZE)
       continue; // Too small for RTP, ignore
 
@@ -305,6 +310,9 @@ void input_loop(){
 }
  
 void cleanup(void){
+  if(!Quiet)
+    dump_mrecv(stderr,Mrecv);
+
   while(Sessions){
     // Flush and close each write stream
     // Be anal-retentive about freeing and clearing stuff even though we're about to exit
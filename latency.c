@@ -0,0 +1,73 @@
+// Latency histograms, for finding out where the time goes in a processing pipeline
+// Each is written by the thread doing the work and read now and then by a status thread,
+// so recording is just an atomic increment and neither side ever waits for the other
+// Copyright 2026, ka9q-radio contributors. GPL v3, see LICENSE
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <string.h>
+#include "latency.h"
+
+// Bin 0 is under a microsecond; after that 4 bins per octave
+static int latency_bin(long long const ns){
+  unsigned long long const us = ns / 1000;
+  if(us == 0)
+    return 0;
+  int const octave = 63 - __builtin_clzll(us);
+  int const sub = octave >= 2 ? (us >> (octave - 2)) & 3 : (us << (2 - octave)) & 3;
+  int const bin = 1 + 4 * octave + sub;
+  return bin < LATENCY_BINS ? bin : LATENCY_BINS-1;
+}
+
+// Lower edge of a bin, microseconds
+static float bin_edge(int const bin){
+  if(bin <= 0)
+    return 0;
+  int const octave = (bin - 1) / 4;
+  int const sub = (bin - 1) % 4;
+  return (float)(1ULL << octave) * (4 + sub) / 4;
+}
+
+void record_latency(struct latency * const lat,long long const ns){
+  assert(lat != NULL);
+  if(ns < 0)
+    return; // Clock went backwards, or a stale timestamp
+  atomic_fetch_add_explicit(&lat->count[latency_bin(ns)],1,memory_order_relaxed);
+  if(ns > atomic_load_explicit(&lat->peak,memory_order_relaxed))
+    atomic_store_explicit(&lat->peak,ns,memory_order_relaxed);
+}
+
+// Update the view's median, 99th percentile and maximum, over roughly the last LATENCY_WINDOW calls
+// The percentiles are interpolated within their bins, the maximum is exact
+// All three are zero until something has been recorded
+// Only one view may be kept of each histogram, since reading it resets the peak
+void latency_stats(struct latency * const lat,struct latency_view * const view){
+  assert(lat != NULL && view != NULL);
+  float const decay = 1 - 1.0f / LATENCY_WINDOW;
+  float total = 0;
+  for(int i=0; i < LATENCY_BINS; i++){
+    unsigned int const count = atomic_load_explicit(&lat->count[i],memory_order_relaxed);
+    view->weight[i] = view->weight[i] * decay + (count - view->last[i]);
+    view->last[i] = count;
+    total += view->weight[i];
+  }
+  view->peak[view->calls++ % LATENCY_WINDOW] = atomic_exchange_explicit(&lat->peak,0,memory_order_relaxed);
+  long long peak = 0;
+  for(int i=0; i < LATENCY_WINDOW; i++)
+    if(view->peak[i] > peak)
+      peak = view->peak[i];
+
+  float const q[2] = { 0.50, 0.99 };
+  int result[2] = { 0, 0 };
+  for(int k=0; k < 2 && total > 0; k++){
+    float const target = q[k] * total;
+    float cum = 0;
+    int i;
+    for(i=0; i < LATENCY_BINS-1 && cum + view->weight[i] < target; i++)
+      cum += view->weight[i];
+    float const frac = view->weight[i] > 0 ? (target - cum) / view->weight[i] : 0;
+    result[k] = bin_edge(i) + frac * (bin_edge(i+1) - bin_edge(i));
+  }
+  view->p50 = result[0];
+  view->p99 = result[1];
+  view->max = (peak + 999) / 1000;
+}
@@ -0,0 +1,47 @@
+// Latency histograms, for finding out where the time goes in a processing pipeline
+// Copyright 2026, ka9q-radio contributors. GPL v3, see LICENSE
+#ifndef _LATENCY_H
+#define _LATENCY_H 1
+
+#include <time.h>
+#include <stdatomic.h>
+
+// Log-spaced bins, 4 per octave, from 1 microsecond to about 8 seconds
+#define LATENCY_BINS 96
+
+// Updated by one thread with record_latency() and read by another with latency_stats()
+struct latency {
+  atomic_uint count[LATENCY_BINS];
+  atomic_llong peak;   // Largest since the last latency_stats(), ns
+};
+
+// A reader's smoothed view of one histogram, covering roughly the last LATENCY_WINDOW calls
+#define LATENCY_WINDOW 50
+struct latency_view {
+  unsigned int last[LATENCY_BINS]; // Counts at the previous call
+  float weight[LATENCY_BINS];      // Exponentially decaying counts
+  long long peak[LATENCY_WINDOW];  // Peaks from each of the last LATENCY_WINDOW calls
+  int calls;
+  // Results of the last call, microseconds
+  int p50;
+  int p99;
+  int max;
+};
+
+static inline long long latency_clock(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// CPU time used so far by the calling thread, ns
+static inline long long thread_cputime(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void record_latency(struct latency *,long long ns);
+void latency_stats(struct latency *,struct latency_view *);
+
+#endif
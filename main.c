@@ -18,9 +18,11 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <locale.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <signal.h>
+#include <fcntl.h>
 
 #include "misc.h"
 #include "dsp.h"
@@ -28,6 +30,9 @@
 #include "radio.h"
 #include "filter.h"
 #include "status.h"
+#include "attr.h"
+#include "pool.h"
+#include "decimate.h"
 
 
 // Config constants
@@ -37,15 +42,24 @@ int static DAC_samprate = 48000;
 
 // Command line Parameters with default values
 int Nthreads = 1;
+int Pool_size = -1;         // Threads demodulating channels, counting procsamp; 0 = one per channel, -1 = one per CPU
 int Quiet = 0;
 int Verbose = 0;
 char Statepath[PATH_MAX];
 char Locale[256] = "en_US.UTF-8";
 int Update_interval = 100;  // 100 ms between screen updates
 int Mcast_ttl = 1;
+// Pre-detection filter: L and M if given, otherwise planned for the block time and transition width
+// The defaults give about what the old fixed L = 3840, M = 4353 did at 192 kHz
+static int Blocksize;
+static int Impulse_length;
+static float Block_time = 0.020; // sec
+static float Transition = 140;   // Hz
+static int Partitions = 1;       // Of the pre-detection filter's impulse response; > 1 cuts its block latency
 
 // Primary control blocks for downconvert/filter/demodulate and output
 // Note: initialized to all zeroes, like all global variables
+// Additional channels are created dynamically by commands; see recv_commands()
 struct demod Demod;
 
 struct timeval Starttime;      // System clock at timestamp 0, for RTCP
@@ -54,6 +68,8 @@ extern uint64_t Commands;
 
 void output_cleanup(void *);
 void closedown(int);
+static int process_file(struct demod *,char const *,char const *);
+static int make_filter_input(struct demod *);
 void *rtp_recv(void *);
 void *rtcp_send(void *);
 void cleanup(void);
@@ -102,7 +118,7 @@ int main(int argc,char *argv[]){
   fftwf_import_system_wisdom();
   fftwf_make_planner_thread_safe();
 
-  struct demod * const demod = &Demod; // Only one demodulator per program for now
+  struct demod * const demod = &Demod; // Primary channel; others are created by command
 
   // Set program defaults, can be overridden by state file and command line args, in that order
   memset(demod,0,sizeof(*demod)); // Just in case it's ever dynamic
@@ -110,8 +126,6 @@ int main(int argc,char *argv[]){
   strcpy(demod->mode,"FM");
   demod->tune.freq = 147.435e6;  // LA "animal house" repeater, active all night for testing
 
-  demod->filter.L = 3840;      // Number of samples in buffer: FFT length = L + M - 1
-  demod->filter.M = 4352+1;    // Length of filter impulse response
   demod->filter.kaiser_beta = 3.0; // Reasonable compromise
   strlcpy(demod->input.dest_address_text,"iq.hf.mcast.local",sizeof(demod->input.dest_address_text));
   demod->agc.headroom = pow(10.,-15./20); // -15 dB
@@ -119,7 +133,7 @@ int main(int argc,char *argv[]){
   demod->tune.step = 0;  // single digit hertz position
   demod->tune.shift = NAN;
   demod->sdr.imbalance = 1; // 0 dB
-  demod->filter.decimate = 1; // default to avoid division by zero
+  demod->filter.decimate = 1; // default to avoid division by zero; set for each channel by set_mode()
   demod->filter.interpolate = 1;
 
   // set invalid to start
@@ -127,8 +141,14 @@ int main(int argc,char *argv[]){
   demod->filter.low = NAN;
   demod->filter.high = NAN;
 
+  // FFTW wisdom lives with the state files unless -W says otherwise
+  char wisdom_file[PATH_MAX];
+  snprintf(wisdom_file,sizeof(wisdom_file),"%s/wisdom",Statepath);
+
   // Find any file argument and load it
-  char optstring[] = "d:f:I:k:l:L:m:M:r:R:qs:t:T:u:vS:";
+  char const *iq_file = NULL;  // Recording to process offline instead of live multicast
+  char const *pcm_file = NULL; // Where offline PCM goes; stdout by default
+  char optstring[] = "b:B:d:f:i:I:k:l:L:m:M:o:p:P:r:R:qs:t:T:u:vS:w:W:x:";
   while(getopt(argc,argv,optstring) != -1)
     ;
   if(argc > optind)
@@ -141,12 +161,21 @@ int main(int argc,char *argv[]){
   int c;
   while((c = getopt(argc,argv,optstring)) != EOF){
     switch(c){
+    case 'b':   // Pre-detection filter block time, ms, when not given with -L
+      Block_time = strtod(optarg,NULL) / 1000;
+      break;
+    case 'B':   // Split the pre-detection filter into this many partitions, each with 1/B the block time
+      Partitions = strtol(optarg,NULL,0);
+      break;
     case 'd':
       demod->doppler_command = optarg;
       break;
     case 'f':   // Initial RF tuning frequency
       demod->tune.freq = parse_frequency(optarg);
       break;
+    case 'i':   // I/Q recording from iqrecord, processed as fast as possible
+      iq_file = optarg;
+      break;
     case 'I':   // Multicast address to listen to for I/Q data
       strlcpy(demod->input.dest_address_text,optarg,sizeof(demod->input.dest_address_text));
       break;
@@ -158,13 +187,23 @@ int main(int argc,char *argv[]){
       setlocale(LC_ALL,Locale);
       break;
     case 'L':   // Pre-detection filter block size
-      demod->filter.L = strtol(optarg,NULL,0);
+      Blocksize = strtol(optarg,NULL,0);
       break;
     case 'm':   // receiver mode (AM/FM, etc)
       strlcpy(demod->mode,optarg,sizeof(demod->mode));
       break;
     case 'M':   // Pre-detection filter impulse length
-      demod->filter.M = strtol(optarg,NULL,0);
+      Impulse_length = strtol(optarg,NULL,0);
+      break;
+    case 'o':   // PCM output file for -i; - is stdout
+      pcm_file = optarg;
+      break;
+    case 'p':   // Thread CPU affinity and scheduling, name=cpulist[:policy[:priority]]
+      if(add_thread_sched(optarg) == -1)
+	exit(1);
+      break;
+    case 'P':   // Size of the channel demodulator pool
+      Pool_size = strtol(optarg,NULL,0);
       break;
     case 'q':
       Quiet++;  // Suppress display
@@ -193,22 +232,52 @@ int main(int argc,char *argv[]){
     case 'S':   // Set SSRC on output stream
       demod->output.rtp.ssrc = strtol(optarg,NULL,0);
       break;
+    case 'w':   // FFTW planning level for plans not already in the wisdom
+      if((Fftw_plan_level = plan_level(optarg)) == -1){
+	fprintf(stderr,"Unknown FFTW planning level %s; use estimate, measure, patient or exhaustive\n",optarg);
+	exit(1);
+      }
+      break;
+    case 'W':   // FFTW wisdom file
+      strlcpy(wisdom_file,optarg,sizeof(wisdom_file));
+      break;
+    case 'x':   // Pre-detection filter transition width, Hz, when not given with -M
+      Transition = strtod(optarg,NULL);
+      break;
     default:
-      fprintf(stderr,"Usage: %s [-d doppler_command] [-f frequency] [-I iq multicast address] [-k kaiser_beta] [-l locale] [-L blocksize] [-m mode] [-M FIRlength] [-q] [-R Output multicast address] [-s shift offset] [-t threads] [-u update_ms] [-v]\n",argv[0]);
+      fprintf(stderr,"Usage: %s [-b block_ms] [-B partitions] [-d doppler_command] [-f frequency] [-i iq file [-o pcm file]] [-I iq multicast address] [-k kaiser_beta] [-l locale] [-L blocksize] [-m mode] [-M FIRlength] [-p thread=cpus[:fifo|rr[:prio]]] [-P pool threads] [-q] [-R Output multicast address] [-s shift offset] [-t threads] [-u update_ms] [-v] [-w planning level] [-W wisdom file] [-x transition_hz]\n",argv[0]);
       exit(1);
       break;
     }
   }
   fprintf(stderr,"General coverage receiver for the Funcube Pro and Pro+\n");
   fprintf(stderr,"Copyright 2017 by Phil Karn, KA9Q; may be used under the terms of the GNU General Public License\n");
+  if(Verbose)
+    fprintf(stderr,"Sample conversion kernel: %s\n",convert_kernel());
+  if(load_wisdom(wisdom_file) == -1)
+    fprintf(stderr,"No FFTW wisdom in %s; new plans will be made at level %s and saved there\n",
+	    wisdom_file,plan_level_name(Fftw_plan_level));
   
   pthread_mutex_init(&demod->sdr.status_mutex,NULL);
   pthread_cond_init(&demod->sdr.status_cond,NULL);
   pthread_mutex_init(&demod->doppler.mutex,NULL);
   pthread_mutex_init(&demod->shift.mutex,NULL);
   pthread_mutex_init(&demod->second_LO.mutex,NULL);
-  pthread_mutex_init(&demod->input.qmutex,NULL);
-  pthread_cond_init(&demod->input.qcond,NULL);
+
+  // The input thread takes part in the pool, so it needs one fewer of its own
+  if(Pool_size < 0)
+    Pool_size = max(1L,sysconf(_SC_NPROCESSORS_ONLN));
+  if(Pool_size > 0 && (Demod_pool = create_pool(Pool_size-1,"demod")) == NULL){
+    fprintf(stderr,"Can't create demodulator pool\n");
+    exit(1);
+  }
+  if(Verbose)
+    fprintf(stderr,Demod_pool ? "Demodulating channels with a pool of %d threads\n" : "Demodulating each channel in its own thread\n",Pool_size);
+  if(iq_file != NULL)
+    exit(process_file(demod,iq_file,pcm_file) == 0 ? 0 : 1);
+
+  demod->input.ring = create_pktring(2); // Wait up to two packets for a reordered one
+  assert(demod->input.ring != NULL);
 
   // Input socket for I/Q data from SDR
   demod->input.fd = setup_mcast(demod->input.dest_address_text,(struct sockaddr *)&demod->input.dest_address,0,0,0);
@@ -216,6 +285,8 @@ int main(int argc,char *argv[]){
     fprintf(stderr,"Can't set up I/Q input\n");
     exit(1);
   }
+  demod->input.mrecv = create_mrecv(demod->input.fd);
+  assert(demod->input.mrecv != NULL);
   // Output socket for commands to SDR
   demod->input.ctl_fd = setup_mcast(demod->input.dest_address_text,NULL,1,Mcast_ttl,2);
 
@@ -225,15 +296,8 @@ int main(int argc,char *argv[]){
     fprintf(stderr,"Output setup failed\n");
     exit(1);
   }
-  // Create master half of filter
-  // Must be done before the demodulator starts or it will fail an assert
-  // If done in proc_samples(), will be a race condition
-  // Blocksize really should be computed from demod->filter.L and decimate
-  demod->filter.in = create_filter_input(demod->filter.L,demod->filter.M,COMPLEX);
-
   pthread_t rtp_recv_thread,proc_samples_thread;
   pthread_create(&rtp_recv_thread,NULL,rtp_recv,demod);
-  pthread_create(&proc_samples_thread,NULL,proc_samples,demod);
 
   // Optional doppler correction
   if(demod->doppler_command)
@@ -257,10 +321,22 @@ int main(int argc,char *argv[]){
   pthread_mutex_unlock(&demod->sdr.status_mutex);
   fprintf(stderr,"%'d Hz\n",demod->sdr.status.samprate);
 
+  // Create master half of filter, sized for the sample rate
+  // Must be done before the demodulator starts or it will fail an assert
+  // If done in proc_samples(), will be a race condition; until it starts, rtp_recv() just drops packets
+  if(make_filter_input(demod) != 0)
+    exit(1);
+  Channels = demod;
+  pthread_create(&proc_samples_thread,NULL,proc_samples,demod);
+
   //  sleep(2);
   // Actually set the mode and frequency already specified
   set_mode(demod,demod->mode,0); // Don't override with defaults from mode table 
 
+  // Now we can accept commands, including ones creating more channels
+  pthread_t command_thread;
+  pthread_create(&command_thread,NULL,recv_commands,demod);
+
   // Graceful signal catch
   signal(SIGPIPE,closedown);
   signal(SIGINT,closedown);
@@ -290,8 +366,6 @@ void *rtp_recv(void *arg){
   assert(arg != NULL);
   struct demod * const demod = arg;
   
-  struct packet *pkt = NULL;
-
   while(1){
     // Packet consists of Ethernet, IP and UDP header (already stripped)
     // then standard Real Time Protocol (RTP), a status header and the PCM
@@ -301,18 +375,17 @@ void *rtp_recv(void *arg){
     // Note this is a portability problem if this system and the one generating
     // the data have opposite byte orders. But who's big endian anymore?
     // Receive I/Q data from front end
-    // Incoming RTP packets
-
-    if(!pkt)
-      pkt = malloc(sizeof(*pkt));
-
+    // Incoming RTP packets, a batch at a time
     socklen_t socksize = sizeof(demod->input.source_address);
-    int size = recvfrom(demod->input.fd,pkt->content,sizeof(pkt->content),0,(struct sockaddr *)&demod->input.source_address,&socksize);
-    if(size <= 0){    // ??
-      perror("recvfrom");
+    struct packet * const pkt = recv_pkt(demod->input.mrecv,(struct sockaddr *)&demod->input.source_address,&socksize);
+    if(pkt == NULL){    // ??
+      perror("recvmmsg");
       usleep(50000);
       continue;
     }
+    if(!pkts_pending(demod->input.mrecv))
+      demod->cpu_time[THREAD_RTP_RECV] = thread_cputime(); // Once per batch
+    int size = pkt->len;
     if(size < RTP_MIN_SIZE)
       continue; // Too small for RTP, ignore
 
@@ -343,28 +416,148 @@ void *rtp_recv(void *arg){
     pkt->data = dp;
     pkt->len = size;
 
-    // Insert onto queue sorted by sequence number, wake up thread
-    struct packet *q_prev = NULL;
-    struct packet *qe = NULL;
-    pthread_mutex_lock(&demod->input.qmutex);
-    for(qe = demod->input.queue; qe && pkt->rtp.seq >= qe->rtp.seq; q_prev = qe,qe = qe->next)
-      ;
-
-    pkt->next = qe;
-    if(q_prev)
-      q_prev->next = pkt;
-    else
-      demod->input.queue = pkt; // Front of list
-
-    pkt = NULL;        // force new packet to be allocated
-    // wake up decoder thread
-    pthread_cond_signal(&demod->input.qcond);
-    pthread_mutex_unlock(&demod->input.qmutex);
+    // Into its slot in the ring by sequence number, wakes up procsamp if it's waiting
+    // The ring's empty buffer takes its place in the receive pool
+    replace_pkt(demod->input.mrecv,put_pkt(demod->input.ring,pkt));
   }      
   return NULL;
 }
 
 
+// Size the pre-detection filter for the input sample rate, now that it's known, and create its master half
+// Each channel's decimation is then picked by set_mode() to suit its mode
+static int make_filter_input(struct demod * const demod){
+  demod->filter.L = Blocksize;
+  demod->filter.M = Impulse_length;
+  demod->filter.partitions = Partitions;
+  if(plan_blocksize(demod->input.samprate,Block_time,Transition,demod->filter.kaiser_beta,&demod->filter.L,&demod->filter.M,&demod->filter.partitions) != 0){
+    fprintf(stderr,"Can't size the filter for %'d Hz\n",demod->input.samprate);
+    return -1;
+  }
+  if(Verbose){
+    fprintf(stderr,"Filter L = %d, M = %d, N = %d (%.1f ms blocks)\n",demod->filter.L,demod->filter.M,
+	    demod->filter.L + demod->filter.M - 1,1000. * demod->filter.L / demod->input.samprate);
+    if(demod->filter.partitions > 1)
+      fprintf(stderr,"%d partitions, impulse response %d\n",demod->filter.partitions,
+	      (demod->filter.partitions - 1) * demod->filter.L + demod->filter.M);
+  }
+  demod->filter.in = create_partitioned_filter_input(demod->filter.L,demod->filter.M,demod->filter.partitions,COMPLEX);
+  return demod->filter.in == NULL ? -1 : 0;
+}
+
+// Process an I/Q recording from iqrecord as fast as the CPU allows, instead of live multicast
+// The sample rate and front end frequency come from the file's attributes
+// Demodulated 16-bit PCM in host byte order, silence and all, goes to pcm_file or stdout
+// lined up with the input and exactly as long: one output sample period per input sample period
+// The demodulator always runs in the pool, which takes each block before the next, so none is ever skipped
+static int process_file(struct demod * const demod,char const *iq_file,char const *pcm_file){
+  int const fd = open(iq_file,O_RDONLY);
+  if(fd == -1){
+    fprintf(stderr,"Can't read %s: %s\n",iq_file,strerror(errno));
+    return -1;
+  }
+  long samprate = 0;
+  double frequency = 0;
+  int channels = 2;
+  char format[32] = "s16le";
+  attrscanf(fd,"samplerate","%ld",&samprate);
+  attrscanf(fd,"frequency","%lf",&frequency);
+  attrscanf(fd,"channels","%d",&channels);
+  attrscanf(fd,"sampleformat","%31s",format);
+  if(samprate <= 0 || channels != 2 || (strcmp(format,"s16le") != 0 && strcmp(format,"s16be") != 0)){
+    fprintf(stderr,"%s: need 16-bit I/Q samples with a samplerate attribute\n",iq_file);
+    close(fd);
+    return -1;
+  }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  int const swap = strcmp(format,"s16be") == 0;
+#else
+  int const swap = strcmp(format,"s16le") == 0;
+#endif
+  // Stand in for the SDR status radio_status.c would otherwise get
+  demod->input.samprate = demod->sdr.status.samprate = samprate;
+  demod->sdr.status.frequency = frequency;
+  demod->sdr.min_IF = -0.5 * samprate * IF_EXCLUDE;
+  demod->sdr.max_IF = +0.5 * samprate * IF_EXCLUDE;
+  demod->sdr.gain_factor = 1; // The recording has no analog gain information
+  demod->tune.lock = 1;       // Nothing to retune
+  if(fabs(demod->tune.freq - frequency) >= 0.5 * samprate){
+    fprintf(stderr,"%'.3lf Hz isn't in the recording (%'.3lf Hz +/- %'ld Hz); tuning to its center\n",
+	    demod->tune.freq,frequency,samprate/2);
+    demod->tune.freq = frequency;
+  }
+  FILE *fp = stdout;
+  if(pcm_file != NULL && strcmp(pcm_file,"-") != 0 && (fp = fopen(pcm_file,"w")) == NULL){
+    fprintf(stderr,"Can't write %s: %s\n",pcm_file,strerror(errno));
+    close(fd);
+    return -1;
+  }
+  demod->output.pcm_file = fp;
+  if(make_filter_input(demod) != 0){
+    close(fd);
+    return -1;
+  }
+  Channels = demod;
+  if(Demod_pool == NULL && (Demod_pool = create_pool(0,"demod")) == NULL){
+    fprintf(stderr,"Can't create demodulator pool\n");
+    close(fd);
+    return -1;
+  }
+  if(set_mode(demod,demod->mode,0) != 0){
+    fprintf(stderr,"Can't start mode %s\n",demod->mode);
+    close(fd);
+    return -1;
+  }
+  // Line the output up with the input by dropping the group delay of the pre-detection filter, about the
+  // middle of its impulse response unless it's minimum phase, of any filter after the demodulator
+  // and of the resampler, if any. The length isn't known until the end
+  double const out_per_in = (double)demod->output.samprate / samprate;
+  double delay = demod->filter.post_delay * demod->filter.decimate * out_per_in;
+  if(!demod->filter.min_phase)
+    delay += 0.5 * (filter_memory(demod->filter.in) + 1) * out_per_in;
+  if(demod->output.resampler != NULL)
+    delay += resample_delay(demod->output.resampler);
+  demod->output.pcm_skip = llrint(delay);
+  atomic_store(&demod->output.pcm_frames,LLONG_MAX);
+
+  struct timespec start,stop;
+  clock_gettime(CLOCK_MONOTONIC,&start);
+  int16_t buffer[2 * demod->filter.L];
+  int len;
+  while((len = pipefill(fd,buffer,sizeof(buffer))) > 0){
+    int const cnt = len / (2 * sizeof(*buffer));
+    demod->input.arrival = demod->input.dequeue = latency_clock(); // The file read stands in for the network
+    if(swap){
+      for(int i=0; i < 2*cnt; i++)
+	buffer[i] = __builtin_bswap16(buffer[i]);
+    }
+    input_samples(demod,buffer,IQ_PT,cnt);
+  }
+  close(fd);
+  long long const samples = demod->input.samples;
+  // Now stop where the input did. The demodulator has been counting down from LLONG_MAX as it wrote
+  atomic_fetch_add(&demod->output.pcm_frames,llrint(samples * out_per_in) - LLONG_MAX);
+
+  // Run the filter's delay out with silence, so everything up to the last sample is demodulated
+  int const drain = (filter_memory(demod->filter.in) + demod->filter.L - 1) / demod->filter.L + 1;
+  for(int i=0; i <= drain; i++)
+    input_gap(demod,demod->filter.L);
+  stop_demod(demod);
+  clock_gettime(CLOCK_MONOTONIC,&stop);
+  if(fp != stdout)
+    fclose(fp);
+  else
+    fflush(fp);
+  demod->output.pcm_file = NULL;
+
+  double const elapsed = (stop.tv_sec - start.tv_sec) + 1e-9 * (stop.tv_nsec - start.tv_nsec);
+  if(Verbose)
+    fprintf(stderr,"%s: %'lld samples (%'.1lf sec) in %'.1lf sec, %.1lf x real time\n",
+	    iq_file,samples,(double)samples/samprate,elapsed,samples / (samprate * elapsed));
+  return 0;
+}
+
+
 // Save receiver state to file
 // Path is Statepath[] = $HOME/.radiostate
 int savestate(struct demod *dp,char const *filename){
@@ -384,14 +577,23 @@ int savestate(struct demod *dp,char const *filename){
   fprintf(fp,"Source %s\n",dp->input.dest_address_text);
   fprintf(fp,"Output %s\n",dp->output.dest_address_text);
   fprintf(fp,"TTL %d\n",Mcast_ttl);
-  fprintf(fp,"Blocksize %d\n",dp->filter.L);
-  fprintf(fp,"Impulse len %d\n",dp->filter.M);
+  if(Blocksize > 0)
+    fprintf(fp,"Blocksize %d\n",Blocksize);
+  if(Impulse_length > 0)
+    fprintf(fp,"Impulse len %d\n",Impulse_length);
+  fprintf(fp,"Block time %.1f ms\n",Block_time * 1000);
+  fprintf(fp,"Transition %.1f Hz\n",Transition);
+  if(Partitions > 1)
+    fprintf(fp,"Partitions %d\n",Partitions);
   fprintf(fp,"Frequency %.3f Hz\n",dp->tune.freq);
   fprintf(fp,"Mode %s\n",dp->mode);
   fprintf(fp,"Shift %.3f Hz\n",dp->tune.shift);
   fprintf(fp,"Filter low %.3f Hz\n",dp->filter.low);
   fprintf(fp,"Filter high %.3f Hz\n",dp->filter.high);
   fprintf(fp,"Tunestep %d\n",dp->tune.step);
+  char const *spec;
+  for(int i=0; (spec = thread_sched_spec(i)) != NULL; i++)
+    fprintf(fp,"Thread %s\n",spec);
   fclose(fp);
   return 0;
 }
@@ -423,13 +625,19 @@ int loadstate(struct demod *dp,char const *filename){
     } else if(sscanf(line,"Filter low %f",&dp->filter.low) > 0){
     } else if(sscanf(line,"Filter high %f",&dp->filter.high) > 0){
     } else if(sscanf(line,"Kaiser Beta %f",&dp->filter.kaiser_beta) > 0){
-    } else if(sscanf(line,"Blocksize %d",&dp->filter.L) > 0){
-    } else if(sscanf(line,"Impulse len %d",&dp->filter.M) > 0){
+    } else if(sscanf(line,"Blocksize %d",&Blocksize) > 0){
+    } else if(sscanf(line,"Impulse len %d",&Impulse_length) > 0){
+    } else if(sscanf(line,"Block time %f",&Block_time) > 0){
+      Block_time /= 1000;
+    } else if(sscanf(line,"Transition %f",&Transition) > 0){
+    } else if(sscanf(line,"Partitions %d",&Partitions) > 0){
     } else if(sscanf(line,"Tunestep %d",&dp->tune.step) > 0){
     } else if(sscanf(line,"Source %256s",dp->input.dest_address_text) > 0){
       // Array sizes defined elsewhere!
     } else if(sscanf(line,"Output %256s",dp->output.dest_address_text) > 0){
     } else if(sscanf(line,"TTL %d",&Mcast_ttl) > 0){
+    } else if(strncmp(line,"Thread ",7) == 0){
+      add_thread_sched(&line[7]);
     } else if(sscanf(line,"Locale %256s",Locale)){
       setlocale(LC_ALL,Locale);
     }
@@ -439,75 +647,77 @@ int loadstate(struct demod *dp,char const *filename){
 }
 
 // RTP control protocol sender task
+// Sends a report for each channel
 void *rtcp_send(void *arg){
-  struct demod *demod = (struct demod *)arg;
-  if(demod == NULL)
+  struct demod *primary = (struct demod *)arg;
+  if(primary == NULL)
     pthread_exit(NULL);
 
   pthread_setname("rtcp");
   //  fprintf(stderr,"hello from rtcp_send\n");
   while(1){
-
-    if(demod->output.rtp.ssrc == 0) // Wait until it's set by output RTP subsystem
-      goto done;
-    unsigned char buffer[4096]; // much larger than necessary
-    memset(buffer,0,sizeof(buffer));
-    
-    // Construct sender report
-    struct rtcp_sr sr;
-    memset(&sr,0,sizeof(sr));
-    sr.ssrc = demod->output.rtp.ssrc;
-
-    // Construct NTP timestamp
-    struct timeval tv;
-    gettimeofday(&tv,NULL);
-    double runtime = (tv.tv_sec - Starttime.tv_sec) + (tv.tv_usec - Starttime.tv_usec)/1000000.;
-
-    long long now_time = ((long long)tv.tv_sec + NTP_EPOCH)<< 32;
-    now_time += ((long long)tv.tv_usec << 32) / 1000000;
-
-    sr.ntp_timestamp = now_time;
-    // The zero is to remind me that I start timestamps at zero, but they could start anywhere
-    sr.rtp_timestamp = 0 + runtime * 48000;
-    sr.packet_count = demod->output.rtp.seq;
-    sr.byte_count = demod->output.rtp.bytes;
-    
-    unsigned char *dp = gen_sr(buffer,sizeof(buffer),&sr,NULL,0);
-
-    // Construct SDES
-    struct rtcp_sdes sdes[4];
-    
-    // CNAME
-    char hostname[1024];
-    gethostname(hostname,sizeof(hostname));
-    char *string = NULL;
-    int sl = asprintf(&string,"radio@%s",hostname);
-    if(sl > 0 && sl <= 255){
-      sdes[0].type = CNAME;
-      strcpy(sdes[0].message,string);
-      sdes[0].mlen = strlen(sdes[0].message);
-    }
-    if(string){
-      free(string); string = NULL;
+    pthread_mutex_lock(&Channel_mutex);
+    for(struct demod *demod = Channels; demod != NULL; demod = demod->next){
+      if(demod->output.rtp.ssrc == 0) // Wait until it's set by output RTP subsystem
+	continue;
+      unsigned char buffer[4096]; // much larger than necessary
+      memset(buffer,0,sizeof(buffer));
+      
+      // Construct sender report
+      struct rtcp_sr sr;
+      memset(&sr,0,sizeof(sr));
+      sr.ssrc = demod->output.rtp.ssrc;
+      
+      // Construct NTP timestamp
+      struct timeval tv;
+      gettimeofday(&tv,NULL);
+      double runtime = (tv.tv_sec - Starttime.tv_sec) + (tv.tv_usec - Starttime.tv_usec)/1000000.;
+      
+      long long now_time = ((long long)tv.tv_sec + NTP_EPOCH)<< 32;
+      now_time += ((long long)tv.tv_usec << 32) / 1000000;
+      
+      sr.ntp_timestamp = now_time;
+      // The zero is to remind me that I start timestamps at zero, but they could start anywhere
+      sr.rtp_timestamp = 0 + runtime * 48000;
+      sr.packet_count = demod->output.rtp.seq;
+      sr.byte_count = demod->output.rtp.bytes;
+      
+      unsigned char *dp = gen_sr(buffer,sizeof(buffer),&sr,NULL,0);
+      
+      // Construct SDES
+      struct rtcp_sdes sdes[4];
+      
+      // CNAME
+      char hostname[1024];
+      gethostname(hostname,sizeof(hostname));
+      char *string = NULL;
+      int sl = asprintf(&string,"radio@%s",hostname);
+      if(sl > 0 && sl <= 255){
+	sdes[0].type = CNAME;
+	strcpy(sdes[0].message,string);
+	sdes[0].mlen = strlen(sdes[0].message);
+      }
+      if(string){
+	free(string); string = NULL;
+      }
+      
+      sdes[1].type = NAME;
+      strcpy(sdes[1].message,"KA9Q Radio Program");
+      sdes[1].mlen = strlen(sdes[1].message);
+      
+      sdes[2].type = EMAIL;
+      strcpy(sdes[2].message,"karn@ka9q.net");
+      sdes[2].mlen = strlen(sdes[2].message);
+      
+      sdes[3].type = TOOL;
+      strcpy(sdes[3].message,"KA9Q Radio Program");
+      sdes[3].mlen = strlen(sdes[3].message);
+      
+      dp = gen_sdes(dp,sizeof(buffer) - (dp-buffer),demod->output.rtp.ssrc,sdes,4);
+      
+      send(demod->output.rtcp_fd,buffer,dp-buffer,0);
     }
-
-    sdes[1].type = NAME;
-    strcpy(sdes[1].message,"KA9Q Radio Program");
-    sdes[1].mlen = strlen(sdes[1].message);
-    
-    sdes[2].type = EMAIL;
-    strcpy(sdes[2].message,"karn@ka9q.net");
-    sdes[2].mlen = strlen(sdes[2].message);
-
-    sdes[3].type = TOOL;
-    strcpy(sdes[3].message,"KA9Q Radio Program");
-    sdes[3].mlen = strlen(sdes[3].message);
-    
-    dp = gen_sdes(dp,sizeof(buffer) - (dp-buffer),demod->output.rtp.ssrc,sdes,4);
-
-
-    send(demod->output.rtcp_fd,buffer,dp-buffer,0);
-  done:;
+    pthread_mutex_unlock(&Channel_mutex);
     usleep(1000000);
   }
 }
@@ -1,12 +1,20 @@
 // $Id: misc.c,v 1.27 2018/08/04 22:18:49 karn Exp $
 // Miscellaneous low-level routines, mostly time-related
 // Copyright 2018, Phil Karn, KA9Q
-
+#define _GNU_SOURCE 1
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#if defined(linux)
+#include <bsd/string.h>
+#endif
+#include <strings.h>
 #include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 
 #ifndef NULL
 #define NULL ((void *)0)
@@ -70,6 +78,162 @@ char *lltime(long long t){
   return result;
 
 }
+// Thread scheduling table, filled from the command line and state file before the threads start
+// Later specs for a name replace earlier ones, so the command line overrides the state file
+#define THREAD_SCHEDS 32
+static struct thread_sched {
+  char spec[128];  // As given, for saving back to the state file
+  char name[16];   // Thread names are limited to 15 chars + null
+  int prefix;      // name ended in *
+  int ncpus;       // 0 = leave affinity alone
+#ifndef __APPLE__
+  cpu_set_t cpus;
+#endif
+  int policy;      // -1 = leave alone
+  int priority;
+} Thread_sched[THREAD_SCHEDS];
+static int Thread_scheds;
+
+int add_thread_sched(char const *spec){
+  if(spec == NULL)
+    return -1;
+#ifdef __APPLE__
+  fprintf(stderr,"Thread scheduling not supported here, ignoring %s\n",spec);
+  return -1;
+#else
+  struct thread_sched ts;
+  memset(&ts,0,sizeof(ts));
+  strlcpy(ts.spec,spec,sizeof(ts.spec));
+  ts.policy = -1;
+
+  char buf[sizeof(ts.spec)];
+  strlcpy(buf,spec,sizeof(buf));
+  char *cpulist = strchr(buf,'=');
+  if(cpulist == NULL || cpulist == buf || cpulist - buf >= (int)sizeof(ts.name)){
+    fprintf(stderr,"Bad thread spec %s; use name=cpulist[:fifo|rr|other[:priority]]\n",spec);
+    return -1;
+  }
+  *cpulist++ = '\0';
+  if(buf[strlen(buf)-1] == '*'){
+    buf[strlen(buf)-1] = '\0';
+    ts.prefix = 1;
+  }
+  strlcpy(ts.name,buf,sizeof(ts.name));
+
+  char *policy = strchr(cpulist,':');
+  if(policy != NULL)
+    *policy++ = '\0';
+
+  // CPU list, e.g., 0-3,8
+  CPU_ZERO(&ts.cpus);
+  for(char *cp = cpulist; *cp != '\0';){
+    char *ep;
+    long const lo = strtol(cp,&ep,10);
+    long hi = lo;
+    if(ep == cp)
+      goto bad;
+    if(*ep == '-'){
+      cp = ep+1;
+      hi = strtol(cp,&ep,10);
+      if(ep == cp)
+	goto bad;
+    }
+    if(lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+      goto bad;
+    for(long i=lo; i <= hi; i++)
+      CPU_SET(i,&ts.cpus);
+    if(*ep == ',')
+      ep++;
+    else if(*ep != '\0')
+      goto bad;
+    cp = ep;
+  }
+  ts.ncpus = CPU_COUNT(&ts.cpus);
+
+  if(policy != NULL && *policy != '\0'){
+    char *priority = strchr(policy,':');
+    if(priority != NULL)
+      *priority++ = '\0';
+    if(strcasecmp(policy,"fifo") == 0)
+      ts.policy = SCHED_FIFO;
+    else if(strcasecmp(policy,"rr") == 0)
+      ts.policy = SCHED_RR;
+    else if(strcasecmp(policy,"other") == 0)
+      ts.policy = SCHED_OTHER;
+    else
+      goto bad;
+
+    // Real-time policies default to the lowest priority, so they still yield to the kernel's own threads
+    ts.priority = sched_get_priority_min(ts.policy);
+    if(priority != NULL && *priority != '\0'){
+      char *ep;
+      ts.priority = strtol(priority,&ep,10);
+      if(*ep != '\0' || ts.priority < sched_get_priority_min(ts.policy) || ts.priority > sched_get_priority_max(ts.policy)){
+	fprintf(stderr,"Thread spec %s: priority must be %d-%d for this policy\n",spec,
+		sched_get_priority_min(ts.policy),sched_get_priority_max(ts.policy));
+	return -1;
+      }
+    }
+  }
+  int i;
+  for(i=0; i < Thread_scheds; i++)
+    if(Thread_sched[i].prefix == ts.prefix && strcmp(Thread_sched[i].name,ts.name) == 0)
+      break;
+  if(i == THREAD_SCHEDS){
+    fprintf(stderr,"Too many thread specs, ignoring %s\n",spec);
+    return -1;
+  }
+  Thread_sched[i] = ts;
+  if(i == Thread_scheds)
+    Thread_scheds++;
+  return 0;
+
+ bad:;
+  fprintf(stderr,"Bad thread spec %s; use name=cpulist[:fifo|rr|other[:priority]]\n",spec);
+  return -1;
+#endif
+}
+
+// Return the nth spec as originally given, or NULL past the end
+char const *thread_sched_spec(int const n){
+  if(n < 0 || n >= Thread_scheds)
+    return NULL;
+  return Thread_sched[n].spec;
+}
+
+// Name the calling thread, then give it any affinity and policy configured for that name
+// Failures are reported but not fatal; the thread just runs as it would have anyway
+// Real-time policies need CAP_SYS_NICE or a high enough RLIMIT_RTPRIO (LimitRTPRIO= in systemd)
+void thread_setname(char const *name){
+#ifdef __APPLE__
+  pthread_setname_np(name);
+#else
+  pthread_setname_np(pthread_self(),name);
+  // Exact matches win over prefixes; the longest prefix wins among those
+  struct thread_sched const *ts = NULL;
+  for(int i=0; i < Thread_scheds; i++){
+    struct thread_sched const *t = &Thread_sched[i];
+    if(t->prefix ? strncmp(name,t->name,strlen(t->name)) != 0 : strcmp(name,t->name) != 0)
+      continue;
+    if(ts == NULL || (ts->prefix && (!t->prefix || strlen(t->name) > strlen(ts->name))))
+      ts = t;
+  }
+  if(ts == NULL)
+    return;
+  int r;
+  if(ts->ncpus != 0 && (r = pthread_setaffinity_np(pthread_self(),sizeof(ts->cpus),&ts->cpus)) != 0)
+    fprintf(stderr,"%s: can't set CPU affinity %s: %s\n",name,ts->spec,strerror(r));
+  if(ts->policy != -1){
+    struct sched_param param;
+    memset(&param,0,sizeof(param));
+    param.sched_priority = ts->priority;
+    if((r = pthread_setschedparam(pthread_self(),ts->policy,&param)) != 0)
+      fprintf(stderr,"%s: can't set scheduling %s: %s%s\n",name,ts->spec,strerror(r),
+	      r == EPERM ? " (needs CAP_SYS_NICE or RLIMIT_RTPRIO)" : "");
+  }
+#endif
+}
+
 #if __APPLE__
 
 // OSX doesn't have pthread_barrier_*
@@ -27,6 +27,14 @@ void chomp(char *);
 char *lltime(long long t);
 extern char *Months[12];
 
+// Per-thread CPU affinity and scheduling policy, by thread name
+// A spec is name=cpulist[:policy[:priority]], e.g., procsamp=2-3:fifo:50
+// name may end in * to match a prefix; cpulist may be empty to leave affinity alone
+// policy is fifo, rr or other. Taken when the thread names itself with pthread_setname()
+int add_thread_sched(char const *spec);
+char const *thread_sched_spec(int n);
+void thread_setname(char const *name);
+
 
 // I *hate* this sort of pointless, stupid, gratuitous incompatibility that
 // makes a lot of code impossible to read and debug
@@ -56,7 +64,7 @@ int pthread_barrier_wait(pthread_barrier_t *barrier);
 #define malloc_usable_size(x) malloc_size(x)
 #else
 #include <malloc.h>
-#define pthread_setname(x) pthread_setname_np(pthread_self(),x)
+#define pthread_setname(x) thread_setname(x)
 #endif
 
 
@@ -0,0 +1,196 @@
+// Generate FFTW wisdom ahead of time for the filters 'radio' will create
+// Reads the blocksize (L) and impulse length (M) from each radio state file, or plans them as radio
+// would from its block time and filter transition, and makes every plan radio would make for them,
+// so radio starts without planning delays
+// Copyright 2026, ka9q-radio contributors. GPL v3, see LICENSE
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+#if defined(linux)
+#include <bsd/string.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <complex.h>
+#include <fftw3.h>
+#undef I
+#include <time.h>
+
+#include "misc.h"
+#include "filter.h"
+
+char Statepath[PATH_MAX];
+int Verbose;
+
+// Read L, M and what radio plans them from out of a radio state file, leaving them alone if absent
+static int read_state(char const *filename,int *L,int *M,int *partitions,float *block_time,float *transition,float *beta){
+  char pathname[PATH_MAX];
+  if(filename[0] == '/')
+    strlcpy(pathname,filename,sizeof(pathname));
+  else
+    snprintf(pathname,sizeof(pathname),"%s/%s",Statepath,filename);
+
+  FILE * const fp = fopen(pathname,"r");
+  if(fp == NULL){
+    fprintf(stderr,"Can't read state file %s\n",pathname);
+    return -1;
+  }
+  char line[PATH_MAX];
+  while(fgets(line,sizeof(line),fp) != NULL){
+    chomp(line);
+    if(sscanf(line,"Blocksize %d",L) > 0){
+    } else if(sscanf(line,"Impulse len %d",M) > 0){
+    } else if(sscanf(line,"Block time %f",block_time) > 0){
+      *block_time /= 1000; // ms in the file
+    } else if(sscanf(line,"Transition %f",transition) > 0){
+    } else if(sscanf(line,"Kaiser Beta %f",beta) > 0){
+    } else if(sscanf(line,"Partitions %d",partitions) > 0){
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+// Make (and discard) every plan radio makes for this L, M, partitioning and decimation ratio
+// Keep in step with main.c, fm.c and linear.c
+static void plan_all(int L,int M,int partitions,int decimate){
+  // Predetection filter, shared by all demodulators
+  struct filter_in * const master = create_partitioned_filter_input(L,M,partitions,COMPLEX);
+  struct filter_out * const slave = create_filter_output(master,NULL,decimate,COMPLEX);
+  set_filter(slave,-0.1,0.1,3.0); // Response doesn't matter, only the transform sizes
+
+  // FM audio filter
+  int const AL = L / decimate;
+  int const AM = (M - 1) / decimate + 1;
+  int const AN = AL + AM - 1;
+  struct filter_in * const audio_master = create_filter_input(AL,AM,REAL);
+  complex float * const aresponse = fftwf_alloc_complex(AN/2+1);
+  memset(aresponse,0,(AN/2+1) * sizeof(*aresponse));
+  window_rfilter(AL,AM,aresponse,3.0);
+  struct filter_out * const audio_filter = create_filter_output(audio_master,aresponse,1,REAL);
+
+  // FM PL tone filter and its long FFT
+  int PL_decimate = 32;
+  while(PL_decimate > 1 && (AN % PL_decimate != 0 || AL % PL_decimate != 0))
+    PL_decimate--;
+  int const PL_N = AN / PL_decimate;
+  int const PL_L = AL / PL_decimate;
+  int const PL_M = PL_N - PL_L + 1;
+  complex float * const plresponse = fftwf_alloc_complex(PL_N/2+1);
+  memset(plresponse,0,(PL_N/2+1) * sizeof(*plresponse));
+  window_rfilter(PL_L,PL_M,plresponse,2.0);
+  struct filter_out * const pl_filter = create_filter_output(audio_master,plresponse,PL_decimate,REAL);
+
+  int const pl_fft_size = (1 << 19) / PL_decimate;
+  float * const pl_input = fftwf_alloc_real(pl_fft_size);
+  complex float * const pl_spectrum = fftwf_alloc_complex(pl_fft_size/2+1);
+  fftwf_destroy_plan(plan_r2c(pl_fft_size,pl_input,pl_spectrum));
+  fftwf_free(pl_input);
+  fftwf_free(pl_spectrum);
+
+  // Linear demodulator carrier search FFT
+  int const fftsize = 1 << 16;
+  complex float * const fftinbuf = fftwf_alloc_complex(fftsize);
+  complex float * const fftoutbuf = fftwf_alloc_complex(fftsize);
+  fftwf_destroy_plan(plan_dft(fftsize,fftinbuf,fftoutbuf,FFTW_FORWARD));
+  fftwf_free(fftinbuf);
+  fftwf_free(fftoutbuf);
+
+  delete_filter_output(pl_filter);
+  delete_filter_output(audio_filter);
+  delete_filter_input(audio_master);
+  delete_filter_output(slave);
+  delete_filter_input(master);
+}
+
+int main(int argc,char *argv[]){
+  snprintf(Statepath,sizeof(Statepath),"%s/%s",getenv("HOME"),".radiostate");
+  char wisdom_file[PATH_MAX];
+  snprintf(wisdom_file,sizeof(wisdom_file),"%s/wisdom",Statepath);
+  Fftw_plan_level = FFTW_PATIENT; // We have time; radio doesn't
+  int decimations[16];
+  int ndecimations = 0;
+  int samprate = 192000;
+
+  int c;
+  while((c = getopt(argc,argv,"d:r:vw:W:")) != -1){
+    switch(c){
+    case 'd':   // A/D to audio sample rate ratio, e.g., 4 for 192 kHz
+      if(ndecimations < sizeof(decimations)/sizeof(decimations[0]))
+	decimations[ndecimations++] = strtol(optarg,NULL,0);
+      break;
+    case 'r':   // A/D sample rate, for planning L and M and the decimations
+      samprate = strtol(optarg,NULL,0);
+      break;
+    case 'v':
+      Verbose++;
+      break;
+    case 'w':
+      if((Fftw_plan_level = plan_level(optarg)) == -1){
+	fprintf(stderr,"Unknown FFTW planning level %s; use estimate, measure, patient or exhaustive\n",optarg);
+	exit(1);
+      }
+      break;
+    case 'W':
+      strlcpy(wisdom_file,optarg,sizeof(wisdom_file));
+      break;
+    default:
+      fprintf(stderr,"Usage: %s [-d decimate ...] [-r samprate] [-v] [-w planning level] [-W wisdom file] [state file ...]\n",argv[0]);
+      exit(1);
+    }
+  }
+
+  fftwf_import_system_wisdom();
+  if(load_wisdom(wisdom_file) == -1 && Verbose)
+    fprintf(stderr,"No existing wisdom in %s\n",wisdom_file);
+
+  // Same default state file radio uses
+  char *defaults[] = { "default" };
+  char **files = argc > optind ? argv + optind : defaults;
+  int const nfiles = argc > optind ? argc - optind : 1;
+
+  for(int i=0; i < nfiles; i++){
+    int L = 0;
+    int M = 0;
+    int partitions = 1;
+    float block_time = 0.020; // Defaults from main.c
+    float transition = 140;
+    float beta = 3.0;
+    if(read_state(files[i],&L,&M,&partitions,&block_time,&transition,&beta) == -1)
+      continue;
+    if(plan_blocksize(samprate,block_time,transition,beta,&L,&M,&partitions) == -1){
+      fprintf(stderr,"%s: can't pick a blocksize, skipped\n",files[i]);
+      continue;
+    }
+    // Unless told otherwise, every decimation radio might pick for a channel, down to a 48 kHz output
+    int ratios[samprate / PLAN_MIN_RATE + 1];
+    int nratios = 0;
+    if(ndecimations > 0){
+      memcpy(ratios,decimations,ndecimations * sizeof(*ratios));
+      nratios = ndecimations;
+    } else {
+      for(int d = samprate / PLAN_MIN_RATE; d >= 1; d--){
+	if(decimation_ok(samprate,L,M,d,48000))
+	  ratios[nratios++] = d;
+      }
+    }
+    for(int j=0; j < nratios; j++){
+      int const decimate = ratios[j];
+      if(decimate <= 0 || L % decimate != 0 || (L + M - 1) % decimate != 0){
+	fprintf(stderr,"%s: blocksize %d or FFT size %d not divisible by decimation %d, skipped\n",files[i],L,L+M-1,decimate);
+	continue;
+      }
+      struct timespec start,stop;
+      clock_gettime(CLOCK_MONOTONIC,&start);
+      plan_all(L,M,partitions,decimate);
+      clock_gettime(CLOCK_MONOTONIC,&stop);
+      printf("%s: L %d M %d N %d partitions %d decimate %d: %s planning took %.1f sec\n",files[i],L,M,L+M-1,partitions,decimate,
+	     plan_level_name(Fftw_plan_level),
+	     (stop.tv_sec - start.tv_sec) + 1e-9 * (stop.tv_nsec - start.tv_nsec));
+    }
+  }
+  printf("Wisdom file %s\n",wisdom_file);
+  exit(0);
+}
@@ -23,9 +23,9 @@ int Nmodes;
 extern char Libdir[];
 
 struct demodtab Demodtab[] = {
-      {LINEAR_DEMOD, "Linear", demod_linear}, // Coherent demodulation of AM, DSB, BPSK; calibration on WWV/WWVH/CHU carrier
-      {AM_DEMOD,     "AM",     demod_am},     // AM evelope detection
-      {FM_DEMOD,     "FM",     demod_fm},     // NBFM and noncoherent PM
+      {LINEAR_DEMOD, "Linear", start_linear, demod_linear, stop_linear}, // Coherent demodulation of AM, DSB, BPSK; calibration on WWV/WWVH/CHU carrier
+      {AM_DEMOD,     "AM",     start_am,     demod_am,     stop_am},    // AM evelope detection
+      {FM_DEMOD,     "FM",     start_fm,     demod_fm,     stop_fm},    // NBFM and noncoherent PM
 };
 int Ndemod = sizeof(Demodtab)/sizeof(struct demodtab);
 
@@ -106,6 +106,8 @@ int readmodes(char *file){
 	mtp->isb = 1;         // For independent sideband: LSB on left, USB on right
       } else if(strcasecmp(option,"flat") == 0){
 	mtp->flat = 1;         // FM only
+      } else if(strcasecmp(option,"minphase") == 0){
+	mtp->min_phase = 1;    // Minimum phase predetection filter
       } else if(strcasecmp(option,"square") == 0){
 	mtp->square = mtp->pll = 1; // Square implies PLL
       } else if(strcasecmp(option,"coherent") == 0 || strcasecmp(option,"pll") == 0){
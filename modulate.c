@@ -145,7 +145,7 @@ int main(int argc,char *argv[]){
     }
     // Form baseband signal (analytic for SSB, pure real for AM/DSB)
     execute_filter_input(filter_in);
-    execute_filter_output(filter_out);
+    execute_filter_output(filter_out,0);
     
     // Add carrier, if present
     if(carrier != 0){
@@ -153,9 +153,9 @@ int main(int argc,char *argv[]){
 	filter_out->output.c[i] += carrier;
     }
     // Spin up to chosen carrier frequency
-    for(int i=0;i<L;i++){
-      filter_out->output.c[i] *= step_osc(&osc) * amplitude;
-    }
+    mix_osc(&osc,filter_out->output.c,L);
+    for(int i=0;i<L;i++)
+      filter_out->output.c[i] *= amplitude;
     int16_t output[2*L];
     for(int i=0;i<L;i++){
       output[2*i] = crealf(filter_out->output.c[i]) * SHRT_MAX;
@@ -23,16 +23,6 @@
 #include "misc.h"
 #include "multicast.h"
 
-// Incoming RTP packets
-#define PKTSIZE 16384         // Maximum bytes per RTP packet - must be bigger than Ethernet MTU (including offloaded reassembly)
-struct packet {
-  struct packet *next;
-  struct rtp_header rtp;
-  unsigned char *data;
-  int len;
-  unsigned char content[PKTSIZE];
-};
-
 struct session {
   struct session *prev;     // Linked list pointers
   struct session *next; 
@@ -46,9 +36,7 @@ struct session {
   char dest_port[NI_MAXSERV];    // RTP Destination port
 
   pthread_t task;           // Thread reading from queue and running decoder
-  struct packet *queue;     // Incoming RTP packets
-  pthread_mutex_t qmutex;   // Mutex protecting packet queue
-  pthread_cond_t qcond;     // Condition variable for arrival of new packet
+  struct pktring *ring;     // Incoming RTP packets, in sequence order
 
   struct rtp_state rtp_state;
   uint32_t ssrc;            // RTP Sending Source ID
@@ -278,30 +266,25 @@ void *sockproc(void *arg){
     fprintf(stderr,"Can't set up input %s\n",mcast_address_text);
     pthread_exit(NULL);
   }
-  struct packet *pkt = NULL;
+  struct mrecv * const mrecv = create_mrecv(input_fd);
+  if(mrecv == NULL){
+    fprintf(stderr,"Can't allocate receive buffers for %s\n",mcast_address_text);
+    pthread_exit(NULL);
+  }
 
   // Main loop begins here
   while(1){
-
-    // Need a new packet buffer?
-    if(!pkt)
-      pkt = malloc(sizeof(*pkt));
-    // Zero these out to catch any uninitialized derefs
-    pkt->next = NULL;
-    pkt->data = NULL;
-    pkt->len = 0;
-    
     struct sockaddr_storage sender;
     socklen_t socksize = sizeof(sender);
-    int size = recvfrom(input_fd,&pkt->content,sizeof(pkt->content),0,(struct sockaddr *)&sender,&socksize);
-    
-    if(size == -1){
+    struct packet * const pkt = recv_pkt(mrecv,(struct sockaddr *)&sender,&socksize);
+    if(pkt == NULL){
       if(errno != EINTR){ // Happens routinely, e.g., when window resized
-	perror("recvfrom");
+	perror("recvmmsg");
 	usleep(1000);
       }
-      continue;  // Reuse current buffer
+      continue;
     }
+    int const size = pkt->len;
     if(size <= RTP_MIN_SIZE)
       continue; // Must be big enough for RTP header and at least some data
     
@@ -328,31 +311,22 @@ void *sockproc(void *arg){
       sp->start_rptr = Rptr;
       sp->reset = 1;
       
-      pthread_mutex_init(&sp->qmutex,NULL);
-      pthread_cond_init(&sp->qcond,NULL);
+      if(!(sp->ring = create_pktring(4))){
+	fprintf(stderr,"No room!!\n");
+	close_session(sp);
+	continue;
+      }
       if(pthread_create(&sp->task,NULL,decode_task,sp) == -1){
 	perror("pthread_create");
+	delete_pktring(sp->ring);
 	close_session(sp);
 	continue;
       }
     }
     
-    // Insert onto queue sorted by sequence number, wake up thread
-    struct packet *q_prev = NULL;
-    struct packet *qe = NULL;
-    pthread_mutex_lock(&sp->qmutex);
-    for(qe = sp->queue; qe && pkt->rtp.seq >= qe->rtp.seq; q_prev = qe,qe = qe->next)
-      ;
-    
-    pkt->next = qe;
-    if(q_prev)
-      q_prev->next = pkt;
-    else
-      sp->queue = pkt; // Front of list
-    pkt = NULL;        // force new packet to be allocated
-    // wake up decoder thread
-    pthread_cond_signal(&sp->qcond);
-    pthread_mutex_unlock(&sp->qmutex);
+    // Into its slot in the session's ring, wake up decoder thread if it's waiting
+    // The ring's empty buffer goes back into the receive pool in its place
+    replace_pkt(mrecv,put_pkt(sp->ring,pkt));
   }      
 }
 
@@ -389,18 +363,12 @@ void decode_task_cleanup(void *arg){
   struct session *sp = (struct session *)arg;
   assert(sp);
 
-  pthread_mutex_destroy(&sp->qmutex);
-  pthread_cond_destroy(&sp->qcond);
-
   if(sp->opus){
     opus_decoder_destroy(sp->opus);
     sp->opus = NULL;
   }
-  struct packet *pkt_next;
-  for(struct packet *pkt = sp->queue; pkt; pkt = pkt_next){
-    pkt_next = pkt->next;
-    free(pkt);
-  }
+  delete_pktring(sp->ring);
+  sp->ring = NULL;
 }
 
 // Thread to decode incoming RTP packets for each session
@@ -417,15 +385,8 @@ void *decode_task(void *arg){
   // Main loop; run until asked to quit
   while(!sp->terminate){
 
-    struct packet *pkt = NULL;
-    // Wait for packet to appear on queue
-    pthread_mutex_lock(&sp->qmutex);
-    while(!sp->queue)
-      pthread_cond_wait(&sp->qcond,&sp->qmutex);
-    pkt = sp->queue;
-    sp->queue = pkt->next;
-    pkt->next = NULL;
-    pthread_mutex_unlock(&sp->qmutex);
+    // Wait for next packet in sequence
+    struct packet *pkt = get_pkt(sp->ring);
 
     sp->type = pkt->rtp.type;
     sp->packets++; // Count all packets, regardless of type
@@ -521,7 +482,7 @@ void *decode_task(void *arg){
       break;
     }
   drop:;
-    free(pkt); pkt = NULL;
+    release_pkt(sp->ring); pkt = NULL;
   }
   pthread_cleanup_pop(1);
   return NULL;
@@ -2,11 +2,16 @@
 // Multicast socket and RTP utility routines
 // Copyright 2018 Phil Karn, KA9Q
 
+#define _GNU_SOURCE 1 // recvmmsg(), sendmmsg()
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <net/if.h>
+#include <netinet/udp.h>
 #if defined(linux)
 #include <bsd/string.h>
 #endif
@@ -14,6 +19,10 @@
 
 #define EF_TOS 0x2e // Expedited Forwarding type of service, widely used for VoIP (which all this is, sort of)
 
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103 // Linux 4.18+; older headers lack it
+#endif
+
 // Set options on multicast socket
 static void soptions(int fd,int mcast_ttl){
   // Failures here are not fatal
@@ -339,6 +348,460 @@ int rtp_process(struct rtp_state *state,struct rtp_header *rtp,int sampcnt){
   return time_step;
 }
 
+static long long now_ns(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Set up batched receive on socket fd
+// Each datagram is timestamped by the kernel as it arrives, so time spent queued in the socket counts too
+struct mrecv *create_mrecv(int fd){
+  struct mrecv * const mr = calloc(1,sizeof(*mr));
+  if(mr == NULL)
+    return NULL;
+  mr->fd = fd;
+  mr->msg = calloc(RECV_BATCH,sizeof(*mr->msg));
+  mr->iov = calloc(RECV_BATCH,sizeof(*mr->iov));
+  mr->control = calloc(RECV_BATCH,sizeof(*mr->control));
+  if(mr->msg == NULL || mr->iov == NULL || mr->control == NULL){
+    delete_mrecv(mr);
+    return NULL;
+  }
+  for(int i=0; i < RECV_BATCH; i++){
+    if((mr->pkt[i] = malloc(sizeof(struct packet))) == NULL){
+      delete_mrecv(mr);
+      return NULL;
+    }
+  }
+  int const on = 1;
+  if(setsockopt(fd,SOL_SOCKET,SO_TIMESTAMPNS,&on,sizeof(on)) == -1)
+    perror("setsockopt SO_TIMESTAMPNS"); // Not fatal; recv_pkt() falls back to the time recvmmsg() returns
+  return mr;
+}
+
+void delete_mrecv(struct mrecv *mr){
+  if(mr == NULL)
+    return;
+  for(int i=0; i < RECV_BATCH; i++)
+    free(mr->pkt[i]);
+  free(mr->msg);
+  free(mr->iov);
+  free(mr->control);
+  free(mr);
+}
+
+// Count and pass over datagrams in the batch that were too big for content[]
+static void skip_truncated(struct mrecv *mr){
+  while(mr->next < mr->count && (mr->msg[mr->next].msg_hdr.msg_flags & MSG_TRUNC)){
+    mr->truncated++;
+    mr->next++;
+  }
+}
+
+// Return the next datagram, waiting for a new batch only when the last one is used up
+// The packet's content[] holds the raw datagram, with len its size and data pointing at content.
+// It stays in the pool and is overwritten by a later batch unless the caller takes it with replace_pkt()
+// Sender address is returned as by recvfrom(), if requested
+// Datagrams too big for content[] are counted and dropped rather than returned cut short
+// Returns NULL on error, with errno set by recvmmsg()
+struct packet *recv_pkt(struct mrecv *mr,struct sockaddr *sender,socklen_t *socksize){
+  assert(mr != NULL);
+  while(mr->next >= mr->count){
+    mr->next = mr->count = 0;
+    for(int i=0; i < RECV_BATCH; i++){
+      mr->iov[i].iov_base = mr->pkt[i]->content;
+      mr->iov[i].iov_len = sizeof(mr->pkt[i]->content);
+      mr->msg[i].msg_hdr.msg_name = &mr->sender[i];
+      mr->msg[i].msg_hdr.msg_namelen = sizeof(mr->sender[i]);
+      mr->msg[i].msg_hdr.msg_iov = &mr->iov[i];
+      mr->msg[i].msg_hdr.msg_iovlen = 1;
+      mr->msg[i].msg_hdr.msg_control = mr->control[i];
+      mr->msg[i].msg_hdr.msg_controllen = sizeof(mr->control[i]);
+      mr->msg[i].msg_hdr.msg_flags = 0;
+    }
+    // Block for the first datagram, then take whatever else is already queued
+    int const n = recvmmsg(mr->fd,mr->msg,RECV_BATCH,MSG_WAITFORONE,NULL);
+    if(n <= 0)
+      return NULL;
+    mr->count = n;
+    mr->calls++;
+    mr->packets += n;
+    mr->depth[n]++;
+    // Kernel timestamps are on the wall clock; note where it stands against the monotonic one
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    mr->received = now_ns();
+    mr->clock_offset = mr->received - (ts.tv_sec * 1000000000LL + ts.tv_nsec);
+    skip_truncated(mr);
+  }
+  int const i = mr->last = mr->next++;
+  skip_truncated(mr); // So pkts_pending() doesn't promise one that isn't there
+  struct packet * const pkt = mr->pkt[i];
+  pkt->next = NULL;
+  pkt->data = pkt->content;
+  pkt->len = mr->msg[i].msg_len;
+  pkt->arrival = mr->received;
+  for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mr->msg[i].msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&mr->msg[i].msg_hdr,cmsg)){
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS){
+      struct timespec ts;
+      memcpy(&ts,CMSG_DATA(cmsg),sizeof(ts));
+      pkt->arrival = ts.tv_sec * 1000000000LL + ts.tv_nsec + mr->clock_offset;
+      break;
+    }
+  }
+  if(sender && socksize){
+    socklen_t const len = mr->msg[i].msg_hdr.msg_namelen;
+    memcpy(sender,&mr->sender[i],len < *socksize ? len : *socksize);
+    *socksize = len;
+  }
+  return pkt;
+}
+
+// Keep the packet last returned by recv_pkt(), putting the caller's empty one in its place in the pool
+// Passing that same packet back is a no-op
+void replace_pkt(struct mrecv *mr,struct packet *pkt){
+  assert(mr != NULL && pkt != NULL && mr->next > 0);
+  mr->pkt[mr->last] = pkt;
+}
+
+// Report how much batching is saving us
+void dump_mrecv(FILE *fp,struct mrecv const *mr){
+  if(mr == NULL || mr->calls == 0)
+    return;
+  fprintf(fp,"%lld datagrams in %lld calls, average batch %.2f\n",
+	  mr->packets,mr->calls,(double)mr->packets/mr->calls);
+  if(mr->truncated)
+    fprintf(fp," %lld too big for %d byte packets, dropped\n",mr->truncated,PKTSIZE);
+  for(int i=1; i <= RECV_BATCH; i++){
+    if(mr->depth[i])
+      fprintf(fp," %d: %lld\n",i,mr->depth[i]);
+  }
+}
+
+// Set up batched transmit on socket fd, for datagrams of up to pktsize bytes
+// A queued datagram waits at most about 'latency' seconds (plus one datagram interval) before going out
+struct msend *create_msend(int fd,double latency,int pktsize){
+  if(pktsize <= 0 || pktsize > SEND_MAX_PKTSIZE)
+    return NULL;
+  struct msend * const ms = calloc(1,sizeof(*ms));
+  if(ms == NULL)
+    return NULL;
+  ms->fd = fd;
+  ms->latency = latency * 1e9;
+  ms->pktsize = pktsize;
+  ms->buf = malloc(SEND_BATCH * pktsize);
+  ms->msg = calloc(SEND_BATCH,sizeof(*ms->msg));
+  ms->iov = calloc(SEND_BATCH,sizeof(*ms->iov));
+  if(ms->buf == NULL || ms->msg == NULL || ms->iov == NULL){
+    delete_msend(ms);
+    return NULL;
+  }
+#if defined(linux)
+  // See if the kernel knows about UDP segmentation offload
+  int segsize = 0;
+  socklen_t optlen = sizeof(segsize);
+  ms->gso = (getsockopt(fd,SOL_UDP,UDP_SEGMENT,&segsize,&optlen) == 0);
+#endif
+  return ms;
+}
+
+void delete_msend(struct msend *ms){
+  if(ms == NULL)
+    return;
+  flush_send(ms);
+  free(ms->buf);
+  free(ms->msg);
+  free(ms->iov);
+  free(ms);
+}
+
+// Where to build the next datagram; commit it with queue_send()
+unsigned char *send_buffer(struct msend *ms){
+  assert(ms != NULL && ms->count < SEND_BATCH);
+  return ms->buf + ms->count * ms->pktsize;
+}
+
+// Queue the datagram just built in send_buffer()
+// Sends the queue if it's full or the oldest entry has waited out the latency cap
+// Returns -1 if that send failed, 0 otherwise
+int queue_send(struct msend *ms,int len){
+  assert(ms != NULL && ms->count < SEND_BATCH && len >= 0 && len <= ms->pktsize);
+  if(ms->count == 0 && ms->latency > 0)
+    ms->first = now_ns();
+  ms->len[ms->count++] = len;
+  if(ms->count == SEND_BATCH || (ms->latency > 0 && now_ns() - ms->first >= ms->latency))
+    return flush_send(ms);
+  return 0;
+}
+
+#if defined(linux)
+// Send the whole queue as one UDP GSO super-datagram, segmented by the kernel
+// Only possible when every datagram but the last is the same size, and the last is no bigger
+static int send_gso(struct msend *ms,int count){
+  int const segsize = ms->len[0];
+  for(int i=1; i < count; i++){
+    if(ms->len[i] > segsize || (i < count-1 && ms->len[i] != segsize))
+      return -1;
+  }
+  union {
+    char buf[CMSG_SPACE(sizeof(uint16_t))];
+    struct cmsghdr align;
+  } control;
+  memset(&control,0,sizeof(control));
+  for(int i=0; i < count; i++){
+    ms->iov[i].iov_base = ms->buf + i * ms->pktsize;
+    ms->iov[i].iov_len = ms->len[i];
+  }
+  struct msghdr msg;
+  memset(&msg,0,sizeof(msg));
+  msg.msg_iov = ms->iov;
+  msg.msg_iovlen = count;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr * const cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_UDP;
+  cm->cmsg_type = UDP_SEGMENT;
+  cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+  *(uint16_t *)CMSG_DATA(cm) = segsize;
+  if(sendmsg(ms->fd,&msg,0) == -1){
+    if(errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)
+      ms->gso = 0; // Device or socket can't do it after all; don't try again
+    return -1;
+  }
+  return 0;
+}
+#endif
+
+// Send everything queued. Returns -1 on error (the queue is discarded anyway), 0 otherwise
+int flush_send(struct msend *ms){
+  assert(ms != NULL);
+  if(ms->count == 0)
+    return 0;
+
+  int const count = ms->count;
+  ms->count = 0;
+  if(count == 1){
+    ms->calls++;
+    if(send(ms->fd,ms->buf,ms->len[0],0) == -1){
+      ms->errors++;
+      return -1;
+    }
+    ms->packets++;
+    return 0;
+  }
+#if defined(linux)
+  if(ms->gso && send_gso(ms,count) == 0){
+    ms->calls++;
+    ms->packets += count;
+    return 0;
+  }
+#endif
+  for(int i=0; i < count; i++){
+    ms->iov[i].iov_base = ms->buf + i * ms->pktsize;
+    ms->iov[i].iov_len = ms->len[i];
+    memset(&ms->msg[i].msg_hdr,0,sizeof(ms->msg[i].msg_hdr));
+    ms->msg[i].msg_hdr.msg_iov = &ms->iov[i];
+    ms->msg[i].msg_hdr.msg_iovlen = 1;
+  }
+  int sent = 0;
+  while(sent < count){
+    int const r = sendmmsg(ms->fd,&ms->msg[sent],count - sent,0);
+    ms->calls++;
+    if(r <= 0){
+      ms->errors++;
+      return -1;
+    }
+    sent += r;
+    ms->packets += r;
+  }
+  return 0;
+}
+
+// Create lock-free ring of RTP packets, with all its packet buffers allocated up front
+// The consumer waits for a missing packet until 'reorder' later ones have arrived
+struct pktring *create_pktring(int reorder){
+  struct pktring * const ring = calloc(1,sizeof(*ring));
+  if(ring == NULL)
+    return NULL;
+
+  pthread_mutex_init(&ring->mutex,NULL);
+  pthread_cond_init(&ring->cond,NULL);
+  for(int i=0; i < PKTRING_SIZE; i++){
+    if((ring->slot[i] = malloc(sizeof(struct packet))) == NULL){
+      delete_pktring(ring);
+      return NULL;
+    }
+  }
+  if((ring->resync_pkt = malloc(sizeof(struct packet))) == NULL){
+    delete_pktring(ring);
+    return NULL;
+  }
+  if(reorder < 0)
+    reorder = 0;
+  else if(reorder > PKTRING_SIZE/2)
+    reorder = PKTRING_SIZE/2;
+  ring->reorder = reorder;
+  return ring;
+}
+
+void delete_pktring(struct pktring *ring){
+  if(ring == NULL)
+    return;
+  for(int i=0; i < PKTRING_SIZE; i++)
+    free(ring->slot[i]);
+  free(ring->resync_pkt);
+  pthread_mutex_destroy(&ring->mutex);
+  pthread_cond_destroy(&ring->cond);
+  free(ring);
+}
+
+static void wake_consumer(struct pktring *ring){
+  // Both sides use sequentially consistent atomics on 'waiting' and the slot flags,
+  // so either the consumer sees the new packet or we see it waiting
+  if(atomic_load(&ring->waiting)){
+    pthread_mutex_lock(&ring->mutex);
+    pthread_cond_signal(&ring->cond);
+    pthread_mutex_unlock(&ring->mutex);
+  }
+}
+
+// Producer: put a received packet, header already converted by ntoh_rtp(), into its slot
+// Returns an empty packet for the next receive - the one swapped out of the slot,
+// or the caller's own if the packet was dropped
+struct packet *put_pkt(struct pktring *ring,struct packet *pkt){
+  assert(ring != NULL && pkt != NULL);
+
+  if(atomic_load(&ring->resync))
+    return pkt; // Consumer hasn't acted on the last one yet
+
+  if(!ring->init || pkt->rtp.ssrc != ring->ssrc){
+    // First packet, or the sender restarted
+    ring->init = 1;
+    ring->ssrc = pkt->rtp.ssrc;
+    goto resync;
+  }
+  unsigned int const head = atomic_load(&ring->head);
+  int const d = (int16_t)(pkt->rtp.seq - (uint16_t)head);
+  if(d < -PKTRING_SIZE || d >= PKTRING_SIZE){
+    // Way outside the window. Either the consumer has fallen badly behind
+    // or the sequence jumped; after a few in a row, start over from here
+    if(++ring->wild > 3){
+      ring->wild = 0;
+      goto resync;
+    }
+    if(d > 0)
+      ring->overruns++;
+    else
+      ring->late++;
+    return pkt;
+  }
+  ring->wild = 0;
+  if(d < 0){
+    ring->late++; // Consumer already moved past it
+    return pkt;
+  }
+  unsigned int const seq = head + d;
+  int const i = seq & (PKTRING_SIZE-1);
+  if(atomic_load(&ring->full[i])){
+    // Slot is still occupied, either by a duplicate or an unconsumed older packet
+    if(ring->slot[i]->rtp.seq == pkt->rtp.seq)
+      ring->late++;
+    else
+      ring->overruns++;
+    return pkt;
+  }
+  struct packet * const empty = ring->slot[i];
+  ring->slot[i] = pkt;
+  if((int)(seq + 1 - atomic_load(&ring->tail)) > 0)
+    atomic_store(&ring->tail,seq + 1);
+  if(d + 1 > atomic_load(&ring->hwm))
+    atomic_store(&ring->hwm,d + 1);
+  atomic_store(&ring->full[i],1);
+  wake_consumer(ring);
+  return empty;
+
+ resync:;
+  // Only the consumer may touch the slots, so it does the actual reset and puts
+  // this packet in the first one. Until then it waits in resync_pkt, swapped for the spare
+  {
+    struct packet * const empty = ring->resync_pkt;
+    ring->resync_pkt = pkt;
+    ring->resync_seq = pkt->rtp.seq;
+    atomic_store(&ring->tail,ring->resync_seq + 1);
+    ring->resyncs++;
+    atomic_store(&ring->resync,1);
+    wake_consumer(ring);
+    return empty;
+  }
+}
+
+static int ring_ready(struct pktring *ring,unsigned int head){
+  return atomic_load(&ring->resync)
+    || atomic_load(&ring->full[head & (PKTRING_SIZE-1)])
+    || (int)(atomic_load(&ring->tail) - head) > ring->reorder;
+}
+
+static void unlock_mutex(void *arg){
+  pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+// Consumer: return the next packet in sequence, blocking until it arrives or is given up as lost
+// The packet belongs to the consumer until release_pkt()
+struct packet *get_pkt(struct pktring *ring){
+  assert(ring != NULL);
+
+  while(1){
+    if(atomic_load(&ring->resync)){
+      for(int i=0; i < PKTRING_SIZE; i++)
+	atomic_store(&ring->full[i],0);
+      // The packet that caused it goes first; its slot's old buffer becomes the producer's spare
+      int const i = ring->resync_seq & (PKTRING_SIZE-1);
+      struct packet * const spare = ring->slot[i];
+      ring->slot[i] = ring->resync_pkt;
+      ring->resync_pkt = spare;
+      atomic_store(&ring->full[i],1);
+      atomic_store(&ring->head,ring->resync_seq);
+      atomic_store(&ring->resync,0);
+      continue;
+    }
+    unsigned int const head = atomic_load(&ring->head);
+    int const i = head & (PKTRING_SIZE-1);
+    if(atomic_load(&ring->full[i])){
+      if(ring->slot[i]->rtp.seq == (uint16_t)head)
+	return ring->slot[i];
+      // The producer filled this slot for a sequence number we'd already given up on,
+      // or from before a resync; it's stale, so empty the slot and keep waiting for the right one
+      ring->late++;
+      atomic_store(&ring->full[i],0);
+      continue;
+    }
+
+    if((int)(atomic_load(&ring->tail) - head) > ring->reorder){
+      // Enough later packets have arrived; stop waiting for this one
+      ring->lost++;
+      atomic_store(&ring->head,head + 1);
+      continue;
+    }
+    // Nothing to do; sleep until the producer wakes us
+    pthread_mutex_lock(&ring->mutex);
+    pthread_cleanup_push(unlock_mutex,&ring->mutex); // We may be cancelled in the wait
+    atomic_store(&ring->waiting,1);
+    while(!ring_ready(ring,head))
+      pthread_cond_wait(&ring->cond,&ring->mutex);
+    atomic_store(&ring->waiting,0);
+    pthread_cleanup_pop(1);
+  }
+}
+
+// Consumer: done with the packet from get_pkt(), give its slot back to the producer
+void release_pkt(struct pktring *ring){
+  assert(ring != NULL);
+  unsigned int const head = atomic_load(&ring->head);
+  atomic_store(&ring->full[head & (PKTRING_SIZE-1)],0);
+  atomic_store(&ring->head,head + 1);
+}
+
 // For caching back conversions of binary socket structures to printable addresses
 void update_sockcache(struct sockcache *sc,struct sockaddr *sa){
   int len;
@@ -5,7 +5,10 @@
 
 #ifndef _MULTICAST_H
 #define _MULTICAST_H 1
+#include <stdio.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <assert.h>
@@ -37,6 +40,95 @@ struct rtp_header {
   uint32_t csrc[15];
 };
 
+// Incoming RTP packets
+#define PKTSIZE 16384         // Maximum bytes per RTP packet - must be bigger than Ethernet MTU (including offloaded reassembly)
+struct packet {
+  struct packet *next;
+  struct rtp_header rtp;
+  unsigned char *data;
+  int len;
+  long long arrival;          // When the kernel received it, CLOCK_MONOTONIC ns
+  unsigned char content[PKTSIZE];
+};
+
+// Single-producer, single-consumer ring of received RTP packets, indexed by sequence number
+// The receive thread and the processing thread share it without locks; each slot
+// holds a preallocated packet, and packets are exchanged with the producer by pointer swap.
+// A packet arriving out of order simply lands in its own slot, and a slot still empty
+// when the producer has moved more than 'reorder' packets beyond it is declared lost
+#define PKTRING_SIZE 64       // Must be power of 2
+struct pktring {
+  struct packet *slot[PKTRING_SIZE];
+  atomic_int full[PKTRING_SIZE]; // Set by producer when slot is filled, cleared by consumer
+  atomic_uint head;         // Extended sequence number the consumer wants next
+  atomic_uint tail;         // One past highest extended sequence number received
+  atomic_int resync;        // Producer asks consumer to restart at resync_seq
+  unsigned int resync_seq;
+  struct packet *resync_pkt; // Packet that caused the resync, for the consumer to put in its slot; otherwise a spare
+  int reorder;              // Packets to wait for a missing one before declaring it lost
+
+  // Producer private
+  int init;
+  uint32_t ssrc;
+  int wild;                 // Consecutive packets out of the window
+
+  // Consumer sleeps here only when the ring is empty
+  atomic_int waiting;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  // Statistics
+  atomic_llong late;        // Duplicate or too late, dropped by producer (or found stale by consumer)
+  atomic_llong overruns;    // Consumer too slow, dropped by producer
+  atomic_llong lost;        // Never arrived, skipped by consumer
+  atomic_llong resyncs;
+  atomic_int hwm;           // Most packets ever waiting for the consumer
+};
+
+// Batched receive of datagrams into a preallocated pool of packets, one recvmmsg() per batch
+#define RECV_BATCH 16
+struct mrecv {
+  int fd;
+  int count;                // Datagrams in current batch
+  int next;                 // Next one to hand out
+  int last;                 // Last one handed out, for replace_pkt()
+  struct packet *pkt[RECV_BATCH];
+  struct sockaddr_storage sender[RECV_BATCH];
+  struct mmsghdr *msg;
+  struct iovec *iov;
+  char (*control)[64];      // Ancillary data for each datagram, i.e., its kernel timestamp
+  long long received;       // When the batch was returned, CLOCK_MONOTONIC ns
+  long long clock_offset;   // CLOCK_MONOTONIC minus CLOCK_REALTIME, for converting kernel timestamps
+
+  // Statistics
+  long long calls;          // recvmmsg() calls returning data
+  long long packets;        // Datagrams received
+  long long truncated;      // Datagrams bigger than PKTSIZE, dropped
+  long long depth[RECV_BATCH+1]; // Histogram of datagrams per call
+};
+
+// Batched transmit. Datagrams are built in place in a queue and flushed with one sendmmsg(),
+// or one UDP GSO send when the kernel supports it and all but the last are the same size
+#define SEND_BATCH 16
+#define SEND_MAX_PKTSIZE PKTSIZE // Largest datagram our receivers take; anything above the path MTU gets fragmented
+struct msend {
+  int fd;
+  int pktsize;              // Largest datagram the caller will build, bytes
+  int count;                // Datagrams queued
+  long long latency;        // Flush when the oldest has waited this long, ns; 0 = only when full or asked
+  long long first;          // When the oldest was queued, ns
+  int gso;                  // Kernel does UDP segmentation offload on this socket
+  unsigned char *buf;       // SEND_BATCH buffers of pktsize bytes
+  int len[SEND_BATCH];
+  struct mmsghdr *msg;
+  struct iovec *iov;
+
+  // Statistics
+  long long calls;          // System calls that sent data
+  long long packets;        // Datagrams sent
+  long long errors;
+};
+
 // RTP sender/receiver state
 struct rtp_state {
   uint32_t ssrc;
@@ -109,6 +201,38 @@ void update_sockcache(struct sockcache *sc,struct sockaddr *sa);
 // Returns number of samples dropped or skipped by silence suppression, if any
 int rtp_process(struct rtp_state *state,struct rtp_header *rtp,int samples);
 
+// Batched receive
+struct mrecv *create_mrecv(int fd);
+void delete_mrecv(struct mrecv *);
+struct packet *recv_pkt(struct mrecv *,struct sockaddr *,socklen_t *);
+void replace_pkt(struct mrecv *,struct packet *);
+void dump_mrecv(FILE *,struct mrecv const *);
+
+// True when recv_pkt() can return a packet already received without another system call
+static inline int pkts_pending(struct mrecv const *mr){
+  return mr->next < mr->count;
+}
+
+// Batched transmit
+struct msend *create_msend(int fd,double latency,int pktsize);
+void delete_msend(struct msend *);
+unsigned char *send_buffer(struct msend *);
+int queue_send(struct msend *,int len);
+int flush_send(struct msend *);
+
+// Lock-free RTP packet ring
+struct pktring *create_pktring(int reorder);
+void delete_pktring(struct pktring *);
+struct packet *put_pkt(struct pktring *,struct packet *);
+struct packet *get_pkt(struct pktring *);
+void release_pkt(struct pktring *);
+
+// Packets received but not yet consumed, counting any holes still awaited
+static inline int pktring_depth(struct pktring *ring){
+  int const depth = atomic_load(&ring->tail) - atomic_load(&ring->head);
+  return depth > 0 ? depth : 0;
+}
+
 // Generate RTCP source description segment
 unsigned char *gen_sdes(unsigned char *output,int bufsize,uint32_t ssrc,struct rtcp_sdes const *sdes,int sc);
 // Generate RTCP bye segment
@@ -45,7 +45,6 @@ struct session {
 
 
 // Global config variables
-int const Bufsize = 8192;     // Maximum samples/words per RTP packet - must be bigger than Ethernet MTU
 int const Samprate = 48000;   // Too hard to handle other sample rates right now
                               // Opus will notice the actual audio bandwidth, so there's no real cost to this
 
@@ -64,6 +63,7 @@ int Mcast_ttl = 10;           // our multicast output is frequently routed
 
 // Global variables
 int Input_fd = -1;            // Multicast receive socket
+struct mrecv *Mrecv;          // Batched receive on Input_fd
 int Output_fd = -1;           // Multicast receive socket
 int Opus_frame_size;
 struct session *Audio;
@@ -146,6 +146,10 @@ int main(int argc,char * const argv[]){
     fprintf(stderr,"Can't set up input on %s: %sn",Mcast_input_address_text,strerror(errno));
     exit(1);
   }
+  if((Mrecv = create_mrecv(Input_fd)) == NULL){
+    fprintf(stderr,"Can't allocate receive buffers\n");
+    exit(1);
+  }
   Output_fd = setup_mcast(Mcast_output_address_text,NULL,1,Mcast_ttl,0);
   if(Output_fd == -1){
     fprintf(stderr,"Can't set up output on %s: %s\n",Mcast_output_address_text,strerror(errno));
@@ -166,16 +170,17 @@ int main(int argc,char * const argv[]){
   signal(SIGPIPE,SIG_IGN);
 
   while(1){
-    unsigned char buffer[Bufsize];
     socklen_t socksize = sizeof(sender);
-    int size = recvfrom(Input_fd,buffer,sizeof(buffer),0,&sender,&socksize);
-    if(size == -1){
+    struct packet * const pkt = recv_pkt(Mrecv,&sender,&socksize);
+    if(pkt == NULL){
       if(errno != EINTR){ // Happens routinely
-	perror("recvfrom");
+	perror("recvmmsg");
 	usleep(1000);
       }
       continue;
     }
+    unsigned char * const buffer = pkt->content;
+    int size = pkt->len;
     if(size <= RTP_MIN_SIZE){
       usleep(500); // Avoid tight loop
       continue; // Too small to be valid RTP
@@ -349,6 +354,9 @@ void closedown(int s){
   while(Audio != NULL)
     close_session(Audio);
 
+  if(Verbose)
+    dump_mrecv(stderr,Mrecv);
+
   exit(0);
 }
 // Enqueue a stereo pair of samples for transmit, encode and send Opus
@@ -6,55 +6,115 @@
 #include <math.h>
 #include <complex.h>
 #include "osc.h"
-#include "dsp.h"
 
-const int Renorm_rate = 16384; // Renormalize oscillators this often
+#define OSC_CHUNK 256 // Samples of phase computed ahead of each sin/cos pass
 
-// Return 1 if complex phasor appears to be initialized, 0 if not
-int is_phasor_init(const complex double x){
-  if(isnan(creal(x)) || isnan(cimag(x)) || cnrm(x) < 0.9)
-    return 0;
-  return 1;
+// Convert cycles (or cycles/sample, etc) to 2^-64 cycle units, modulo one cycle
+// Double has only 53 bits of mantissa, so nothing is lost by scaling by 2^63 and shifting
+static uint64_t fixed_phase(double x){
+  x -= round(x); // -0.5 to +0.5
+  return (uint64_t)llrint(ldexp(x,63)) << 1;
 }
 
 // Set oscillator frequency and sweep rate
 // Units are cycles/sample and cycles/sample^2
+// Phase is left alone, so retuning doesn't jump it
 void set_osc(struct osc *osc,double f,double r){
   pthread_mutex_lock(&osc->mutex);
-  if(!is_phasor_init(osc->phasor)){
-    osc->phasor = 1; // Don't jump phase if already initialized
-    osc->steps = 0;
-  }
   osc->freq = f;
   osc->rate = r;
-  osc->phasor_step = csincospi(2 * osc->freq);
-  if(osc->rate != 0)
-    osc->phasor_step_step = csincospi(2 * osc->rate);
-  else
-    osc->phasor_step_step = 1;
+  osc->phase_step = fixed_phase(f);
+  osc->phase_step_step = fixed_phase(r);
   pthread_mutex_unlock(&osc->mutex);
 }
 
+// Fill in top 32 bits of phase for the next cnt samples, advancing the oscillator
+static void next_phases(struct osc *osc,uint32_t *phase,int cnt){
+  uint64_t p = osc->phase;
+  uint64_t step = osc->phase_step;
+  uint64_t const step_step = osc->phase_step_step;
+  if(step_step == 0){
+    for(int i=0; i < cnt; i++)
+      phase[i] = (p + i * step) >> 32;
+    p += cnt * step;
+  } else {
+    for(int i=0; i < cnt; i++){
+      phase[i] = p >> 32;
+      p += step;
+      step += step_step;
+    }
+  }
+  osc->phase = p;
+  osc->phase_step = step;
+}
+
+// cos and sin of 2*pi*phase/2^32, reduced to +/-pi/4 by the top phase bits
+// Cephes single precision polynomials; about 1e-7 error. Straight-line code so loops over it vectorize
+static inline void sincos_phase(uint32_t const phase,float *c,float *s){
+  uint32_t const quadrant = (phase + (1U << 29)) >> 30;
+  float const x = (int32_t)(phase - (quadrant << 30)) * (float)(2 * M_PI / 4294967296.);
+  float const x2 = x * x;
+  float const sn = x + x * x2 * (-1.6666654611e-1f + x2 * (8.3321608736e-3f + x2 * -1.9515295891e-4f));
+  float const cs = 1 - 0.5f * x2 + x2 * x2 * (4.166664568298827e-2f + x2 * (-1.388731625493765e-3f + x2 * 2.443315711809948e-5f));
+  float const re = (quadrant & 1) ? -sn : cs;
+  float const im = (quadrant & 1) ? cs : sn;
+  *c = (quadrant & 2) ? -re : re;
+  *s = (quadrant & 2) ? -im : im;
+}
+
 // Step oscillator through one sample, return complex phase
 complex double step_osc(struct osc *osc){
-  complex double r;
+  uint32_t phase;
+  next_phases(osc,&phase,1);
+  float c,s;
+  sincos_phase(phase,&c,&s);
+  return CMPLX(c,s);
+}
 
-  r = osc->phasor;
-  if(osc->freq != 0){
-    osc->phasor *= osc->phasor_step;
-    if(osc->rate != 0)
-      osc->phasor_step *= osc->phasor_step_step;
+// Fill output with the next cnt oscillator samples
+void block_osc(struct osc *osc,complex float *output,int cnt){
+  float *out = (float *)output;
+  while(cnt > 0){
+    int const n = cnt < OSC_CHUNK ? cnt : OSC_CHUNK;
+    uint32_t phase[n];
+    next_phases(osc,phase,n);
+    for(int i=0; i < n; i++)
+      sincos_phase(phase[i],&out[2*i],&out[2*i+1]);
+    out += 2*n;
+    cnt -= n;
   }
-  if(++osc->steps == Renorm_rate)
-    renorm_osc(osc);
-  return r;
 }
 
-void renorm_osc(struct osc *osc){
-  osc->steps = 0;
-  osc->phasor /= cabs(osc->phasor);
-
-  if(osc->rate != 0)
-    osc->phasor_step /= cabs(osc->phasor_step);
+// Multiply buffer in place by the next cnt oscillator samples
+void mix_osc(struct osc *osc,complex float *buffer,int cnt){
+  float *buf = (float *)buffer;
+  while(cnt > 0){
+    int const n = cnt < OSC_CHUNK ? cnt : OSC_CHUNK;
+    uint32_t phase[n];
+    next_phases(osc,phase,n);
+    for(int i=0; i < n; i++){
+      float c,s;
+      sincos_phase(phase[i],&c,&s);
+      float const re = buf[2*i];
+      float const im = buf[2*i+1];
+      buf[2*i] = re * c - im * s;
+      buf[2*i+1] = re * s + im * c;
+    }
+    buf += 2*n;
+    cnt -= n;
+  }
 }
 
+// Advance oscillator by cnt samples (negative to back up) without generating them
+// Exact modulo one cycle, so skipping ahead lands on the same phase as stepping
+void advance_osc(struct osc *osc,long long cnt){
+  // cnt*(cnt-1)/2 increments of phase_step_step accumulate; halve whichever factor is even
+  long long a = cnt;
+  long long b = cnt - 1;
+  if(a % 2 == 0)
+    a /= 2;
+  else
+    b /= 2;
+  osc->phase += (uint64_t)cnt * osc->phase_step + (uint64_t)a * (uint64_t)b * osc->phase_step_step;
+  osc->phase_step += (uint64_t)cnt * osc->phase_step_step;
+}
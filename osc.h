@@ -3,22 +3,25 @@
 
 #define _GNU_SOURCE 1
 #include <pthread.h>
+#include <stdint.h>
 #include <math.h>
 #include <complex.h>
 
+// Numerically controlled oscillator
+// Phase is an exact fraction of a cycle in 64 bits, so it never drifts and needs no renormalizing
 struct osc {
-  double freq;
-  double rate;
-  complex double phasor;
-  complex double phasor_step;
-  complex double phasor_step_step;
+  double freq;              // cycles/sample
+  double rate;              // cycles/sample^2
+  uint64_t phase;           // 2^-64 cycles
+  uint64_t phase_step;      // Phase increment for the next sample
+  uint64_t phase_step_step; // Change in phase_step per sample, for sweeps
   pthread_mutex_t mutex;
-  int steps; // Steps since last normalize
 };
 #endif
 
 // Osc functions
 void set_osc(struct osc *osc,double f,double r);
 complex double step_osc(struct osc *osc);
-void renorm_osc(struct osc *osc);
-int is_phasor_init(const complex double x);
+void block_osc(struct osc *osc,complex float *output,int cnt);
+void mix_osc(struct osc *osc,complex float *buffer,int cnt);
+void advance_osc(struct osc *osc,long long cnt);
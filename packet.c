@@ -112,13 +112,19 @@ int main(int argc,char *argv[]){
   FD_ZERO(&fdset_template);
   int max_fd = 2;        // Highest number fd for select()
   int input_fd[Nfds];    // Multicast receive sockets
+  struct mrecv *mrecv[Nfds]; // Batched receive on each
 
   for(int i=0;i<Nfds;i++){
     input_fd[i] = setup_mcast(Mcast_address_text[i],NULL,0,0,0);
     if(input_fd[i] == -1){
       fprintf(stderr,"Can't set up input %s\n",Mcast_address_text[i]);
+      mrecv[i] = NULL;
       continue;
     }
+    if((mrecv[i] = create_mrecv(input_fd[i])) == NULL){
+      fprintf(stderr,"Can't allocate receive buffers for %s\n",Mcast_address_text[i]);
+      exit(1);
+    }
     if(input_fd[i] > max_fd)
       max_fd = input_fd[i];
     FD_SET(input_fd[i],&fdset_template);
@@ -136,28 +142,41 @@ int main(int argc,char *argv[]){
   // audio input thread
   // Receive audio multicasts, multiplex into sessions, execute filter front end (which wakes up decoder thread)
   while(1){
-    // Wait for traffic to arrive
-    fd_set fdset = fdset_template;
-    int s = select(max_fd+1,&fdset,NULL,NULL,NULL);
-    if(s < 0 && errno != EAGAIN && errno != EINTR)
-      break;
-    if(s == 0)
-      continue; // Nothing arrived; probably just an ignored signal
+    // Packets left over from the last batch don't show up in select(), so take them first
+    fd_set fdset;
+    FD_ZERO(&fdset);
+    int pending = 0;
+    for(int i=0; i < Nfds; i++){
+      if(mrecv[i] != NULL && pkts_pending(mrecv[i])){
+	FD_SET(input_fd[i],&fdset);
+	pending++;
+      }
+    }
+    if(!pending){
+      // Wait for traffic to arrive
+      fdset = fdset_template;
+      int s = select(max_fd+1,&fdset,NULL,NULL,NULL);
+      if(s < 0 && errno != EAGAIN && errno != EINTR)
+	break;
+      if(s == 0)
+	continue; // Nothing arrived; probably just an ignored signal
+    }
 
     for(int fd_index = 0;fd_index < Nfds;fd_index++){
       if(input_fd[fd_index] == -1 || !FD_ISSET(input_fd[fd_index],&fdset))
 	continue;
 
-      unsigned char buffer[16384]; // Fix this
       socklen_t socksize = sizeof(sender);
-      int size = recvfrom(input_fd[fd_index],buffer,sizeof(buffer),0,&sender,&socksize);
-      if(size == -1){
+      struct packet * const pkt = recv_pkt(mrecv[fd_index],&sender,&socksize);
+      if(pkt == NULL){
 	if(errno != EINTR){ // Happens routinely
-	  perror("recvfrom");
+	  perror("recvmmsg");
 	  usleep(1000);
 	}
 	continue;
       }
+      unsigned char * const buffer = pkt->content;
+      int size = pkt->len;
       if(size < RTP_MIN_SIZE){
 	usleep(1000); // Avoid tight loop
 	continue; // Too small to be valid RTP
@@ -300,18 +319,22 @@ void *decode_task(void *arg){
   int ones = 0;
 
   while(1){
-    execute_filter_output(filter);    // Blocks until data appears
+    execute_filter_output(filter,0);    // Blocks until data appears
 
+    complex float mark_lo[filter->olen];
+    complex float space_lo[filter->olen];
+    block_osc(&mark,mark_lo,filter->olen);
+    block_osc(&space,space_lo,filter->olen);
     for(int n=0; n<filter->olen; n++){
 
       // Spin down by 1200 and 2200 Hz, accumulate each in boxcar (comb) filters
       // Mark and space each have in-phase and offset integrators for timing recovery
       float complex s;
-      s = filter->output.c[n] * step_osc(&mark);
+      s = filter->output.c[n] * mark_lo[n];
       mark_accum += s;
       mark_offset_accum += s;
 
-      s = filter->output.c[n] * step_osc(&space);
+      s = filter->output.c[n] * space_lo[n];
       space_accum += s;
       space_offset_accum += s;
 
@@ -31,7 +31,6 @@ struct pcmstream {
 };
 
 // Config constants
-int const Bufsize = 2048;
 float const Samprate = 48000;
 
 // Command line params
@@ -40,6 +39,7 @@ int Quiet;
 int Stereo;   // Force stereo output; otherwise output mono, downmixing if necessary
 
 int Input_fd = -1;
+struct mrecv *Mrecv;
 struct pcmstream *Pcmstream;
 int Sessions; // Session count - limit to 1 for now
 uint32_t Ssrc; // Requested SSRC
@@ -83,6 +83,10 @@ int main(int argc,char *argv[]){
 	    Mcast_address_text);
     exit(1);
   }
+  if((Mrecv = create_mrecv(Input_fd)) == NULL){
+    fprintf(stderr,"Can't allocate receive buffers\n");
+    exit(1);
+  }
 
 
   // audio input thread
@@ -91,15 +95,16 @@ int main(int argc,char *argv[]){
   while(1){
     struct sockaddr sender;
     socklen_t socksize = sizeof(sender);
-    unsigned char buffer[Bufsize];
-    int size = recvfrom(Input_fd,buffer,sizeof(buffer),0,&sender,&socksize);
-    if(size == -1){
+    struct packet * const pkt = recv_pkt(Mrecv,&sender,&socksize);
+    if(pkt == NULL){
       if(errno != EINTR){ // Happens routinely
-	perror("recvmsg");
+	perror("recvmmsg");
 	usleep(1000);
       }
       continue;
     }
+    unsigned char * const buffer = pkt->content;
+    int size = pkt->len;
     if(size < RTP_MIN_SIZE)
       continue; // Too small to be valid RTP
 
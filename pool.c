@@ -0,0 +1,157 @@
+// Fixed pool of worker threads running batches of independent tasks, with work stealing
+// The caller of run_pool() takes part and returns only when every task is done, so each batch
+// ends in a barrier. Only as many workers as there are tasks to share are woken
+// Copyright 2026, ka9q-radio contributors. GPL v3, see LICENSE
+#define _GNU_SOURCE 1
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "misc.h"
+#include "pool.h"
+
+// Take the next task from the front of a range, or with back set, the last one from the back
+// Returns -1 if it's empty
+static int take(struct range * const r,int const back){
+  unsigned long long old = atomic_load(&r->span);
+  while(1){
+    unsigned int const next = old & 0xffffffff;
+    unsigned int const end = old >> 32;
+    if(next >= end)
+      return -1;
+    unsigned long long const new = back ? (unsigned long long)(end - 1) << 32 | next : (unsigned long long)end << 32 | (next + 1);
+    if(atomic_compare_exchange_weak(&r->span,&old,new))
+      return back ? end - 1 : next;
+  }
+}
+
+// Work through our own range, then steal from the others' until there's nothing left anywhere
+static void work(struct pool * const pool,int const self){
+  int const participants = pool->participants;
+  int n;
+  while((n = take(&pool->range[self],0)) != -1)
+    (*pool->task)(pool->arg,n);
+
+  for(int i=1; i < participants; i++){
+    struct range * const victim = &pool->range[(self + i) % participants];
+    while((n = take(victim,1)) != -1)
+      (*pool->task)(pool->arg,n);
+  }
+}
+
+static void *worker(void *arg){
+  struct worker * const w = arg;
+  struct pool * const pool = w->pool;
+
+  pthread_setname(w->name);
+  while(1){
+    pthread_mutex_lock(&w->mutex);
+    while(!w->go && !pool->terminate)
+      pthread_cond_wait(&w->cond,&w->mutex);
+    w->go = 0;
+    pthread_mutex_unlock(&w->mutex);
+    if(pool->terminate)
+      break;
+
+    work(pool,w->index);
+    if(atomic_fetch_sub(&pool->busy,1) == 1){
+      pthread_mutex_lock(&pool->mutex);
+      pthread_cond_signal(&pool->done_cond);
+      pthread_mutex_unlock(&pool->mutex);
+    }
+  }
+  return NULL;
+}
+
+// Start a pool with 'workers' threads besides the caller, named name0, name1, ...
+// (so they can be given CPUs with add_thread_sched()). Zero is allowed, in which case
+// run_pool() just runs everything itself
+struct pool *create_pool(int const workers,char const *name){
+  assert(workers >= 0);
+  if(workers < 0)
+    return NULL;
+  struct pool * const pool = calloc(1,sizeof(*pool));
+  if(pool == NULL)
+    return NULL;
+  pool->workers = workers;
+  pool->worker = calloc(workers + 1,sizeof(*pool->worker));
+  if(posix_memalign((void **)&pool->range,64,(workers + 1) * sizeof(*pool->range)) != 0 || pool->worker == NULL){
+    free(pool->worker);
+    free(pool);
+    return NULL;
+  }
+  memset(pool->range,0,(workers + 1) * sizeof(*pool->range));
+  pthread_mutex_init(&pool->mutex,NULL);
+  pthread_cond_init(&pool->done_cond,NULL);
+  for(int i=1; i <= workers; i++){
+    struct worker * const w = &pool->worker[i];
+    w->pool = pool;
+    w->index = i;
+    snprintf(w->name,sizeof(w->name),"%s%d",name,i-1);
+    pthread_mutex_init(&w->mutex,NULL);
+    pthread_cond_init(&w->cond,NULL);
+  }
+  for(int i=1; i <= workers; i++)
+    pthread_create(&pool->worker[i].thread,NULL,worker,&pool->worker[i]);
+  return pool;
+}
+
+// Run task(arg,0) through task(arg,tasks-1) on the pool, returning when all are done
+// Each participant starts with an equal slice and steals from the back of the others' when it runs out
+// Only one thread at a time may call this on a given pool
+void run_pool(struct pool * const pool,int const tasks,void (* const task)(void *,int),void * const arg){
+  assert(pool != NULL && task != NULL);
+  if(tasks <= 0)
+    return;
+  int const participants = min(pool->workers + 1,tasks);
+  pool->task = task;
+  pool->arg = arg;
+  pool->participants = participants;
+  for(int i=0; i < participants; i++){
+    unsigned long long const next = (long)i * tasks / participants;
+    unsigned long long const end = (long)(i+1) * tasks / participants;
+    atomic_store(&pool->range[i].span,end << 32 | next);
+  }
+  atomic_store(&pool->busy,participants - 1);
+  for(int i=1; i < participants; i++){
+    struct worker * const w = &pool->worker[i];
+    pthread_mutex_lock(&w->mutex);
+    w->go = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+  }
+  work(pool,0);
+
+  // Barrier: wait for the workers still finishing tasks they took
+  if(atomic_load(&pool->busy) != 0){
+    pthread_mutex_lock(&pool->mutex);
+    while(atomic_load(&pool->busy) != 0)
+      pthread_cond_wait(&pool->done_cond,&pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+}
+
+void delete_pool(struct pool * const pool){
+  if(pool == NULL)
+    return;
+  for(int i=1; i <= pool->workers; i++){
+    struct worker * const w = &pool->worker[i];
+    pthread_mutex_lock(&w->mutex);
+    pool->terminate = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+  }
+  for(int i=1; i <= pool->workers; i++){
+    struct worker * const w = &pool->worker[i];
+    pthread_join(w->thread,NULL);
+    pthread_mutex_destroy(&w->mutex);
+    pthread_cond_destroy(&w->cond);
+  }
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->done_cond);
+  free(pool->range);
+  free(pool->worker);
+  free(pool);
+}
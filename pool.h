@@ -0,0 +1,43 @@
+// Fixed pool of worker threads running batches of independent tasks, with work stealing
+// Copyright 2026, ka9q-radio contributors. GPL v3, see LICENSE
+#ifndef _POOL_H
+#define _POOL_H 1
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+// Each participant's share of a batch: tasks next..end-1, packed in one word so that
+// the owner taking from the front and a thief taking from the back never both get the same one
+struct range {
+  _Atomic unsigned long long span; // end << 32 | next
+  char pad[64 - sizeof(unsigned long long)]; // Own cache line; they're hammered by different threads
+};
+
+struct worker {
+  struct pool *pool;
+  int index;            // 1..workers; the caller of run_pool() is participant 0
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int go;               // Set to start on a batch
+  char name[16];
+};
+
+struct pool {
+  int workers;             // Threads besides the caller of run_pool()
+  struct worker *worker;
+  struct range *range;     // workers+1, [0] belonging to the caller
+  int participants;        // In the current batch, including the caller
+  void (*task)(void *,int);
+  void *arg;
+  atomic_int busy;         // Workers not yet out of tasks in the current batch
+  pthread_mutex_t mutex;   // Only for sleeping on done_cond
+  pthread_cond_t done_cond;
+  int terminate;
+};
+
+struct pool *create_pool(int workers,char const *name);
+void run_pool(struct pool *,int tasks,void (*task)(void *arg,int n),void *arg);
+void delete_pool(struct pool *);
+
+#endif
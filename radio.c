@@ -7,6 +7,7 @@
 #include <limits.h>
 #include <pthread.h>
 #include <string.h>
+#include <ctype.h>
 #if defined(linux)
 #include <bsd/string.h>
 #endif
@@ -21,7 +22,9 @@
 #include "osc.h"
 #include "radio.h"
 #include "filter.h"
+#include "decimate.h"
 #include "status.h"
+#include "pool.h"
 
 
 // SDR alias keep-out region, i.e., stay between -(samprate/2 - IF_EXCLUDE) and (samprate/2 - IF_EXCLUDE)
@@ -30,32 +33,207 @@ const float IF_EXCLUDE = 0.95; // Assume decimation filters roll off above Fs/2
 // Preferred A/D sample rate; ignored by funcube but may be used by others someday
 const int ADC_samprate = 192000;
 
+// Resampler from a channel's decimated rate to the output rate, when they differ
+// It's flat over about the lower RESAMP_PASS of the decimated Nyquist band, so channels get at least that much room
+#define RESAMP_PASS 0.75
+#define RESAMP_TAPS 32      // Per polyphase branch
+#define RESAMP_CUTOFF 0.875 // -6 dB point, fraction of the lower Nyquist rate
+#define RESAMP_BETA 2       // Kaiser window, as in make_kaiser()
+
 // thread for first half of demodulator
 // Preprocessing of samples performed for all demodulators
 // Update power measurement
 // Pass to input of pre-demodulation filter
+// Tuning is no longer done here; each channel rotates the shared spectrum in downconvert()
+
+// List of channels, the primary first
+struct demod *Channels;
+pthread_mutex_t Channel_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Channels are demodulated by a fixed pool of threads, each block ending in a barrier
+// Held while the pool works on a block, so a channel can be taken out of it between blocks
+struct pool *Demod_pool;
+static pthread_mutex_t Block_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread long long Task_cpu; // CPU time this thread has spent on channels, ns
+
+// Demodulate the current block on every running channel, returning when all are done
+// Called by the input thread after each block goes through the forward FFT
+static void run_channel(void *arg,int n){
+  struct demod * const demod = ((struct demod **)arg)[n];
+  long long const start = thread_cputime();
+  (*Demodtab[demod->demod_type].demod)(demod);
+  long long const used = thread_cputime() - start;
+  demod->cpu_time[THREAD_DEMOD] += used;
+  Task_cpu += used;
+}
+
+void run_channels(void){
+  if(Demod_pool == NULL)
+    return; // Each has its own thread
+  pthread_mutex_lock(&Block_mutex);
+  pthread_mutex_lock(&Channel_mutex);
+  int count = 0;
+  for(struct demod *dp = Channels; dp != NULL; dp = dp->next)
+    count += dp->running;
+  struct demod *list[count + 1];
+  int n = 0;
+  for(struct demod *dp = Channels; dp != NULL; dp = dp->next)
+    if(dp->running)
+      list[n++] = dp;
+  pthread_mutex_unlock(&Channel_mutex);
+  run_pool(Demod_pool,n,run_channel,list);
+  pthread_mutex_unlock(&Block_mutex);
+}
+
+// Without a pool, each channel's demodulator runs in its own thread, waiting on the filter for each block
+static void *channel_thread(void *arg){
+  struct demod * const demod = arg;
+  struct demodtab const * const dt = &Demodtab[demod->demod_type];
+  char name[16];
+  int i;
+  for(i=0; i < sizeof(name)-1 && dt->name[i] != '\0'; i++)
+    name[i] = tolower(dt->name[i]);
+  name[i] = '\0';
+  pthread_setname(name);
+
+  if((*dt->start)(demod) != 0)
+    return NULL;
+  while(!demod->terminate){
+    long long const start = thread_cputime();
+    (*dt->demod)(demod);
+    demod->cpu_time[THREAD_DEMOD] += thread_cputime() - start;
+  }
+  (*dt->stop)(demod);
+  return NULL;
+}
 
 float const SCALE16 = 1./SHRT_MAX; // Scale signed 16-bit int to float in range -1, +1
 float const SCALE8 = 1./127;       // Scale signed 8-bit int to float in range -1, +1
 
+// Stand in for cnt lost samples with zeroes, to keep the sample count and block timing correct
+// May upset the I/Q DC offset and channel balance estimates, but hey you can't win 'em all
+void input_gap(struct demod * const demod,int cnt){
+  struct filter_in * const in = demod->filter.in;
+  demod->input.samples += cnt;
+  // Whole blocks of zeroes still carry real samples in their history (M-1 samples, more if partitioned)
+  // until it drains; after that every block is identical silence and the filter is just reset past them
+  int const drain = (filter_memory(in) + in->ilen - 1) / in->ilen;
+  int zero_blocks = 0;
+  while(cnt > 0){
+    if(demod->input.in_cnt == 0 && zero_blocks >= drain && cnt >= in->ilen){
+      // Every remaining whole block would be silence; skip them all at once
+      reset_filter_input(in,cnt / in->ilen);
+      run_channels();
+      cnt %= in->ilen;
+      continue;
+    }
+    int const chunk = min(cnt,(int)in->ilen - demod->input.in_cnt);
+    if(demod->input.in_cnt == 0){
+      demod->input.first = demod->input.arrival; // The zeroes became available when the gap was found
+      if(chunk == in->ilen)
+	zero_blocks++;
+    }
+    memset(in->input.c + demod->input.in_cnt,0,chunk * sizeof(*in->input.c));
+    demod->input.in_cnt += chunk;
+    cnt -= chunk;
+    if(demod->input.in_cnt == in->ilen){
+      // Run filter but freeze everything else
+      execute_filter_input(in);
+      demod->input.in_cnt = 0;
+      run_channels();
+    }
+  }
+}
+
+// Note the times of the block just handed to the filter, for the demodulators to pick up by block number,
+// and time the input stages. Blocks of zeroes standing in for lost samples aren't timed
+static void stamp_block(struct demod * const demod){
+  long long const ready = latency_clock();
+  unsigned int const blocknum = atomic_load(&demod->filter.in->blocknum);
+  struct blocktime * const bt = &demod->input.blocktime[blocknum & (BLOCKTIMES-1)];
+  bt->first = demod->input.first;
+  bt->last = demod->input.arrival;
+  bt->dequeue = demod->input.dequeue;
+  bt->ready = ready;
+  atomic_store_explicit(&bt->blocknum,blocknum,memory_order_release);
+
+  demod->cpu_time[THREAD_PROC_SAMPLES] = thread_cputime() - Task_cpu; // Not counting its share of the channels
+  record_latency(&demod->latency[LAT_FILL],bt->last - bt->first);
+  record_latency(&demod->latency[LAT_QUEUE],bt->dequeue - bt->last);
+  record_latency(&demod->latency[LAT_FILTER],ready - bt->dequeue);
+}
+
+// Time the output stages of the block a channel just demodulated, given when its audio
+// was handed over and when it was sent. Called by the demodulator thread
+void output_latency(struct demod * const demod,long long const done,long long const sent){
+  struct demod const * const input = demod->primary ? demod->primary : demod;
+  if(demod->filter.out == NULL)
+    return;
+  unsigned int const blocknum = demod->filter.out->blocknum;
+  struct blocktime const * const bt = &input->input.blocktime[blocknum & (BLOCKTIMES-1)];
+  if(atomic_load_explicit(&bt->blocknum,memory_order_acquire) != blocknum)
+    return; // Not stamped yet, a gap, or long since overwritten
+  long long const first = bt->first;
+  long long const ready = bt->ready;
+  record_latency(&demod->latency[LAT_DEMOD],done - ready);
+  record_latency(&demod->latency[LAT_SEND],sent - done);
+  record_latency(&demod->latency[LAT_TOTAL],sent - first);
+}
+
+// Convert cnt I/Q samples of payload type 'type' (IQ_PT or IQ_PT8) into the filter input,
+// running the input half of the filter each time a block fills
+// Whole runs go straight into the filter input buffer, each ending at the data's end or the block boundary
+void input_samples(struct demod * const demod,void const *data,int type,int cnt){
+  struct filter_in * const in = demod->filter.in;
+  unsigned char const *dp = data;
+  demod->input.samples += cnt;
+
+  while(cnt > 0){
+    int const chunk = min(cnt,(int)in->ilen - demod->input.in_cnt);
+    complex float * const out = in->input.c + demod->input.in_cnt;
+    if(demod->input.in_cnt == 0)
+      demod->input.first = demod->input.arrival;
+
+    // Scale down according to analog gain from SDR front end
+    switch(type){
+    default: // shuts up lint
+    case IQ_PT:
+      demod->input.block_energy += convert_iq16(out,(signed short const *)dp,chunk,SCALE16 * demod->sdr.gain_factor);
+      dp += chunk * 2 * sizeof(signed short);
+      break;
+    case IQ_PT8:
+      demod->input.block_energy += convert_iq8(out,(signed char const *)dp,chunk,SCALE8 * demod->sdr.gain_factor);
+      dp += chunk * 2 * sizeof(signed char);
+      break;
+    }
+    demod->input.in_cnt += chunk;
+    cnt -= chunk;
+    if(demod->input.in_cnt == in->ilen){
+      // Filter buffer is full, execute it
+      execute_filter_input(in);
+      stamp_block(demod);
+      update_noise(demod);
+      demod->input.block_energy *= 0.5; // Scale for two components per complex sample
+      demod->sig.if_power = demod->input.block_energy / demod->input.in_cnt; // Raw A/D level, without analog gain adjustment
+      demod->input.in_cnt = 0;
+      run_channels();
+    } // Every FFT block
+  }
+}
+
 void *proc_samples(void *arg){
   // gain and phase balance coefficients
   assert(arg);
   pthread_setname("procsamp");
 
   struct demod *demod = (struct demod *)arg;
-  float complex block_energy = 0;
-  int in_cnt = 0;
   struct packet *pkt = NULL;
 
   while(1){
-    // Pull next I/Q data packet off queue
-    pthread_mutex_lock(&demod->input.qmutex);
-    while(demod->input.queue == NULL)
-      pthread_cond_wait(&demod->input.qcond,&demod->input.qmutex);
-    pkt = demod->input.queue;
-    demod->input.queue = pkt->next;
-    pthread_mutex_unlock(&demod->input.qmutex);
+    // Next I/Q data packet in sequence from the ring
+    pkt = get_pkt(demod->input.ring);
+    demod->input.arrival = pkt->arrival;
+    demod->input.dequeue = latency_clock();
 
     int sampcount;
 
@@ -76,76 +254,17 @@ void *proc_samples(void *arg){
     int time_step = rtp_process(&demod->input.rtp,&pkt->rtp,sampcount);
     if(time_step < 0 || time_step > 192000){
       // Old samples, or too big a jump; drop. Shouldn't happen if sequence number isn't old
-      free(pkt); pkt = NULL;
+      release_pkt(demod->input.ring); pkt = NULL;
       continue;
     } else if(time_step > 0){
-      // Samples were lost. Inject enough zeroes to keep the sample count and LO phase correct
+      // Samples were lost. Inject enough zeroes to keep the sample count and block timing correct
       // Arbitrary 1 sec limit just to keep things from blowing up
       // Good enough for the occasional lost packet or two
-      // May upset the I/Q DC offset and channel balance estimates, but hey you can't win 'em all
       // Note: we don't use marker bits since we don't suppress silence
-      demod->input.samples += time_step;
-      for(int i=0;i < time_step; i++){
-	demod->filter.in->input.c[in_cnt++] = 0;
-	// Keep the LOs running
-	(void) step_osc(&demod->second_LO);
-	(void) step_osc(&demod->doppler);
-
-	if(in_cnt == demod->filter.in->ilen){
-	  // Run filter but freeze everything else?
-	  execute_filter_input(demod->filter.in);
-	  in_cnt = 0;
-	}
-      }
+      input_gap(demod,time_step);
     }
-    // Process individual samples
-    signed short *sp = (signed short *)pkt->data;
-    signed char *cp = (signed char *)pkt->data;
-    demod->input.samples += sampcount;
-
-    while(sampcount--){
-
-      float samp_i,samp_q;
-
-      switch(pkt->rtp.type){
-      default: // shuts up lint
-      case IQ_PT:
-	samp_i = *sp++ * SCALE16;
-	samp_q = *sp++ * SCALE16;
-	break;
-      case IQ_PT8:
-	samp_i = *cp++ * SCALE8;
-	samp_q = *cp++ * SCALE8;
-	break;
-      }
-      // Scale down according to analog gain from SDR front end
-      complex float samp = CMPLXF(samp_i,samp_q) * demod->sdr.gain_factor;
-      block_energy += cnrmf(samp);
-
-#if 0
-      // Experimental notch filter
-      if(demod->nf)
-	samp = notch(demod->nf,samp);
-#endif
-
-      // Apply 2nd LO
-      samp *= step_osc(&demod->second_LO);
-      
-      // Apply Doppler if active
-      if(demod->doppler.freq != 0)
-	samp *= step_osc(&demod->doppler);
-
-      // Accumulate in filter input buffer
-      demod->filter.in->input.c[in_cnt++] = samp;
-      if(in_cnt == demod->filter.in->ilen){
-	// Filter buffer is full, execute it
-	execute_filter_input(demod->filter.in);
-	block_energy *= 0.5; // Scale for two components per complex sample
-	demod->sig.if_power = block_energy / in_cnt; // Raw A/D level, without analog gain adjustment
-	in_cnt = 0;
-      } // Every FFT block
-    } // for each sample in I/Q packet
-    free(pkt); pkt = NULL;
+    input_samples(demod,pkt->data,pkt->rtp.type,sampcount);
+    release_pkt(demod->input.ring); pkt = NULL;
   } // end of main loop
 }
 
@@ -210,6 +329,13 @@ double set_freq(struct demod * const demod,double const f,double new_lo2){
   assert(f != 0);
 
   demod->tune.freq = f;
+  if(demod->primary != NULL){
+    // Secondary channels share the primary's front end, so they can't retune LO1
+    new_lo2 = -(f - get_first_LO(demod->primary));
+    if(LO2_in_range(demod,new_lo2,0))
+      set_second_LO(demod,new_lo2);
+    return f;
+  }
 
   // No alias checking on explicitly provided lo2
   if(isnan(new_lo2) || !LO2_in_range(demod,new_lo2,0)){
@@ -287,6 +413,7 @@ int LO2_in_range(struct demod * const demod,double const f,int const avoid_alias
 
 // Set second local oscillator (the one in software)
 // the caller must avoid aliasing, e.g., with LO2_in_range()
+// It is no longer stepped per sample; downconvert() implements it by rotating the channel's FFT bins
 double set_second_LO(struct demod * const demod,double const second_LO){
   assert(demod != NULL);
   if(demod == NULL)
@@ -316,9 +443,81 @@ double get_shift(struct demod * const demod){
 }
 
 
+// Stop a channel's demodulator, whether it's run by the pool or has its own thread
+// Returns once it has freed its filter output and state
+void stop_demod(struct demod * const demod){
+  assert(demod != NULL);
+  if(demod->demod_thread != (pthread_t)0){
+    // It stops itself on its next block
+    demod->terminate = 1;
+    pthread_join(demod->demod_thread,NULL);
+    demod->demod_thread = (pthread_t)0;
+    demod->terminate = 0;
+  }
+  if(demod->running){
+    // Out of the pool, then no block can be in progress on it
+    pthread_mutex_lock(&Block_mutex);
+    demod->running = 0;
+    pthread_mutex_unlock(&Block_mutex);
+    (*Demodtab[demod->demod_type].stop)(demod);
+  }
+}
+
+// Lowest sample rate that holds the channel's passband after the post-detection shift
+// FM keeps the output rate, since its audio filters and PL tone detector are designed for it
+static float channel_min_rate(struct demod const * const demod){
+  if(demod->demod_type == FM_DEMOD)
+    return demod->output.samprate;
+  float const edge = max(fabsf(demod->filter.low),fabsf(demod->filter.high)) + fabs(demod->tune.shift);
+  return 2 * edge / RESAMP_PASS;
+}
+
+// Pick the channel's decimation, so its filter output and demodulator run at the lowest rate
+// the shared filter allows for its passband, and a resampler from there to the output rate
+static int plan_channel(struct demod * const demod){
+  int const samprate = demod->input.samprate;
+  float const min_rate = channel_min_rate(demod);
+  int const decimate = plan_decimate(samprate,demod->filter.L,demod->filter.M,min_rate,demod->output.samprate);
+  if(decimate < 1){
+    fprintf(stderr,"Can't decimate %'d Hz to at least %'.0f Hz with L = %d, M = %d\n",samprate,min_rate,demod->filter.L,demod->filter.M);
+    return -1;
+  }
+  demod->filter.decimate = decimate;
+  delete_resampler(demod->output.resampler);
+  demod->output.resampler = NULL;
+  int const rate = samprate / decimate;
+  if(rate != demod->output.samprate
+     && (demod->output.resampler = create_resampler(demod->output.samprate,rate,RESAMP_TAPS,RESAMP_CUTOFF,RESAMP_BETA)) == NULL){
+    fprintf(stderr,"Can't resample %'d Hz to %'d Hz\n",rate,demod->output.samprate);
+    return -1;
+  }
+  return 0;
+}
+
+// Change the passband edges; NAN leaves one as it is
+// If they no longer fit in the channel's sample rate, the demodulator is restarted at one they do
+int set_passband(struct demod * const demod,float const low,float const high){
+  assert(demod != NULL);
+  if(demod == NULL)
+    return -1;
+  if(!isnan(low))
+    demod->filter.low = low;
+  if(!isnan(high))
+    demod->filter.high = high;
+  if(demod->input.samprate / demod->filter.decimate < min(channel_min_rate(demod),(float)demod->output.samprate))
+    return set_mode(demod,demod->mode,0);
+
+  float const samptime = demod->filter.decimate / (float)demod->input.samprate;
+  if(demod->filter.out){
+    demod->filter.out->min_phase = demod->filter.min_phase;
+    set_filter(demod->filter.out,samptime*demod->filter.low,samptime*demod->filter.high,demod->filter.kaiser_beta);
+  }
+  return 0;
+}
+
 // Set major operating mode
-// This kills the current demodulator thread, sets up the predetection filter
-// and other demodulator parameters, and starts the appropriate demodulator thread
+// This stops the current demodulator, sets up the predetection filter
+// and other demodulator parameters, and starts the appropriate demodulator
 int set_mode(struct demod * const demod,const char * const mode,int const defaults){
   assert(demod != NULL);
   if(demod == NULL)
@@ -332,10 +531,7 @@ int set_mode(struct demod * const demod,const char * const mode,int const defaul
   if(mp == &Modes[Nmodes])
     return -1; // Unregistered mode
 
-  // Kill current demod thread, if any, to cause clean exit
-  demod->terminate = 1;
-  pthread_join(demod->demod_thread,NULL); // Wait for it to finish
-  demod->terminate = 0;
+  stop_demod(demod);
 
   // if the mode argument points to demod->mode, avoid the copy; can cause an abort
   if(demod->mode != mode)
@@ -357,69 +553,370 @@ int set_mode(struct demod * const demod,const char * const mode,int const defaul
 
   demod->opt.flat = mp->flat;
   demod->filter.isb = mp->isb;
+  demod->filter.min_phase = mp->min_phase;
   demod->output.channels = mp->channels;
   demod->opt.pll = mp->pll;
   demod->opt.square = mp->square;
   demod->agc.attack_rate = mp->attack_rate;
   demod->agc.recovery_rate = mp->recovery_rate;
   demod->agc.hangtime = mp->hangtime;
-  
+
+  if(plan_channel(demod) != 0)
+    return -1;
+  demod->filter.post_delay = 0; // Until the demodulator says otherwise
   set_shift(demod,demod->tune.shift);
 
   // Might now be out of range because of change in filter passband
   set_freq(demod,get_freq(demod),NAN);
 
-  pthread_create(&demod->demod_thread,NULL,Demodtab[mp->demod_type].demod,demod);
+  if(Demod_pool == NULL){
+    pthread_create(&demod->demod_thread,NULL,channel_thread,demod);
+    return 0;
+  }
+  // Started here, so filter planning doesn't hold up the other channels
+  if((*Demodtab[mp->demod_type].start)(demod) != 0)
+    return -1;
+  pthread_mutex_lock(&Block_mutex);
+  demod->running = 1;
+  pthread_mutex_unlock(&Block_mutex);
   return 0;
 }      
 
 
 
-// Compute noise spectral density - experimental, my algorithm
+// Noise spectral density estimate - experimental, my algorithm
 // The problem is telling signal from noise
-// Heuristic: first average all bins outside the bandwidth
-// Then recompute the average, tossing bins > 3 dB above the previous average
+// Heuristic: average all bins outside the bandwidth, tossing bins > 3 dB above the noise floor
+// found by the previous pass
 // Hopefully this will get rid of any signals from the noise estimate
-float const compute_n0(struct demod const * const demod){
+
+// The bins are summed in slices by the input thread after each forward FFT,
+// only one stripe of them per block since the noise floor doesn't move fast.
+// Each bin is compared with the floor found so far as it goes, so only the sums of those
+// under the threshold have to be kept and a channel just adds up the slices outside its passband.
+// The first call does them all, against the average of the whole spectrum, so the estimate is usable right away
+// Blocks standing in for lost samples are all zeroes, so don't call this for them
+
+// Average of exponentially distributed noise power below twice its mean, relative to the mean: (1-3/e^2)/(1-1/e^2)
+static float const Noise_truncation = 0.687;
+
+void update_noise(struct demod * const demod){
   assert(demod != NULL);
-  if(demod == NULL || demod->filter.in == NULL)
-    return NAN;
-  
-  struct filter_in const *f = demod->filter.in;
+  struct filter_in const * const f = demod->filter.in;
+  struct noise * const noise = &demod->input.noise;
   int const N = f->ilen + f->impulse_length - 1;
-  float power_spectrum[N];
-  
-  // Compute smoothed power spectrum
-  // There will be some spectral leakage because the convolution FFT we're using is unwindowed
+  if(noise->N != N){
+    atomic_store(&noise->valid,0);
+    noise->N = N;
+    noise->segments = min(N,NOISE_SEGMENTS);
+    noise->stripe = 0;
+  }
+  int const valid = atomic_load(&noise->valid);
+  int const first = valid ? noise->stripe * noise->segments / NOISE_STRIPES : 0;
+  int const last = valid ? (noise->stripe + 1) * noise->segments / NOISE_STRIPES : noise->segments;
+  noise->stripe = (noise->stripe + 1) % NOISE_STRIPES;
+
+  if(!valid){
+    // Nothing to compare with yet, so start from the average of this spectrum, signals and all
+    double total = 0;
+    for(int n=0; n < N; n++)
+      total += cnrmf(f->fdomain[n]);
+    noise->floor = total / N;
+  }
+  float const threshold = 2 * noise->floor; // +3dB
+
+  // Readers retry if they see seq odd or changed; the fence keeps our stores after the first increment
+  atomic_fetch_add_explicit(&noise->seq,1,memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
   // Includes both real and imaginary components, so this will have to be divided by 2 to get 0dBFS convention
-  for(int n=0;n<N;n++)
-    power_spectrum[n] = cnrmf(f->fdomain[n]);
-
-  // compute average energy outside passband, then iterate computing a new average that
-  // omits bins > 3dB above the previous average. This should pick up only the noise
-  float avg_n = INFINITY;
-  for(int iter=0;iter<2;iter++){
-    int noisebins = 0;
-    float new_avg_n = 0;
-    for(int n=0;n<N;n++){
-      float f;
-      if(n <= N/2)
-	f = (float)(n * demod->input.samprate) / N;
-      else
-	f = (float)((n-N) * demod->input.samprate) / N;
-      
-      if(f >= demod->filter.low && f <= demod->filter.high)
-	continue; // Avoid passband
-      
-      float const s = power_spectrum[n];
-      if(s < avg_n * 2){ // +3dB threshold
-	new_avg_n += s;
-	noisebins++;
+  for(int s=first; s < last; s++){
+    int const start = (long)s * N / noise->segments;
+    int const end = (long)(s+1) * N / noise->segments;
+    float energy = 0;
+    int bins = 0;
+    for(int n=start; n < end; n++){
+      float const e = cnrmf(f->fdomain[n]);
+      if(e < threshold){
+	energy += e;
+	bins++;
       }
     }
-    new_avg_n /= noisebins;
-    avg_n = new_avg_n;
+    atomic_store_explicit(&noise->energy[s],energy,memory_order_relaxed);
+    atomic_store_explicit(&noise->bins[s],bins,memory_order_relaxed);
+  }
+  atomic_fetch_add_explicit(&noise->seq,1,memory_order_release);
+
+  // The floor for next time. What's left under the threshold averages low, so scale it back up
+  // or the threshold would creep down; the signals the first threshold let in drop out the same way
+  double energy = 0;
+  long bins = 0;
+  for(int s=0; s < noise->segments; s++){
+    energy += atomic_load_explicit(&noise->energy[s],memory_order_relaxed);
+    bins += atomic_load_explicit(&noise->bins[s],memory_order_relaxed);
   }
+  if(bins > 0)
+    noise->floor = energy / bins / Noise_truncation;
+  atomic_store(&noise->valid,1);
+}
+
+// Noise power per Hz seen by this channel, normalized to 0dBFS, from the slices kept by update_noise()
+// A secondary channel's passband is offset by its bin rotation
+// The slices it touches are found again only when the passband, the tuning or the spectrum changes
+float const compute_n0(struct demod * const demod){
+  assert(demod != NULL);
+  if(demod == NULL)
+    return NAN;
+  struct demod const * const input = demod->primary ? demod->primary : demod;
+  struct noise const * const noise = &input->input.noise;
+  if(!atomic_load(&noise->valid))
+    return NAN;
+
+  int const N = noise->N;
+  int const segments = noise->segments;
+  struct noise_mask * const mask = &demod->filter.noise_mask;
+  if(mask->N != N || mask->segments != segments || mask->rotate != demod->filter.rotate
+     || mask->low != demod->filter.low || mask->high != demod->filter.high){
+    mask->N = N;
+    mask->segments = segments;
+    mask->rotate = demod->filter.rotate;
+    mask->low = demod->filter.low;
+    mask->high = demod->filter.high;
+    float const bins_per_hz = (float)N / demod->input.samprate;
+    int const low = floorf(demod->filter.low * bins_per_hz) + demod->filter.rotate;
+    int const high = ceilf(demod->filter.high * bins_per_hz) + demod->filter.rotate;
+    if(high - low >= N){
+      mask->first = 0;
+      mask->span = segments; // Nothing outside the passband
+    } else {
+      int const low_bin = ((low % N) + N) % N;
+      int const high_bin = ((high % N) + N) % N;
+      mask->first = (long)low_bin * segments / N;
+      mask->span = ((long)high_bin * segments / N - mask->first + segments) % segments;
+    }
+  }
+  if(mask->span >= segments - 1)
+    return NAN;
+
+  // Every slice from just after the passband round to just before it
+  float energy;
+  long bins;
+  unsigned int seq;
+  do {
+    seq = atomic_load_explicit(&noise->seq,memory_order_acquire);
+    energy = 0;
+    bins = 0;
+    for(int i=mask->span+1; i < segments; i++){
+      int s = mask->first + i;
+      if(s >= segments)
+	s -= segments;
+      energy += atomic_load_explicit(&noise->energy[s],memory_order_relaxed);
+      bins += atomic_load_explicit(&noise->bins[s],memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+  } while((seq & 1) || seq != atomic_load_explicit(&noise->seq,memory_order_relaxed));
+  if(bins == 0)
+    return NAN;
   // return noise power per Hz, normalized to 0dBFS
-  return avg_n / (2.0*N*demod->input.samprate);
+  return energy / bins / (2.0*N*demod->input.samprate);
+}
+
+// Tune the two sidebands of a split ISB filter output by the same oscillator, then cross conjugate
+// them as the filter would have: the lower sideband onto I, the upper onto Q
+// Done after tuning, since the split has to fall exactly on the carrier, not on the nearest bin
+static void tune_isb(struct osc * const osc,complex float * const upper,complex float const * const lower,int const cnt){
+  for(int i=0; i < cnt; i += 256){
+    int const n = min(256,cnt - i);
+    complex float phasors[n];
+    block_osc(osc,phasors,n);
+    for(int j=0; j < n; j++){
+      complex float const u = upper[i+j] * phasors[j];
+      complex float const l = lower[i+j] * phasors[j];
+      upper[i+j] = CMPLXF(2 * crealf(l),2 * cimagf(u));
+    }
+  }
+}
+
+// Run the output half of a channel's pre-detection filter
+// Each channel is tuned by rotating the shared input spectrum by the FFT bin nearest its
+// second LO plus Doppler, leaving only a sub-bin residual for a fine oscillator at the output sample rate
+// Retuning therefore costs nothing per input sample
+int downconvert(struct demod * const demod){
+  assert(demod != NULL);
+  struct filter_out * const filter = demod->filter.out;
+  assert(filter != NULL);
+
+  struct filter_in const * const master = filter->master;
+  int const N = master->ilen + master->impulse_length - 1;
+  int const N_dec = N / filter->decimate;
+
+  // Carrier offset in the input spectrum, cycles/sample at the input rate
+  pthread_mutex_lock(&demod->doppler.mutex);
+  double const doppler = demod->doppler.freq;
+  double const doppler_rate = demod->doppler.rate;
+  // Advance the Doppler frequency over this block for next time
+  demod->doppler.freq += doppler_rate * master->ilen;
+  pthread_mutex_unlock(&demod->doppler.mutex);
+  double const offset = -(demod->second_LO.freq + doppler);
+  unsigned int const last_block = filter->blocknum;
+
+  int rotate = lrint(offset * N);
+  int const in_range = abs(rotate) + N_dec/2 < N/2; // Would our passband wrap around the input Nyquist?
+  if(!in_range)
+    rotate = 0;
+  demod->filter.rotate = rotate;
+  int const r = execute_filter_output(filter,rotate);
+  unsigned int const blocks = filter->blocknum - last_block;
+  if(blocks > 1){
+    // The input filter skipped over a gap in one step; catch the Doppler and the output clock
+    // up over the blocks it stood for. This one's silence is sent as usual
+    if(doppler_rate != 0){
+      pthread_mutex_lock(&demod->doppler.mutex);
+      demod->doppler.freq += doppler_rate * master->ilen * (blocks - 1);
+      pthread_mutex_unlock(&demod->doppler.mutex);
+    }
+    skip_output(demod,(long long)(blocks - 1) * filter->olen);
+  }
+  if(!in_range){
+    // Tuned outside the input band; be silent until we come back
+    // Keep the fine oscillator's phase running as if we hadn't stopped
+    memset(filter->output.c,0,filter->olen * sizeof(*filter->output.c));
+    advance_osc(&demod->fine,filter->olen);
+    return r;
+  }
+  // The residual is at most half a bin, so don't bother moving the filter edges
+  double const fine = -(offset - (double)rotate / N) * filter->decimate;
+  double const fine_rate = doppler_rate * filter->decimate * filter->decimate;
+  if(fine != demod->fine.freq || fine_rate != demod->fine.rate)
+    set_osc(&demod->fine,fine,fine_rate);
+  if(filter->out_type == CROSS_CONJ && filter->lower != NULL)
+    tune_isb(&demod->fine,filter->output.c,filter->lower,filter->olen);
+  else if(fine != 0 && filter->out_type == COMPLEX)
+    mix_osc(&demod->fine,filter->output.c,filter->olen);
+  return r;
+}
+
+// Create a secondary channel sharing the primary's input, front end, filter master and output sockets
+// Its own Doppler and second LO start at zero
+// The caller then sets its frequency and starts it with set_mode()
+struct demod *create_channel(struct demod * const primary,uint32_t const ssrc){
+  assert(primary != NULL);
+  if(primary == NULL || primary->filter.in == NULL || primary->input.samprate == 0)
+    return NULL;
+
+  struct demod * const demod = calloc(1,sizeof(*demod));
+  if(demod == NULL)
+    return NULL;
+
+  // The output socket is shared, but each channel thread needs its own transmit queue
+  struct msend * const msend = create_msend(primary->output.fd,0,PCM_PKTSIZE);
+  if(msend == NULL){
+    free(demod);
+    return NULL;
+  }
+  // Start from nothing and take only what a channel inherits from the primary: its share of the
+  // input, front end limits, mode and filter parameters and output addresses. Copying the whole
+  // struct would race with the primary's demodulator and copy its mutexes, maybe while held
+  pthread_mutex_init(&demod->sdr.status_mutex,NULL);
+  pthread_cond_init(&demod->sdr.status_cond,NULL);
+  pthread_mutex_init(&demod->fine.mutex,NULL);
+  pthread_mutex_init(&demod->shift.mutex,NULL);
+  pthread_mutex_init(&demod->second_LO.mutex,NULL);
+  pthread_mutex_init(&demod->doppler.mutex,NULL);
+  demod->primary = primary;
+
+  pthread_mutex_lock(&primary->sdr.status_mutex);
+  demod->sdr.status = primary->sdr.status;
+  pthread_mutex_unlock(&primary->sdr.status_mutex);
+
+  pthread_mutex_lock(&Channel_mutex);
+  demod->input.samprate = primary->input.samprate;
+  demod->sdr.calibration = primary->sdr.calibration;
+  demod->sdr.min_IF = primary->sdr.min_IF;
+  demod->sdr.max_IF = primary->sdr.max_IF;
+  demod->sdr.imbalance = primary->sdr.imbalance;
+  demod->sdr.gain_factor = primary->sdr.gain_factor;
+
+  demod->tune.lock = primary->tune.lock;
+  demod->tune.freq = primary->tune.freq;
+  demod->tune.step = primary->tune.step;
+  demod->tune.item = primary->tune.item;
+  demod->tune.shift = NAN;
+
+  demod->filter.in = primary->filter.in;
+  demod->filter.L = primary->filter.L;
+  demod->filter.M = primary->filter.M;
+  demod->filter.partitions = primary->filter.partitions;
+  demod->filter.interpolate = primary->filter.interpolate;
+  demod->filter.decimate = primary->filter.decimate;
+  demod->filter.kaiser_beta = primary->filter.kaiser_beta;
+  demod->filter.isb = primary->filter.isb;
+  demod->filter.min_phase = primary->filter.min_phase;
+  demod->filter.low = demod->filter.high = NAN; // Take them from the mode table
+
+  demod->demod_type = primary->demod_type;
+  strlcpy(demod->mode,primary->mode,sizeof(demod->mode));
+  demod->opt = primary->opt;
+  demod->agc = primary->agc;
+  demod->sig.n0 = NAN;
+
+  demod->output.samprate = primary->output.samprate;
+  demod->output.channels = primary->output.channels;
+  strlcpy(demod->output.dest_address_text,primary->output.dest_address_text,sizeof(demod->output.dest_address_text));
+  demod->output.source_address = primary->output.source_address;
+  demod->output.dest_address = primary->output.dest_address;
+  demod->output.fd = primary->output.fd;
+  demod->output.rtcp_fd = primary->output.rtcp_fd;
+  demod->output.status_fd = primary->output.status_fd;
+  demod->output.pcm_file = primary->output.pcm_file;
+  demod->output.rtp.ssrc = ssrc;
+  demod->output.msend = msend;
+
+  // Append to the list
+  struct demod *dp;
+  for(dp = Channels; dp->next != NULL; dp = dp->next)
+    ;
+  dp->next = demod;
+  pthread_mutex_unlock(&Channel_mutex);
+  return demod;
+}
+
+// Find channel by its output SSRC
+struct demod *lookup_channel(uint32_t const ssrc){
+  struct demod *demod;
+  pthread_mutex_lock(&Channel_mutex);
+  for(demod = Channels; demod != NULL; demod = demod->next){
+    if(demod->output.rtp.ssrc == ssrc)
+      break;
+  }
+  pthread_mutex_unlock(&Channel_mutex);
+  return demod;
+}
+
+// Stop and delete a secondary channel
+// Must only be called from the thread that creates channels, since the pointer is used after lookup
+int delete_channel(struct demod * const demod){
+  if(demod == NULL || demod->primary == NULL)
+    return -1; // The primary can't be deleted
+
+  pthread_mutex_lock(&Channel_mutex);
+  struct demod **dpp;
+  for(dpp = &Channels; *dpp != NULL && *dpp != demod; dpp = &(*dpp)->next)
+    ;
+  if(*dpp != NULL)
+    *dpp = demod->next;
+  pthread_mutex_unlock(&Channel_mutex);
+
+  stop_demod(demod);
+  pthread_mutex_destroy(&demod->sdr.status_mutex);
+  pthread_cond_destroy(&demod->sdr.status_cond);
+  pthread_mutex_destroy(&demod->fine.mutex);
+  pthread_mutex_destroy(&demod->shift.mutex);
+  pthread_mutex_destroy(&demod->second_LO.mutex);
+  pthread_mutex_destroy(&demod->doppler.mutex);
+  free(demod->output.state);
+  free(demod->output.latency_view);
+  delete_resampler(demod->output.resampler);
+  delete_msend(demod->output.msend);
+  free(demod);
+  return 0;
 }
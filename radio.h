@@ -1,13 +1,14 @@
 // $Id: radio.h,v 1.81 2018/12/05 07:08:16 karn Exp $
 // Internal structures and functions of the 'radio' program
-// Nearly all internal state is in the 'demod' structure
-// More than one can exist in the same program,
-// but so far it seems easier to just run separate instances of the 'radio' program.
+// Nearly all internal state is in the 'demod' structure, one per channel
+// The primary channel owns the I/Q input, the front end and the forward half of the pre-detection filter;
+// secondary channels created at run time share them, each with its own frequency, mode and output SSRC
 // Copyright 2018, Phil Karn, KA9Q
 #ifndef _RADIO_H
 #define _RADIO_H 1
 
 #include <pthread.h>
+#include <stdio.h>
 #include <complex.h>
 #undef I
 
@@ -16,6 +17,71 @@
 #include "sdr.h"
 #include "multicast.h"
 #include "osc.h"
+#include "latency.h"
+
+struct state;
+struct pool;
+struct demod;
+struct resampler;
+
+// Stages of the pipeline whose latency is measured, in order; see status.h
+enum latency_stage {
+  LAT_FILL,    // Block filling with samples
+  LAT_QUEUE,   // Socket and packet ring
+  LAT_FILTER,  // Sample conversion and forward FFT
+  LAT_DEMOD,   // Inverse FFT and demodulation
+  LAT_SEND,    // Audio to the network
+  LAT_TOTAL,   // First sample in to audio out
+  LAT_STAGES,
+};
+
+// Noise floor of the shared input spectrum, kept by the input thread for every channel's compute_n0()
+// The spectrum is cut into NOISE_SEGMENTS equal slices of bins, and one stripe of slices
+// is brought up to date after each block, so a full sweep takes NOISE_STRIPES blocks
+// Bins more than 3 dB above the noise floor are left out as signals as each slice is summed,
+// so a carrier never raises its slice's share however many bins a slice holds
+// Channel threads may read the slices while they change, so they're published under a sequence lock
+#define NOISE_SEGMENTS 1024
+#define NOISE_STRIPES 16
+struct noise {
+  int N;                         // Bins in the spectrum
+  int segments;                  // Slices in use, at most NOISE_SEGMENTS
+  int stripe;                    // Next stripe to refresh
+  float floor;                   // Mean noise energy per bin, which sets the threshold; input thread only
+  atomic_uint seq;               // Odd while the slices below are being changed
+  atomic_int valid;              // Set once every slice has been filled
+  _Atomic float energy[NOISE_SEGMENTS]; // Energy of the bins in each slice under the threshold
+  atomic_int bins[NOISE_SEGMENTS];      // How many of them there were
+};
+
+// The slices a channel's passband touches, found again only when what they depend on changes
+struct noise_mask {
+  float low,high;   // Passband, tuning and spectrum they were found for
+  int rotate;
+  int N,segments;
+  int first,span;   // First through first+span mod segments
+};
+
+// Threads whose CPU time is reported; see status.h
+// The demodulator may be run by the pool rather than its own thread; its time is then what its blocks took
+enum thread_id {
+  THREAD_RTP_RECV,
+  THREAD_PROC_SAMPLES,
+  THREAD_DEMOD,
+  THREAD_PL,      // FM only, part of the demodulator's blocks
+  THREAD_STATUS,
+  THREADS,
+};
+
+// When the samples of a recent filter block came and went, CLOCK_MONOTONIC ns
+#define BLOCKTIMES 16 // Must be power of 2
+struct blocktime {
+  long long first;       // Arrival of the packet with the block's first sample
+  long long last;        // Arrival of the packet completing it
+  long long dequeue;     // That packet leaving the ring
+  long long ready;       // Forward FFT done
+  atomic_uint blocknum;  // Filter block number these are for, stored last
+};
 
 enum demod_type {
   LINEAR_DEMOD = 0,     // Linear demodulation, i.e., everything else: SSB, CW, DSB, CAM, IQ
@@ -23,10 +89,14 @@ enum demod_type {
   FM_DEMOD,             // Frequency demodulation
 };
 
+// A demodulator is started on a channel, called once per block of filter output, then stopped
+// It keeps what it needs between blocks in demod->demod_state
 struct demodtab {
   enum demod_type demod_type;
   char name[16];
-  void *(*demod)(void *); // Address of demodulator routine
+  int (*start)(struct demod *);  // Set up demod_state and the channel's filter output
+  void (*demod)(struct demod *); // Demodulate one block
+  void (*stop)(struct demod *);  // Free what start allocated
 };
 extern struct demodtab Demodtab[];
 extern int Ndemod;
@@ -40,6 +110,7 @@ struct modetab {
   int channels;     // 1 or 2
   int isb;
   int flat;
+  int min_phase;    // Minimum phase predetection filter
   float shift;      // Audio frequency shift (mainly for CW/RTTY)
   float tunestep;   // Default tuning step
   float low;        // Lower edge of IF passband
@@ -49,21 +120,14 @@ struct modetab {
   float hangtime;
 };
 
-#define PKTSIZE 16384
-// Incoming RTP packets
-// This should probably be extracted into a more general RTP library
-struct packet {
-  struct packet *next;
-  struct rtp_header rtp;
-  unsigned char *data;
-  int len;
-  unsigned char content[PKTSIZE];
-};
-
 // Demodulator state block
 struct demod {
+  struct demod *primary;  // Channel owning the input and forward FFT; NULL if this is it
+  struct demod *next;     // List of all channels, starting with the primary
+
   struct {
     int fd;       // Socket for raw incoming I/Q data
+    struct mrecv *mrecv; // Batched receive on fd
     int ctl_fd;   // Socket for commands to front end
 
     char dest_address_text[256];
@@ -72,10 +136,15 @@ struct demod {
     struct rtp_state rtp; // State of the I/Q RTP receiver
     long long samples;    // Count of raw I/Q samples received
     int samprate;
-    // queue of RTP packets between rtp-recv and procsamp
-    pthread_cond_t qcond;
-    pthread_mutex_t qmutex;
-    struct packet *queue;
+    // Ring of RTP packets between rtp-recv and procsamp
+    struct pktring *ring;
+    int in_cnt;           // Samples so far in the filter's input block
+    float block_energy;   // Smoothed input energy, for if_power
+    long long arrival;    // Packet being processed arrived, CLOCK_MONOTONIC ns
+    long long dequeue;    // and left the ring
+    long long first;      // Arrival of the current block's first sample
+    struct blocktime blocktime[BLOCKTIMES]; // Indexed by filter block number, for the channels' demodulators
+    struct noise noise;
   } input;
 
   // Front end hardware information
@@ -109,9 +178,10 @@ struct demod {
 
   pthread_t doppler_thread;          // Thread that reads file and sets doppler (optional)
   char *doppler_command;             // Command to execute for tracking
-  struct osc doppler;
+  struct osc doppler;    // Doppler and second LO are applied by downconvert(), not stepped per sample
   struct osc second_LO;
   struct osc shift;
+  struct osc fine;    // Tuning residual after bin rotation, at output sample rate
 
   // Experimental notch filter
   struct notchfilter *nf;
@@ -121,9 +191,10 @@ struct demod {
     struct filter_in *in;
     struct filter_out *out;
     int L;            // Signal samples in FFT buffer
-    int M;            // Samples in filter impulse response
+    int M;            // Samples in filter impulse response, or in its last partition
+    int partitions;   // Impulse response pieces; the others are L samples each
     int interpolate;  // Input sample ratio multiplier, should be power of 2
-    int decimate;     // output sample rate divisor, should be power of 2
+    int decimate;     // output sample rate divisor, picked by set_mode() for the passband
     float low;        // Edges of filter band
     float high;
     // Window shape factor for Kaiser window
@@ -132,12 +203,18 @@ struct demod {
     float kaiser_beta;
     float noise_bandwidth; // noise bandwidth relative to sample rate
     int isb;     // Independent sideband mode
+    int min_phase; // Minimum phase response: less delay, but not linear phase
+    int rotate;  // FFT bins by which the input spectrum is rotated to tune us
+    float post_delay; // Group delay of the demodulator's own filtering after detection, channel samples
+    struct noise_mask noise_mask; // Noise slices the passband touches, kept by compute_n0()
   } filter;
 
-  // Mode-specific demodulator thread
+  // Mode-specific demodulator, run by the pool each block or, without a pool, in its own thread
   // Run output half of pre-detection filter and pass through AM, FM or linear demodulator
   // The AM and linear demodulators send baseband audio directly to the network;
   // the FM demodulator performs further audio filtering
+  void *demod_state;          // The demodulator's own, between blocks
+  int running;                // Started, and run by the pool each block
   pthread_t demod_thread;
   int terminate;              // set to 1 by set_mode() to request graceful termination
 
@@ -176,9 +253,26 @@ struct demod {
   
   struct filter_in *audio_master; // FM only
 
+  // The input stages are only measured on the primary channel
+  struct latency latency[LAT_STAGES];
+
+  // CPU time used by each thread, ns, updated now and then by the thread itself
+  // The input and status threads' are kept in the primary channel
+  long long cpu_time[THREADS];
+
+  // Compute load as last reported by the status thread, once a second
+  struct {
+    long long time;                // When, CLOCK_MONOTONIC ns
+    long long samples;             // input.samples then
+    long long cpu_time[THREADS]; // cpu_time[] then
+    float cpu[THREADS];        // Fraction of a CPU used by each thread since the time before
+    float realtime;                // CPU time per unit of signal time, procsamp + demodulator + PL
+  } load;
+
   // Output
   struct {
     int samprate;       // Audio D/A sample rate (usually 48 kHz)
+    struct resampler *resampler; // From the channel's decimated rate to samprate; NULL when they're the same
     // RTP network streaming
     int silent; // last packet was suppressed (used to generate RTP mark bit)
     struct rtp_state rtp;
@@ -186,18 +280,32 @@ struct demod {
     struct sockaddr_storage source_address;
     struct sockaddr_storage dest_address;
     int fd;         // File descriptor for multicast output
+    struct msend *msend; // This channel's transmit queue on fd
     int rtcp_fd;    // File descriptor for RTP control protocol
     int status_fd;  // File descriptor for receiver status
     int channels;   // 1 = mono, 2 = stereo
+    struct state *state; // Last status sent, for compact_packet()
+    struct latency_view *latency_view; // Status thread's view of latency[], LAT_STAGES of them
+    FILE *pcm_file; // When set, raw 16-bit host order PCM goes here instead of the network
+    long long pcm_skip;       // Frames still to drop from the start of pcm_file, the filter's delay
+    atomic_llong pcm_frames;  // Frames still to write to pcm_file, so it ends where the input did
   } output;
 };
 extern char Libdir[];
+extern const float IF_EXCLUDE;
 extern int Tunestep;
 extern struct modetab Modes[];
 extern int Nmodes;
 extern int Verbose;
 extern int SDR_correct;
 
+// All active channels, protected by Channel_mutex
+extern struct demod *Channels;
+extern pthread_mutex_t Channel_mutex;
+
+// Runs every channel's demodulator on each input block; NULL gives each channel its own thread
+extern struct pool *Demod_pool;
+
 // Functions/methods to control a demod instance
 void *filtert(void *arg);
 int LO2_in_range(struct demod *,double f,int);
@@ -213,9 +321,19 @@ double get_doppler(struct demod *);
 double get_doppler_rate(struct demod *);
 int set_doppler(struct demod *,double,double);
 int set_mode(struct demod *,const char *,int);
+int set_passband(struct demod *,float,float);
+void stop_demod(struct demod *);
+void run_channels(void);
 int set_cal(struct demod *,double);
 void *proc_samples(void *);
-const float compute_n0(struct demod const *);
+void input_samples(struct demod *,void const *,int,int);
+void input_gap(struct demod *,int);
+void update_noise(struct demod *);
+const float compute_n0(struct demod *);
+int downconvert(struct demod *);
+struct demod *create_channel(struct demod *,uint32_t);
+struct demod *lookup_channel(uint32_t);
+int delete_channel(struct demod *);
 
 // Load mode definition table
 int readmodes(char *);
@@ -229,15 +347,26 @@ void *display(void *);
 void *keyboard(void *);
 void *doppler(void *);
 void *status(void *);
+void *recv_commands(void *);
 
 
-// Demodulator thread entry points
-void *demod_fm(void *);
-void *demod_am(void *);
-void *demod_linear(void *);
+// Demodulators; see struct demodtab
+int start_fm(struct demod *);
+void demod_fm(struct demod *);
+void stop_fm(struct demod *);
+int start_am(struct demod *);
+void demod_am(struct demod *);
+void stop_am(struct demod *);
+int start_linear(struct demod *);
+void demod_linear(struct demod *);
+void stop_linear(struct demod *);
 
+#define PCM_BUFSIZE 480        // 16-bit word count; must fit in Ethernet MTU
+#define PCM_PKTSIZE (RTP_MIN_SIZE + 2 * PCM_BUFSIZE) // Largest PCM datagram, bytes
+void output_latency(struct demod *,long long,long long);
 int send_mono_output(struct demod *,const float *,int);
 int send_stereo_output(struct demod *,const float *,int);
+void skip_output(struct demod *,long long);
 int setup_output(struct demod *,int);
 void output_cleanup(void *);
 
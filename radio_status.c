@@ -27,188 +27,259 @@
 
 uint64_t Commands;
 
-struct state State[256];
+static void send_channel_status(struct demod *,int);
+static void decode_radio_commands(struct demod *,unsigned char const *,int);
 
-// Thread to periodically transmit receiver state
+// Thread to periodically transmit receiver state, one packet per channel
 void *send_status(void *arg){
   pthread_setname("status");
   assert(arg != NULL);
-  struct demod * const demod = arg;
+  struct demod * const primary = arg;
 
-  memset(State,0,sizeof(State));
-  
   for(int count=0;;count++){
-    if(demod->output.status_fd <= 0){
+    if(primary->output.status_fd <= 0){
       usleep(1);
       continue;
     }
     // emit status packets indefinitely
-    unsigned char packet[2048],*bp;
-    memset(packet,0,sizeof(packet));
-    bp = packet;
-
-    *bp++ = 0; // Response (not a command);
-
-    struct timeval tp;
-    gettimeofday(&tp,NULL);
-    // Timestamp is in nanoseconds for futureproofing, but time of day is only available in microsec
-    long long timestamp = ((tp.tv_sec - UNIX_EPOCH + GPS_UTC_OFFSET) * 1000000LL + tp.tv_usec) * 1000LL;
-    encode_int64(&bp,GPS_TIME,timestamp);
-    encode_int64(&bp,COMMANDS,Commands);
-    // Source information
-    // Who's sending us information
-    {
-      struct sockaddr_in *sin;
-      struct sockaddr_in6 *sin6;
-      *bp++ = INPUT_SOURCE_SOCKET;
-      switch(demod->input.source_address.ss_family){
-      case AF_INET:
-	sin = (struct sockaddr_in *)&demod->input.source_address;
-	*bp++= 6;
-	memcpy(bp,&sin->sin_addr.s_addr,4); // Already in network order
-	bp += 4;
-	memcpy(bp,&sin->sin_port,2);
-	bp += 2;
-	break;
-      case AF_INET6:
-	sin6 = (struct sockaddr_in6 *)&demod->input.source_address;
-	*bp++ = 10;
-	memcpy(bp,&sin6->sin6_addr,8);
-	bp += 8;
-	memcpy(bp,&sin6->sin6_port,2);
-	bp += 2;
-	break;
-      default:
-	break;
-      }
-    }
-    // Destination address (usually multicast) and port on which we're getting input data
-    {
-      struct sockaddr_in *sin;
-      struct sockaddr_in6 *sin6;
-      *bp++ = INPUT_DEST_SOCKET;
-      switch(demod->input.dest_address.ss_family){
-      case AF_INET:
-	sin = (struct sockaddr_in *)&demod->input.dest_address;
-	*bp++ = 6;
-	memcpy(bp,&sin->sin_addr.s_addr,4); // Already in network order
-	bp += 4;
-	memcpy(bp,&sin->sin_port,2);
-	bp += 2;
-	break;
-      case AF_INET6:
-	sin6 = (struct sockaddr_in6 *)&demod->input.dest_address;
-	*bp++ = 10;
-	memcpy(bp,&sin6->sin6_addr,8);
-	bp += 8;
-	memcpy(bp,&sin6->sin6_port,2);
-	bp += 2;
-	break;
-      default:
-	break;
-      }
+    // Every 10th packet is full state; all others include changes only
+    primary->cpu_time[THREAD_STATUS] = thread_cputime();
+    pthread_mutex_lock(&Channel_mutex);
+    for(struct demod *demod = Channels; demod != NULL; demod = demod->next)
+      send_channel_status(demod,(count % 10) == 0);
+    pthread_mutex_unlock(&Channel_mutex);
+    usleep(100000);
+  }
+}
+
+static void send_channel_status(struct demod * const demod,int const full){
+  // Input and front end state belongs to the primary channel
+  struct demod const * const input = demod->primary ? demod->primary : demod;
+
+  if(demod->output.state == NULL){
+    demod->output.state = calloc(256,sizeof(struct state));
+    if(demod->output.state == NULL)
+      return;
+  }
+  unsigned char packet[2048],*bp;
+  memset(packet,0,sizeof(packet));
+  bp = packet;
+
+  *bp++ = 0; // Response (not a command);
+
+  struct timeval tp;
+  gettimeofday(&tp,NULL);
+  // Timestamp is in nanoseconds for futureproofing, but time of day is only available in microsec
+  long long timestamp = ((tp.tv_sec - UNIX_EPOCH + GPS_UTC_OFFSET) * 1000000LL + tp.tv_usec) * 1000LL;
+  encode_int64(&bp,GPS_TIME,timestamp);
+  encode_int64(&bp,COMMANDS,Commands);
+  // Source information
+  // Who's sending us information
+  {
+    struct sockaddr_in *sin;
+    struct sockaddr_in6 *sin6;
+    *bp++ = INPUT_SOURCE_SOCKET;
+    switch(input->input.source_address.ss_family){
+    case AF_INET:
+      sin = (struct sockaddr_in *)&input->input.source_address;
+      *bp++= 6;
+      memcpy(bp,&sin->sin_addr.s_addr,4); // Already in network order
+      bp += 4;
+      memcpy(bp,&sin->sin_port,2);
+      bp += 2;
+      break;
+    case AF_INET6:
+      sin6 = (struct sockaddr_in6 *)&input->input.source_address;
+      *bp++ = 10;
+      memcpy(bp,&sin6->sin6_addr,8);
+      bp += 8;
+      memcpy(bp,&sin6->sin6_port,2);
+      bp += 2;
+      break;
+    default:
+      break;
     }
-    encode_int32(&bp,INPUT_SSRC,demod->input.rtp.ssrc);
-    encode_int32(&bp,INPUT_SAMPRATE,demod->sdr.status.samprate);
-    // Where we're sending output
-    {
-      struct sockaddr_in *sin;
-      struct sockaddr_in6 *sin6;
-      *bp++ = OUTPUT_DEST_SOCKET;
-      switch(demod->output.dest_address.ss_family){
-      case AF_INET:
-	sin = (struct sockaddr_in *)&demod->output.dest_address;
-	*bp++ = 6;
-	memcpy(bp,&sin->sin_addr.s_addr,4); // Already in network order
-	bp += 4;
-	memcpy(bp,&sin->sin_port,2);
-	bp += 2;
-	break;
-      case AF_INET6:
-	sin6 = (struct sockaddr_in6 *)&demod->output.dest_address;
-	*bp++ = 10;
-	memcpy(bp,&sin6->sin6_addr,8);
-	bp += 8;
-	memcpy(bp,&sin6->sin6_port,2);
-	bp += 2;
-	break;
-      default:
-	break;
-      }
+  }
+  // Destination address (usually multicast) and port on which we're getting input data
+  {
+    struct sockaddr_in *sin;
+    struct sockaddr_in6 *sin6;
+    *bp++ = INPUT_DEST_SOCKET;
+    switch(input->input.dest_address.ss_family){
+    case AF_INET:
+      sin = (struct sockaddr_in *)&input->input.dest_address;
+      *bp++ = 6;
+      memcpy(bp,&sin->sin_addr.s_addr,4); // Already in network order
+      bp += 4;
+      memcpy(bp,&sin->sin_port,2);
+      bp += 2;
+      break;
+    case AF_INET6:
+      sin6 = (struct sockaddr_in6 *)&input->input.dest_address;
+      *bp++ = 10;
+      memcpy(bp,&sin6->sin6_addr,8);
+      bp += 8;
+      memcpy(bp,&sin6->sin6_port,2);
+      bp += 2;
+      break;
+    default:
+      break;
     }
-    encode_int32(&bp,OUTPUT_SSRC,demod->output.rtp.ssrc);
-    encode_byte(&bp,OUTPUT_TTL,Mcast_ttl);
-    encode_int32(&bp,OUTPUT_SAMPRATE,demod->output.samprate);
-    encode_int64(&bp,INPUT_PACKETS,demod->input.rtp.packets);
-    encode_int64(&bp,INPUT_SAMPLES,demod->input.samples);
-    encode_int64(&bp,INPUT_DROPS,demod->input.rtp.drops);
-    encode_int64(&bp,INPUT_DUPES,demod->input.rtp.dupes);
-    encode_int64(&bp,OUTPUT_PACKETS,demod->output.rtp.packets);
-
-    // Tuning
-    encode_double(&bp,RADIO_FREQUENCY,get_freq(demod));
-    encode_double(&bp,SECOND_LO_FREQUENCY,get_second_LO(demod));
-    encode_double(&bp,SHIFT_FREQUENCY,demod->shift.freq);
-
-    // Front end
-    encode_double(&bp,FIRST_LO_FREQUENCY,demod->sdr.status.frequency);
-    encode_byte(&bp,LNA_GAIN,demod->sdr.status.lna_gain);
-    encode_byte(&bp,MIXER_GAIN,demod->sdr.status.mixer_gain);
-    encode_byte(&bp,IF_GAIN,demod->sdr.status.if_gain);
-
-
-    // Doppler info
-    encode_double(&bp,DOPPLER_FREQUENCY,get_doppler(demod));
-    encode_double(&bp,DOPPLER_FREQUENCY_RATE,get_doppler_rate(demod));
-
-    // Filtering
-    encode_float(&bp,LOW_EDGE,demod->filter.low);
-    encode_float(&bp,HIGH_EDGE,demod->filter.high);
-    encode_float(&bp,KAISER_BETA,demod->filter.kaiser_beta);
-    encode_int32(&bp,FILTER_BLOCKSIZE,demod->filter.L);
-    encode_int32(&bp,FILTER_FIR_LENGTH,demod->filter.M);
-    if(demod->filter.out)
-      encode_float(&bp,NOISE_BANDWIDTH,demod->input.samprate * demod->filter.out->noise_gain);
-
-    // Signals - these ALWAYS change
-    encode_float(&bp,IF_POWER,demod->sig.if_power);
-    encode_float(&bp,BASEBAND_POWER,demod->sig.bb_power);
-    encode_float(&bp,NOISE_DENSITY,demod->sig.n0);
-
-    // Demodulation mode
-    encode_string(&bp,RADIO_MODE,demod->mode,strlen(demod->mode));
-    enum demod_type demod_type = Demodtab[demod->demod_type].demod_type;
-    encode_byte(&bp,DEMOD_MODE,demod_type);
-    switch(demod_type){
-    case AM_DEMOD:
-      encode_float(&bp,DEMOD_GAIN,demod->agc.gain);
+  }
+  encode_int32(&bp,INPUT_SSRC,input->input.rtp.ssrc);
+  encode_int32(&bp,INPUT_SAMPRATE,input->sdr.status.samprate);
+  // Where we're sending output
+  {
+    struct sockaddr_in *sin;
+    struct sockaddr_in6 *sin6;
+    *bp++ = OUTPUT_DEST_SOCKET;
+    switch(demod->output.dest_address.ss_family){
+    case AF_INET:
+      sin = (struct sockaddr_in *)&demod->output.dest_address;
+      *bp++ = 6;
+      memcpy(bp,&sin->sin_addr.s_addr,4); // Already in network order
+      bp += 4;
+      memcpy(bp,&sin->sin_port,2);
+      bp += 2;
       break;
-    case FM_DEMOD:
-      encode_float(&bp,PEAK_DEVIATION,demod->sig.pdeviation);
-      encode_float(&bp,PL_TONE,demod->sig.plfreq);
+    case AF_INET6:
+      sin6 = (struct sockaddr_in6 *)&demod->output.dest_address;
+      *bp++ = 10;
+      memcpy(bp,&sin6->sin6_addr,8);
+      bp += 8;
+      memcpy(bp,&sin6->sin6_port,2);
+      bp += 2;
+      break;
+    default:
+      break;
+    }
+  }
+  encode_int32(&bp,OUTPUT_SSRC,demod->output.rtp.ssrc);
+  encode_byte(&bp,OUTPUT_TTL,Mcast_ttl);
+  encode_int32(&bp,OUTPUT_SAMPRATE,demod->output.samprate);
+  encode_int64(&bp,INPUT_PACKETS,input->input.rtp.packets);
+  encode_int64(&bp,INPUT_SAMPLES,input->input.samples);
+  encode_int64(&bp,INPUT_DROPS,input->input.rtp.drops);
+  encode_int64(&bp,INPUT_DUPES,input->input.rtp.dupes);
+  encode_int64(&bp,OUTPUT_PACKETS,demod->output.rtp.packets);
+
+  // Tuning
+  encode_double(&bp,RADIO_FREQUENCY,get_freq(demod));
+  encode_double(&bp,SECOND_LO_FREQUENCY,get_second_LO(demod));
+  encode_double(&bp,SHIFT_FREQUENCY,demod->shift.freq);
+
+  // Front end
+  encode_double(&bp,FIRST_LO_FREQUENCY,input->sdr.status.frequency);
+  encode_byte(&bp,LNA_GAIN,input->sdr.status.lna_gain);
+  encode_byte(&bp,MIXER_GAIN,input->sdr.status.mixer_gain);
+  encode_byte(&bp,IF_GAIN,input->sdr.status.if_gain);
+
+
+  // Doppler info
+  encode_double(&bp,DOPPLER_FREQUENCY,get_doppler(demod));
+  encode_double(&bp,DOPPLER_FREQUENCY_RATE,get_doppler_rate(demod));
+
+  // Filtering
+  encode_float(&bp,LOW_EDGE,demod->filter.low);
+  encode_float(&bp,HIGH_EDGE,demod->filter.high);
+  encode_float(&bp,KAISER_BETA,demod->filter.kaiser_beta);
+  encode_int32(&bp,FILTER_BLOCKSIZE,demod->filter.L);
+  encode_int32(&bp,FILTER_FIR_LENGTH,demod->filter.M);
+  if(demod->filter.out)
+    encode_float(&bp,NOISE_BANDWIDTH,input->input.samprate * demod->filter.out->noise_gain);
+
+  // Signals - these ALWAYS change
+  encode_float(&bp,IF_POWER,input->sig.if_power);
+  encode_float(&bp,BASEBAND_POWER,demod->sig.bb_power);
+  encode_float(&bp,NOISE_DENSITY,demod->sig.n0);
+
+  // Demodulation mode
+  encode_string(&bp,RADIO_MODE,demod->mode,strlen(demod->mode));
+  enum demod_type demod_type = Demodtab[demod->demod_type].demod_type;
+  encode_byte(&bp,DEMOD_MODE,demod_type);
+  switch(demod_type){
+  case AM_DEMOD:
+    encode_float(&bp,DEMOD_GAIN,demod->agc.gain);
+    break;
+  case FM_DEMOD:
+    encode_float(&bp,PEAK_DEVIATION,demod->sig.pdeviation);
+    encode_float(&bp,PL_TONE,demod->sig.plfreq);
+    encode_float(&bp,FREQ_OFFSET,demod->sig.foffset);
+    encode_float(&bp,DEMOD_SNR,demod->sig.snr);
+    break;
+  case LINEAR_DEMOD:
+    encode_float(&bp,DEMOD_GAIN,demod->agc.gain);
+    encode_int32(&bp,INDEPENDENT_SIDEBAND,demod->filter.isb);
+    if(demod->opt.pll){
       encode_float(&bp,FREQ_OFFSET,demod->sig.foffset);
+      encode_float(&bp,PLL_PHASE,demod->sig.cphase);
       encode_float(&bp,DEMOD_SNR,demod->sig.snr);
-      break;
-    case LINEAR_DEMOD:
-      encode_float(&bp,DEMOD_GAIN,demod->agc.gain);
-      encode_int32(&bp,INDEPENDENT_SIDEBAND,demod->filter.isb);
-      if(demod->opt.pll){
-	encode_float(&bp,FREQ_OFFSET,demod->sig.foffset);
-	encode_float(&bp,PLL_PHASE,demod->sig.cphase);
-	encode_float(&bp,DEMOD_SNR,demod->sig.snr);
-	encode_byte(&bp,PLL_LOCK,demod->sig.pll_lock);
-	encode_byte(&bp,PLL_SQUARE,demod->opt.square);
+      encode_byte(&bp,PLL_LOCK,demod->sig.pll_lock);
+      encode_byte(&bp,PLL_SQUARE,demod->opt.square);
+    }
+    break;
+  }
+  encode_int32(&bp,OUTPUT_CHANNELS,demod->output.channels);
+
+  // Latency by stage. The input stages belong to the primary, which is always reported first,
+  // so the other channels just repeat its figures
+  if(demod->output.latency_view == NULL)
+    demod->output.latency_view = calloc(LAT_STAGES,sizeof(struct latency_view));
+  if(demod->output.latency_view != NULL && input->output.latency_view != NULL){
+    for(enum latency_stage stage = LAT_FILL; stage < LAT_STAGES; stage++){
+      struct latency_view *view;
+      if(stage < LAT_DEMOD){
+	view = &input->output.latency_view[stage];
+	if(demod == input)
+	  latency_stats(&demod->latency[stage],view);
+      } else {
+	view = &demod->output.latency_view[stage];
+	latency_stats(&demod->latency[stage],view);
       }
-      break;
+      encode_int32(&bp,LATENCY_FILL_P50 + 3*stage,view->p50);
+      encode_int32(&bp,LATENCY_FILL_P99 + 3*stage,view->p99);
+      encode_int32(&bp,LATENCY_FILL_MAX + 3*stage,view->max);
     }
-    encode_int32(&bp,OUTPUT_CHANNELS,demod->output.channels);
-    encode_eol(&bp);
+  }
 
-    // Every 10th packet is full state; all others include changes only
-    int len = compact_packet(&State[0],packet,(count % 10) == 0);
-    send(demod->output.status_fd,packet,len,0);
-    usleep(100000);
+  // Compute load, measured between full status packets
+  if(full){
+    long long const now = latency_clock();
+    long long used[THREADS];
+    for(enum thread_id t = 0; t < THREADS; t++)
+      used[t] = (t == THREAD_DEMOD || t == THREAD_PL) ? demod->cpu_time[t] : input->cpu_time[t];
+
+    if(demod->load.time != 0 && now > demod->load.time){
+      float const interval = 1e-9 * (now - demod->load.time);
+      for(enum thread_id t = 0; t < THREADS; t++){
+	long long const delta = used[t] - demod->load.cpu_time[t];
+	demod->load.cpu[t] = delta > 0 ? 1e-9 * delta / interval : 0; // A restarted thread starts over from zero
+      }
+      float const signal_time = (float)(input->input.samples - demod->load.samples) / input->input.samprate;
+      if(input->input.samprate > 0 && signal_time > 0)
+	demod->load.realtime = (demod->load.cpu[THREAD_PROC_SAMPLES] + demod->load.cpu[THREAD_DEMOD] + demod->load.cpu[THREAD_PL])
+	  * interval / signal_time;
+    }
+    demod->load.time = now;
+    demod->load.samples = input->input.samples;
+    memcpy(demod->load.cpu_time,used,sizeof(demod->load.cpu_time));
   }
+  // CPU_RTP_RECV through CPU_STATUS are in the same order as enum thread_id
+  for(enum thread_id t = 0; t < THREADS; t++)
+    encode_float(&bp,CPU_RTP_RECV + t,demod->load.cpu[t]);
+  if(input->input.ring != NULL){
+    encode_int32(&bp,INPUT_QUEUE_DEPTH,pktring_depth(input->input.ring));
+    encode_int32(&bp,INPUT_QUEUE_HWM,atomic_load(&input->input.ring->hwm));
+  }
+  if(input->filter.in != NULL)
+    encode_float(&bp,FFT_TIME,input->filter.in->fft_time);
+  if(demod->filter.out != NULL)
+    encode_float(&bp,IFFT_TIME,demod->filter.out->fft_time);
+  encode_float(&bp,REALTIME_LOAD,demod->load.realtime);
+  encode_eol(&bp);
+
+  int len = compact_packet(demod->output.state,packet,full);
+  send(demod->output.status_fd,packet,len,0);
 }
 
 
@@ -263,7 +334,6 @@ void decode_sdr_status(struct demod *demod,unsigned char *buffer,int length){
       break;
     case OUTPUT_SAMPRATE:
       demod->input.samprate = demod->sdr.status.samprate = decode_int(cp,optlen);
-      demod->filter.decimate = demod->sdr.status.samprate / demod->output.samprate;
       break;
     case GPS_TIME:
       demod->sdr.status.timestamp = decode_int(cp,optlen);
@@ -309,10 +379,14 @@ void decode_sdr_status(struct demod *demod,unsigned char *buffer,int length){
   if(gainchange)
     demod->sdr.gain_factor = powf(10.,-0.05*(demod->sdr.status.lna_gain + demod->sdr.status.if_gain + demod->sdr.status.mixer_gain));
   if(!isnan(nfreq) && demod->sdr.status.frequency != nfreq && demod->sdr.status.samprate != 0){
-    // Recalculate LO2
+    // Recalculate LO2 for every channel, since they all share LO1
     demod->sdr.status.frequency = nfreq;
-    double new_LO2 = -(demod->tune.freq - get_first_LO(demod));
-    set_second_LO(demod,new_LO2);
+    pthread_mutex_lock(&Channel_mutex);
+    for(struct demod *dp = Channels; dp != NULL; dp = dp->next){
+      double new_LO2 = -(dp->tune.freq - get_first_LO(demod));
+      set_second_LO(dp,new_LO2);
+    }
+    pthread_mutex_unlock(&Channel_mutex);
   }
   done:;
 }
@@ -320,3 +394,109 @@ void decode_sdr_status(struct demod *demod,unsigned char *buffer,int length){
 
 
   
+
+// Thread to receive commands on the output status group
+// Commands are TLV lists just like status, but with a leading 1 instead of 0
+// OUTPUT_SSRC selects the channel, defaulting to the primary
+// A command to an unknown SSRC with a nonzero RADIO_FREQUENCY creates a new channel
+// sharing the primary's input; a zero RADIO_FREQUENCY deletes a secondary channel
+void *recv_commands(void *arg){
+  pthread_setname("cmd");
+  assert(arg != NULL);
+  struct demod * const primary = arg;
+
+  int const fd = setup_mcast(primary->output.dest_address_text,NULL,0,0,2);
+  if(fd == -1){
+    fprintf(stderr,"Can't set up command input\n");
+    return NULL;
+  }
+  while(1){
+    unsigned char buffer[8192];
+
+    int const len = recv(fd,buffer,sizeof(buffer),0);
+    if(len <= 0){
+      sleep(1);
+      continue;
+    }
+    if(buffer[0] != 1)
+      continue; // Ignore status, including our own
+    Commands++;
+    decode_radio_commands(primary,buffer+1,len-1);
+  }
+}
+
+static void decode_radio_commands(struct demod * const primary,unsigned char const * const buffer,int const length){
+  unsigned char const *cp = buffer;
+  int have_ssrc = 0;
+  uint32_t ssrc = 0;
+  double freq = NAN;
+  float low = NAN;
+  float high = NAN;
+  char mode[sizeof(primary->mode)];
+  mode[0] = '\0';
+
+  while(cp - buffer < length){
+    enum status_type type = *cp++; // increment cp to length field
+
+    if(type == EOL)
+      break; // End of list
+
+    unsigned int optlen = *cp++;
+    if(cp - buffer + optlen >= length)
+      break; // Invalid length
+    switch(type){
+    case OUTPUT_SSRC:
+      ssrc = decode_int((unsigned char *)cp,optlen);
+      have_ssrc = 1;
+      break;
+    case RADIO_FREQUENCY:
+      freq = decode_double((unsigned char *)cp,optlen);
+      break;
+    case RADIO_MODE:
+      {
+	int const n = min(optlen,(unsigned int)sizeof(mode)-1);
+	memcpy(mode,cp,n);
+	mode[n] = '\0';
+      }
+      break;
+    case LOW_EDGE:
+      low = decode_float((unsigned char *)cp,optlen);
+      break;
+    case HIGH_EDGE:
+      high = decode_float((unsigned char *)cp,optlen);
+      break;
+    default:
+      break;
+    }
+    cp += optlen;
+  }
+  struct demod *demod = have_ssrc ? lookup_channel(ssrc) : primary;
+  if(demod == NULL){
+    // New channel
+    if(isnan(freq) || freq == 0)
+      return;
+    if((demod = create_channel(primary,ssrc)) == NULL)
+      return;
+    demod->tune.freq = freq;
+    if(!isnan(low))
+      demod->filter.low = low;
+    if(!isnan(high))
+      demod->filter.high = high;
+    if(set_mode(demod,strlen(mode) > 0 ? mode : primary->mode,0) != 0){
+      fprintf(stderr,"Can't create channel ssrc 0x%x in mode %s\n",ssrc,mode);
+      delete_channel(demod);
+    }
+    return;
+  }
+  if(freq == 0){
+    delete_channel(demod);
+    return;
+  }
+  if(strlen(mode) > 0)
+    set_mode(demod,mode,1);
+
+  if(!isnan(low) || !isnan(high))
+    set_passband(demod,low,high);
+  if(!isnan(freq))
+    set_freq(demod,freq,NAN);
+}
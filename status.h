@@ -69,6 +69,38 @@ enum status_type {
   PLL_PHASE,      // Linear PLL
 
   OUTPUT_CHANNELS, // 1 or 2 in Linear, otherwise 1
+
+  // Latency of each stage of 'radio', integer microseconds: median, 99th percentile and maximum over the last few seconds
+  LATENCY_FILL_P50,   // First sample of a block arriving to its last
+  LATENCY_FILL_P99,
+  LATENCY_FILL_MAX,
+  LATENCY_QUEUE_P50,  // Last packet of a block arriving in the socket to leaving the packet ring
+  LATENCY_QUEUE_P99,
+  LATENCY_QUEUE_MAX,
+  LATENCY_FILTER_P50, // Leaving the packet ring to the forward FFT being done
+  LATENCY_FILTER_P99,
+  LATENCY_FILTER_MAX,
+  LATENCY_DEMOD_P50,  // Forward FFT done to the demodulator handing over its audio
+  LATENCY_DEMOD_P99,
+  LATENCY_DEMOD_MAX,
+  LATENCY_SEND_P50,   // Audio handed over to the last of its packets being sent
+  LATENCY_SEND_P99,
+  LATENCY_SEND_MAX,
+  LATENCY_TOTAL_P50,  // First sample of a block arriving to its audio being sent
+  LATENCY_TOTAL_P99,
+  LATENCY_TOTAL_MAX,
+
+  // Compute load of 'radio', updated once a second
+  CPU_RTP_RECV,      // Fraction of one CPU used by each thread
+  CPU_PROC_SAMPLES,
+  CPU_DEMOD,
+  CPU_PL,            // FM only
+  CPU_STATUS,
+  INPUT_QUEUE_DEPTH, // I/Q packets waiting to be processed
+  INPUT_QUEUE_HWM,   // Most ever waiting
+  FFT_TIME,          // Forward FFT execution time per block, sec
+  IFFT_TIME,         // This channel's inverse FFT, sec
+  REALTIME_LOAD,     // CPU time spent by procsamp, demodulator and PL threads per unit of signal time
 };
 
 // Previous transmitted state, used to detect changes